@@ -0,0 +1,219 @@
+/********************************************************************
+ This file is part of the KDE project.
+
+Copyright (C) 2010 Nikhil Marathe <nsm.nikhil@gmail.com>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*********************************************************************/
+
+#include "cassette.h"
+
+#include <QCoreApplication>
+#include <QDir>
+#include <QVector>
+#include <QXmlStreamReader>
+#include <QXmlStreamWriter>
+
+#include <kdebug.h>
+
+#include <HUpnpCore/HActionArgument>
+#include <HUpnpCore/HStateVariableInfo>
+#include <HUpnpCore/HUpnpDataTypes>
+
+using namespace Herqq::Upnp;
+
+Cassette *Cassette::fromEnvironment()
+{
+    const QByteArray record = qgetenv( CASSETTE_RECORD_ENV );
+    if( !record.isEmpty() )
+        return new Cassette( Record, QFile::decodeName( record ) );
+
+    const QByteArray replay = qgetenv( CASSETTE_REPLAY_ENV );
+    if( !replay.isEmpty() )
+        return new Cassette( Replay, QFile::decodeName( replay ) );
+
+    return 0;
+}
+
+Cassette::Cassette( Mode mode, const QString &directory )
+    : m_mode( mode )
+    , m_realtime( !qgetenv( CASSETTE_REALTIME_ENV ).isEmpty() )
+    , m_writer( 0 )
+{
+    QDir dir( directory );
+    if( m_mode == Record ) {
+        dir.mkpath( QLatin1String(".") );
+        m_file.setFileName( dir.filePath( QString::number( QCoreApplication::applicationPid() )
+                                          + QLatin1String(".cassette") ) );
+        if( !m_file.open( QIODevice::WriteOnly | QIODevice::Truncate ) ) {
+            kDebug() << "Cannot record to" << m_file.fileName();
+            m_mode = Off;
+            return;
+        }
+        m_writer = new QXmlStreamWriter( &m_file );
+        m_writer->writeStartDocument();
+        m_writer->writeStartElement( QLatin1String("cassette") );
+        m_file.flush();
+        kDebug() << "Recording to" << m_file.fileName();
+    }
+    else if( m_mode == Replay ) {
+        foreach( const QString &fileName, dir.entryList( QStringList() << QLatin1String("*.cassette"), QDir::Files ) ) {
+            load( dir.filePath( fileName ) );
+        }
+        kDebug() << "Replaying" << m_interactions.size() << "interactions from" << directory;
+    }
+}
+
+Cassette::~Cassette()
+{
+    if( m_writer ) {
+        m_writer->writeEndElement();
+        m_writer->writeEndDocument();
+        delete m_writer;
+    }
+}
+
+QString Cassette::key( const QString &uuid, const QString &action, const Arguments &input )
+{
+    Arguments sorted = input;
+    qSort( sorted );
+    QString key = uuid + QLatin1Char('\n') + action;
+    typedef QPair<QString, QString> Argument;
+    foreach( const Argument &arg, sorted ) {
+        key += QLatin1Char('\n') + arg.first + QLatin1Char('=') + arg.second;
+    }
+    return key;
+}
+
+Cassette::Arguments Cassette::fromActionArguments( const HActionArguments &arguments )
+{
+    Arguments result;
+    foreach( const QString &name, arguments.names() ) {
+        result << qMakePair( name, arguments[name].value().toString() );
+    }
+    return result;
+}
+
+HActionArguments Cassette::toActionArguments( const Arguments &arguments )
+{
+    QVector<HActionArgument> vector;
+    typedef QPair<QString, QString> Argument;
+    foreach( const Argument &arg, arguments ) {
+        HActionArgument argument( arg.first, HStateVariableInfo( arg.first, HUpnpDataTypes::string ) );
+        argument.setValue( arg.second );
+        vector << argument;
+    }
+    return HActionArguments( vector );
+}
+
+void Cassette::record( const QString &uuid,
+                       const QString &action,
+                       const HActionArguments &input,
+                       const HActionArguments &output,
+                       bool ok,
+                       const QString &error,
+                       qint64 elapsed )
+{
+    if( !m_writer )
+        return;
+
+    m_writer->writeStartElement( QLatin1String("interaction") );
+    m_writer->writeAttribute( QLatin1String("device"), uuid );
+    m_writer->writeAttribute( QLatin1String("action"), action );
+    m_writer->writeAttribute( QLatin1String("ok"), ok ? QLatin1String("1") : QLatin1String("0") );
+    m_writer->writeAttribute( QLatin1String("elapsed"), QString::number( elapsed ) );
+    if( !error.isEmpty() )
+        m_writer->writeAttribute( QLatin1String("error"), error );
+
+    typedef QPair<QString, QString> Argument;
+    foreach( const Argument &arg, fromActionArguments( input ) ) {
+        m_writer->writeStartElement( QLatin1String("in") );
+        m_writer->writeAttribute( QLatin1String("name"), arg.first );
+        m_writer->writeCharacters( arg.second );
+        m_writer->writeEndElement();
+    }
+    foreach( const Argument &arg, fromActionArguments( output ) ) {
+        m_writer->writeStartElement( QLatin1String("out") );
+        m_writer->writeAttribute( QLatin1String("name"), arg.first );
+        m_writer->writeCharacters( arg.second );
+        m_writer->writeEndElement();
+    }
+    m_writer->writeEndElement();
+
+    // slaves are killed rather than shut down, so keep
+    // the file usable at all times
+    m_file.flush();
+}
+
+/**
+ * Slaves are usually killed before they can close the
+ * root element, so a premature end of document is expected
+ * and everything up to it is kept.
+ */
+void Cassette::load( const QString &fileName )
+{
+    QFile file( fileName );
+    if( !file.open( QIODevice::ReadOnly ) ) {
+        kDebug() << "Cannot replay" << fileName;
+        return;
+    }
+
+    QXmlStreamReader reader( &file );
+    while( reader.readNextStartElement() ) {
+        if( reader.name() == QLatin1String("cassette") )
+            continue;
+        if( reader.name() != QLatin1String("interaction") ) {
+            reader.skipCurrentElement();
+            continue;
+        }
+
+        const QXmlStreamAttributes attributes = reader.attributes();
+        const QString uuid = attributes.value( QLatin1String("device") ).toString();
+        const QString action = attributes.value( QLatin1String("action") ).toString();
+
+        Interaction interaction;
+        interaction.ok = attributes.value( QLatin1String("ok") ) == QLatin1String("1");
+        interaction.error = attributes.value( QLatin1String("error") ).toString();
+        interaction.elapsed = attributes.value( QLatin1String("elapsed") ).toString().toLongLong();
+
+        Arguments input;
+        while( reader.readNextStartElement() ) {
+            const QString name = reader.attributes().value( QLatin1String("name") ).toString();
+            if( reader.name() == QLatin1String("in") )
+                input << qMakePair( name, reader.readElementText() );
+            else if( reader.name() == QLatin1String("out") )
+                interaction.output << qMakePair( name, reader.readElementText() );
+            else
+                reader.skipCurrentElement();
+        }
+
+        if( !reader.hasError() )
+            m_interactions.insert( key( uuid, action, input ), interaction );
+    }
+
+    if( reader.hasError() && reader.error() != QXmlStreamReader::PrematureEndOfDocumentError )
+        kDebug() << "Error in" << fileName << reader.errorString();
+}
+
+bool Cassette::replay( const QString &uuid,
+                       const QString &action,
+                       const Arguments &input,
+                       Interaction *interaction ) const
+{
+    QHash<QString, Interaction>::ConstIterator it = m_interactions.find( key( uuid, action, input ) );
+    if( it == m_interactions.constEnd() )
+        return false;
+    *interaction = it.value();
+    return true;
+}
@@ -0,0 +1,122 @@
+/********************************************************************
+ This file is part of the KDE project.
+
+Copyright (C) 2010 Nikhil Marathe <nsm.nikhil@gmail.com>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*********************************************************************/
+
+#ifndef CASSETTE_H
+#define CASSETTE_H
+
+#include <QFile>
+#include <QHash>
+#include <QPair>
+#include <QStringList>
+
+#include <HUpnpCore/HActionArguments>
+
+class QXmlStreamWriter;
+
+#define CASSETTE_RECORD_ENV "KIO_UPNP_MS_RECORD"
+#define CASSETTE_REPLAY_ENV "KIO_UPNP_MS_REPLAY"
+#define CASSETTE_REALTIME_ENV "KIO_UPNP_MS_REPLAY_REALTIME"
+
+/**
+ * A Cassette records ContentDirectory action invocations,
+ * input and output arguments, to disk so that they can
+ * be replayed later without a network or a device.
+ *
+ * Recording is enabled by pointing the environment variable
+ * KIO_UPNP_MS_RECORD to a directory, replaying by pointing
+ * KIO_UPNP_MS_REPLAY to a directory holding recordings.
+ * Every slave process records into its own
+ * <directory>/<pid>.cassette file, replay loads every
+ * *.cassette file in the directory. Replies are delivered
+ * immediately, unless KIO_UPNP_MS_REPLAY_REALTIME is set, in
+ * which case they take as long as they took while recording.
+ *
+ * Invocations are matched on the device, the action name and
+ * the complete set of input arguments. So a replay only answers
+ * requests which were made in exactly the same way while
+ * recording.
+ */
+class Cassette
+{
+  public:
+    enum Mode {
+        Off,
+        Record,
+        Replay
+    };
+
+    typedef QList< QPair<QString, QString> > Arguments;
+
+    struct Interaction {
+        bool ok;
+        QString error;
+        Arguments output;
+        // how long the device took to answer
+        qint64 elapsed;
+    };
+
+    /**
+     * Returns a Cassette configured from the environment,
+     * or 0 if neither recording nor replay was requested.
+     */
+    static Cassette *fromEnvironment();
+
+    Cassette( Mode mode, const QString &directory );
+    ~Cassette();
+
+    Mode mode() const { return m_mode; }
+    bool realtime() const { return m_realtime; }
+
+    void record( const QString &uuid,
+                 const QString &action,
+                 const Herqq::Upnp::HActionArguments &input,
+                 const Herqq::Upnp::HActionArguments &output,
+                 bool ok,
+                 const QString &error,
+                 qint64 elapsed );
+
+    /**
+     * Looks up the recorded reply to @c action invoked on device
+     * @c uuid with @c input. Returns false if there is none.
+     */
+    bool replay( const QString &uuid,
+                 const QString &action,
+                 const Arguments &input,
+                 Interaction *interaction ) const;
+
+    /**
+     * Builds HActionArguments out of recorded name, value pairs.
+     * All arguments are typed as strings, which is how the
+     * slave reads them anyway.
+     */
+    static Herqq::Upnp::HActionArguments toActionArguments( const Arguments &arguments );
+    static Arguments fromActionArguments( const Herqq::Upnp::HActionArguments &arguments );
+
+  private:
+    static QString key( const QString &uuid, const QString &action, const Arguments &input );
+    void load( const QString &fileName );
+
+    Mode m_mode;
+    bool m_realtime;
+    QFile m_file;
+    QXmlStreamWriter *m_writer;
+    QHash<QString, Interaction> m_interactions;
+};
+
+#endif
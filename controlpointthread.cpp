@@ -26,6 +26,7 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include <KDirNotify>
 
 #include <QCoreApplication>
+#include <QTimer>
 #include <QXmlStreamReader>
 
 #include <HUpnpCore/HClientAction>
@@ -41,42 +42,45 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include <HUpnpCore/HEndpoint>
 #include <HUpnpCore/HResourceType>
 #include <HUpnpCore/HServiceId>
+#include <HUpnpCore/HStateVariableEvent>
 #include <HUpnpCore/HUdn>
 #include <HUpnpCore/HUpnp>
 
+#include "cassette.h"
+#include "metrics.h"
 #include "didlparser.h"
 #include "didlobjects.h"
+#include "listingparser.h"
 #include "upnp-ms-types.h"
 #include "objectcache.h"
+#include "pagingcontroller.h"
 #include "persistentaction.h"
+#include "tracer.h"
 
 using namespace Herqq::Upnp;
 
 /**
  * Fill UDSEntry @c entry,
- * setting uint @c property by retrieving
- * the value from the item/container @c object's meta-data
- * where the key is @c name.
+ * setting uint @c property from the item/container
+ * @c object's meta-data slot @c slot, if it was present.
  */
 static inline void fillMetadata( KIO::UDSEntry &entry, uint property,
-                          const DIDL::Object *object, const QString &name )
+                          const DIDL::Object *object, DIDL::Property slot )
 {
-    const DIDL::ExtraData data = object->data();
-    DIDL::ExtraData::ConstIterator it = data.find( name );
-    if( it != data.constEnd() )
-        entry.insert( property, it.value() );
+    const QString value = object->property( slot );
+    if( !value.isNull() )
+        entry.insert( property, value );
 }
 
 /**
  * Fill from resource attributes
  */
 static inline void fillResourceMetadata( KIO::UDSEntry &entry, uint property,
-                                         const DIDL::Item *object, const QString &name )
+                                         const DIDL::Item *object, DIDL::ResourceProperty slot )
 {
-    const DIDL::Resource resource = object->resource();
-    DIDL::Resource::ConstIterator it = resource.find( name );
-    if( it != resource.constEnd() )
-        entry.insert( property, it.value() );
+    const QString value = object->resource().value( slot );
+    if( !value.isNull() )
+        entry.insert( property, value );
 }
 
 namespace SearchRegExp
@@ -110,10 +114,21 @@ ControlPointThread::ControlPointThread( QObject *parent )
     : QObject( parent )
     , m_controlPoint( 0 )
     , m_searchListingCounter( 0 )
+    , m_cassette( Cassette::fromEnvironment() )
+    , m_replaySequence( 0 )
+    , m_lastResponseMsecs( 0 )
+    , m_cacheEntries( false )
+    , m_entryBatchSize( ENTRY_BATCH_SIZE )
+    , m_requestGeneration( 0 )
 {
+    m_pipeline.fillScheduled = false;
+    m_crawl.active = false;
+    m_notifyScheduled = false;
     //Herqq::Upnp::SetLoggingLevel( Herqq::Upnp::Debug );
     qRegisterMetaType<KIO::UDSEntry>();
+    qRegisterMetaType<KIO::UDSEntryList>();
     qRegisterMetaType<Herqq::Upnp::HActionArguments>();
+    m_replayClock.start();
 
     run();
 }
@@ -123,8 +138,11 @@ ControlPointThread::~ControlPointThread()
     foreach( MediaServerDevice dev, m_devices ) {
         delete dev.cache;
         dev.cache = NULL;
+        delete dev.paging;
+        dev.paging = NULL;
     }
     delete m_controlPoint;
+    delete m_cassette;
 }
 
 void ControlPointThread::run()
@@ -134,6 +152,9 @@ void ControlPointThread::run()
     // should take place in run()
     HControlPointConfiguration config;
     config.setAutoDiscovery(false);
+    // only the ContentDirectory's events are of interest,
+    // see subscribeUpdates()
+    config.setSubscribeToEvents(false);
     m_controlPoint = new HControlPoint( config, this );
     connect(m_controlPoint,
             SIGNAL(rootDeviceOnline(Herqq::Upnp::HClientDevice *)),
@@ -158,7 +179,10 @@ void ControlPointThread::rootDeviceOnline(HClientDevice *device) // SLOT
     MediaServerDevice &dev = m_devices[device->info().udn().toSimpleUuid()];
     dev.device = device;
     dev.info = device->info();
-    dev.cache = new ObjectCache( this );
+    dev.uuid = device->info().udn().toSimpleUuid();
+    dev.cache = new ObjectCache( this, dev.uuid );
+    dev.paging = new PagingController;
+    subscribeUpdates( dev );
 
     HClientAction *searchCapAction = contentDirectory(dev.device)->actions()["GetSearchCapabilities"];
     Q_ASSERT( searchCapAction );
@@ -178,7 +202,6 @@ void ControlPointThread::rootDeviceOnline(HClientDevice *device) // SLOT
 
 void ControlPointThread::searchCapabilitiesInvokeDone(Herqq::Upnp::HClientAction *action, const Herqq::Upnp::HClientActionOp &op, bool ok, QString errorString ) // SLOT
 {
-    Q_UNUSED( errorString );
     PersistentAction *pAction = static_cast<PersistentAction *>( QObject::sender() );
     pAction->deleteLater();
 
@@ -187,6 +210,12 @@ void ControlPointThread::searchCapabilitiesInvokeDone(Herqq::Upnp::HClientAction
     Q_ASSERT( device );
     MediaServerDevice &dev = m_devices[device->info().udn().toSimpleUuid()];
 
+    if( recording() ) {
+        m_cassette->record( dev.uuid, action->info().name(),
+                            op.inputArguments(), op.outputArguments(),
+                            ok, errorString, pAction->elapsed() );
+    }
+
     if( !ok ) {
         dev.searchCapabilities = QStringList();
         // no info, so error
@@ -200,9 +229,218 @@ void ControlPointThread::searchCapabilitiesInvokeDone(Herqq::Upnp::HClientAction
 
     dev.searchCapabilities = reply.split(QLatin1String(","), QString::SkipEmptyParts);
 
+    HClientAction *sortCapAction = contentDirectory(dev.device)->actions()["GetSortCapabilities"];
+    if( !sortCapAction ) {
+        dev.sortCapabilities = QStringList();
+        fetchSystemUpdateId( dev );
+        return;
+    }
+
+    PersistentAction *sortAction = new PersistentAction( sortCapAction, this, 1 ); // try just once
+
+    connect( sortAction,
+             SIGNAL( invokeComplete(Herqq::Upnp::HClientAction*, const Herqq::Upnp::HClientActionOp&, bool, QString ) ),
+             this,
+             SLOT( sortCapabilitiesInvokeDone(Herqq::Upnp::HClientAction*, const Herqq::Upnp::HClientActionOp&, bool, QString ) ) );
+
+    sortAction->invoke( sortCapAction->info().inputArguments() );
+}
+
+void ControlPointThread::sortCapabilitiesInvokeDone(Herqq::Upnp::HClientAction *action, const Herqq::Upnp::HClientActionOp &op, bool ok, QString errorString ) // SLOT
+{
+    PersistentAction *pAction = static_cast<PersistentAction *>( QObject::sender() );
+    pAction->deleteLater();
+
+    // NOTE as a reference!
+    HClientDevice *device = action->parentService()->parentDevice();
+    Q_ASSERT( device );
+    MediaServerDevice &dev = m_devices[device->info().udn().toSimpleUuid()];
+
+    if( recording() ) {
+        m_cassette->record( dev.uuid, action->info().name(),
+                            op.inputArguments(), op.outputArguments(),
+                            ok, errorString, pAction->elapsed() );
+    }
+
+    // unlike searching, listings work without sorting,
+    // so the device is usable either way
+    dev.sortCapabilities = QStringList();
+    if( ok ) {
+        HActionArguments output = op.outputArguments();
+        dev.sortCapabilities = output[QLatin1String("SortCaps")].value().toString()
+                                  .split(QLatin1String(","), QString::SkipEmptyParts);
+    }
+
+    fetchSystemUpdateId( dev );
+}
+
+/**
+ * The last step of setting up a device, its SystemUpdateID
+ * tells whether the PathIndex earlier slaves left still holds.
+ */
+void ControlPointThread::fetchSystemUpdateId( MediaServerDevice &dev )
+{
+    HClientAction *updateIdAction = contentDirectory(dev.device)->actions()["GetSystemUpdateID"];
+    if( !updateIdAction ) {
+        emit deviceReady();
+        return;
+    }
+
+    PersistentAction *action = new PersistentAction( updateIdAction, this, 1 ); // try just once
+
+    connect( action,
+             SIGNAL( invokeComplete(Herqq::Upnp::HClientAction*, const Herqq::Upnp::HClientActionOp&, bool, QString ) ),
+             this,
+             SLOT( systemUpdateIdInvokeDone(Herqq::Upnp::HClientAction*, const Herqq::Upnp::HClientActionOp&, bool, QString ) ) );
+
+    action->invoke( updateIdAction->info().inputArguments() );
+}
+
+void ControlPointThread::systemUpdateIdInvokeDone(Herqq::Upnp::HClientAction *action, const Herqq::Upnp::HClientActionOp &op, bool ok, QString errorString ) // SLOT
+{
+    PersistentAction *pAction = static_cast<PersistentAction *>( QObject::sender() );
+    pAction->deleteLater();
+
+    // NOTE as a reference!
+    HClientDevice *device = action->parentService()->parentDevice();
+    Q_ASSERT( device );
+    MediaServerDevice &dev = m_devices[device->info().udn().toSimpleUuid()];
+
+    if( recording() ) {
+        m_cassette->record( dev.uuid, action->info().name(),
+                            op.inputArguments(), op.outputArguments(),
+                            ok, errorString, pAction->elapsed() );
+    }
+
+    // without it, every path is resolved from scratch
+    if( ok ) {
+        HActionArguments output = op.outputArguments();
+        dev.systemUpdateId = output[QLatin1String("Id")].value().toString();
+        dev.cache->openIndex( dev.systemUpdateId );
+    }
+
     emit deviceReady();
 }
 
+/**
+ * Has the device tell us about changes, so that cached
+ * objects can be kept for as long as they are valid.
+ * Any change changes the SystemUpdateID, ContainerUpdateIDs
+ * is optional and tells which containers changed.
+ */
+void ControlPointThread::subscribeUpdates( MediaServerDevice &dev )
+{
+    HClientService *service = contentDirectory( dev.device );
+    if( !service )
+        return;
+
+    const HClientStateVariables &variables = service->stateVariables();
+    const HClientStateVariable *systemUpdateId = variables.value( QLatin1String("SystemUpdateID") );
+    const HClientStateVariable *containerUpdateIds = variables.value( QLatin1String("ContainerUpdateIDs") );
+    if( !systemUpdateId )
+        return;
+
+    connect( systemUpdateId,
+             SIGNAL( valueChanged( const Herqq::Upnp::HClientStateVariable *, const Herqq::Upnp::HStateVariableEvent & ) ),
+             this,
+             SLOT( systemUpdateIdChanged( const Herqq::Upnp::HClientStateVariable *, const Herqq::Upnp::HStateVariableEvent & ) ) );
+    if( containerUpdateIds ) {
+        connect( containerUpdateIds,
+                 SIGNAL( valueChanged( const Herqq::Upnp::HClientStateVariable *, const Herqq::Upnp::HStateVariableEvent & ) ),
+                 this,
+                 SLOT( containerUpdateIdsChanged( const Herqq::Upnp::HClientStateVariable *, const Herqq::Upnp::HStateVariableEvent & ) ) );
+    }
+
+    if( !m_controlPoint->subscribeEvents( service ) )
+        kDebug() << "Cannot subscribe to the events of" << dev.uuid << m_controlPoint->errorDescription();
+}
+
+/**
+ * The value is a comma separated list of
+ * (container ID, its new update ID) pairs.
+ */
+void ControlPointThread::containerUpdateIdsChanged( const HClientStateVariable *source, const HStateVariableEvent &event ) // SLOT
+{
+    const QString uuid = source->parentService()->parentDevice()->info().udn().toSimpleUuid();
+    if( !m_devices.contains( uuid ) || !m_devices[uuid].cache )
+        return;
+    ObjectCache *cache = m_devices[uuid].cache;
+
+    const QStringList values = event.newValue().toString().split( QLatin1Char(',') );
+    for( int i = 0; i + 1 < values.size(); i += 2 ) {
+        const QString id = values[i];
+        // update() only knows containers which were resolved or
+        // listed, changes to any other are of no concern
+        if( cache->update( id, values[i+1] ) )
+            containerChanged( uuid, cache, id );
+    }
+}
+
+void ControlPointThread::systemUpdateIdChanged( const HClientStateVariable *source, const HStateVariableEvent &event ) // SLOT
+{
+    const QString uuid = source->parentService()->parentDevice()->info().udn().toSimpleUuid();
+    if( !m_devices.contains( uuid ) || !m_devices[uuid].cache )
+        return;
+
+    // NOTE as a reference!
+    MediaServerDevice &dev = m_devices[uuid];
+    const QString systemUpdateId = event.newValue().toString();
+    // the first event after subscribing just tells the current
+    // value, which may even come before GetSystemUpdateID's
+    const bool changed = !dev.systemUpdateId.isEmpty() && systemUpdateId != dev.systemUpdateId;
+    dev.systemUpdateId = systemUpdateId;
+    if( m_currentDevice.uuid == uuid )
+        m_currentDevice.systemUpdateId = systemUpdateId;
+    if( !changed )
+        return;
+
+    dev.cache->discardIndex();
+    if( source->parentService()->stateVariables().contains( QLatin1String("ContainerUpdateIDs") ) )
+        return;
+
+    // no telling what changed
+    Metrics::forDevice( uuid )->containersChanged++;
+    dev.cache->reset();
+    notifyChanged( uuid, QString() );
+}
+
+/**
+ * Drops what @c cache knows of the container @c id and
+ * its children, and has the directory listed again.
+ */
+void ControlPointThread::containerChanged( const QString &uuid, ObjectCache *cache, const QString &id )
+{
+    Metrics::forDevice( uuid )->containersChanged++;
+    const QString path = cache->pathForId( id );
+    cache->invalidate( id );
+    notifyChanged( uuid, path );
+}
+
+void ControlPointThread::notifyChanged( const QString &uuid, const QString &path )
+{
+    m_changedDirectories.insert( QLatin1String("upnp-ms://") + uuid
+                                 + ( path.isEmpty() ? QLatin1String("/") : path ) );
+    if( !m_notifyScheduled ) {
+        m_notifyScheduled = true;
+        QTimer::singleShot( UPDATE_NOTIFY_MSECS, this, SLOT( emitChangeNotifications() ) );
+    }
+}
+
+/**
+ * Directory listers list the directories again, and
+ * only those they are showing.
+ */
+void ControlPointThread::emitChangeNotifications() // SLOT
+{
+    m_notifyScheduled = false;
+    foreach( const QString &url, m_changedDirectories ) {
+        kDebug() << "Changed" << url;
+        Metrics::forDevice( KUrl( url ).host() )->notifications++;
+        OrgKdeKDirNotifyInterface::emitFilesAdded( url );
+    }
+    m_changedDirectories.clear();
+}
+
 void ControlPointThread::rootDeviceOffline(HClientDevice *device) // SLOT
 {
     // if we aren't valid, we don't really care about
@@ -225,6 +463,9 @@ void ControlPointThread::rootDeviceOffline(HClientDevice *device) // SLOT
  */
 bool ControlPointThread::updateDeviceInfo( const KUrl& url )
 {
+    TraceSpan span( "updateDeviceInfo" );
+    span.setArgument( "device", url.host() );
+
     QString udn = QLatin1String("uuid:") + url.host();
 
     // the device is definitely present, so we let the scan fill in
@@ -232,8 +473,11 @@ bool ControlPointThread::updateDeviceInfo( const KUrl& url )
     MediaServerDevice dev;
     dev.device = NULL;
     dev.info = HDeviceInfo();
+    dev.uuid = url.host();
     dev.cache = NULL;
+    dev.paging = NULL;
     dev.searchCapabilities = QStringList();
+    dev.sortCapabilities = QStringList();
     m_devices[url.host()] = dev;
 
     HDiscoveryType specific( udn, Herqq::Upnp::LooseChecks );
@@ -287,14 +531,61 @@ HClientService* ControlPointThread::contentDirectory(HClientDevice *forDevice) c
 
 HClientAction* ControlPointThread::browseAction() const
 {
+    // there is no device to get one from
+    if( replaying() )
+        return NULL;
     return contentDirectory() ? contentDirectory()->actions()[QLatin1String("Browse")] : NULL;
 }
 
 HClientAction* ControlPointThread::searchAction() const
 {
+    if( replaying() )
+        return NULL;
     return contentDirectory() ? contentDirectory()->actions()[QLatin1String("Search")] : NULL;
 }
 
+bool ControlPointThread::replaying() const
+{
+    return m_cassette && m_cassette->mode() == Cassette::Replay;
+}
+
+bool ControlPointThread::recording() const
+{
+    return m_cassette && m_cassette->mode() == Cassette::Record;
+}
+
+/**
+ * Emits browseResult() for @c op, unless it was requested in
+ * an earlier @c generation, by a pipeline or crawl which has
+ * since been stopped.
+ */
+void ControlPointThread::emitBrowseResult( const HClientActionOp &op, uint generation )
+{
+    if( generation != m_requestGeneration ) {
+        HActionArguments input = op.inputArguments();
+        kDebug() << "Dropping reply to abandoned page"
+                 << input[QLatin1String("ObjectID")].value().toString()
+                 << input[QLatin1String("StartingIndex")].value().toUInt();
+        // it may have been what held the current pipeline back
+        if( !m_pipeline.id.isNull() && !m_pipeline.fillScheduled )
+            fillPipeline();
+        if( m_crawl.active )
+            fillCrawl();
+        return;
+    }
+    // what later events are compared against, a reply
+    // may also be the first to tell of a change
+    HActionArguments input = op.inputArguments();
+    HActionArguments output = op.outputArguments();
+    if( input[QLatin1String("BrowseFlag")].value().toString() == QLatin1String(BROWSE_DIRECT_CHILDREN)
+        && output[QLatin1String("UpdateID")].isValid() ) {
+        const QString id = input[QLatin1String("ObjectID")].value().toString();
+        if( m_currentDevice.cache->update( id, output[QLatin1String("UpdateID")].value().toString() ) )
+            containerChanged( m_currentDevice.uuid, m_currentDevice.cache, id );
+    }
+    emit browseResult( op );
+}
+
 bool ControlPointThread::ensureDevice( const KUrl &url )
 {
     // TODO probably list all media servers
@@ -311,6 +602,38 @@ bool ControlPointThread::ensureDevice( const KUrl &url )
         return true;
     }
 
+    if( replaying() ) {
+        // the cassette stands in for the device, there
+        // is nothing to discover
+        MediaServerDevice dev;
+        dev.device = NULL;
+        dev.info = HDeviceInfo();
+        dev.uuid = url.host();
+        dev.cache = new ObjectCache( this, dev.uuid );
+        dev.paging = new PagingController;
+
+        Cassette::Interaction caps;
+        if( m_cassette->replay( dev.uuid, QLatin1String("GetSearchCapabilities"), Cassette::Arguments(), &caps ) && caps.ok ) {
+            HActionArguments output = Cassette::toActionArguments( caps.output );
+            dev.searchCapabilities = output[QLatin1String("SearchCaps")].value().toString()
+                                        .split(QLatin1String(","), QString::SkipEmptyParts);
+        }
+        if( m_cassette->replay( dev.uuid, QLatin1String("GetSortCapabilities"), Cassette::Arguments(), &caps ) && caps.ok ) {
+            HActionArguments output = Cassette::toActionArguments( caps.output );
+            dev.sortCapabilities = output[QLatin1String("SortCaps")].value().toString()
+                                      .split(QLatin1String(","), QString::SkipEmptyParts);
+        }
+        if( m_cassette->replay( dev.uuid, QLatin1String("GetSystemUpdateID"), Cassette::Arguments(), &caps ) && caps.ok ) {
+            HActionArguments output = Cassette::toActionArguments( caps.output );
+            dev.systemUpdateId = output[QLatin1String("Id")].value().toString();
+            dev.cache->openIndex( dev.systemUpdateId );
+        }
+
+        m_devices[url.host()] = dev;
+        m_currentDevice = dev;
+        return true;
+    }
+
     if( updateDeviceInfo(url) ) {
         // make this the current device
         m_currentDevice = m_devices[url.host()];
@@ -331,13 +654,28 @@ void ControlPointThread::stat( const KUrl &url )
       return;
     }
 
+    if( !selectFields( url ) )
+        return;
+    m_cacheEntries = false;
+
+    // a file manager stats what it has just listed
+    const bool cached = url.hasQueryItem( QLatin1String("id") )
+        ? m_currentDevice.cache->entryForId( url.queryItem( QLatin1String("id") ), &m_statEntry )
+        : m_currentDevice.cache->entryForPath( url.path( KUrl::RemoveTrailingSlash ), &m_statEntry );
+    if( cached ) {
+        // the cache holds entries filled with all fields
+        Projection::apply( m_statEntry, m_fields );
+        QTimer::singleShot( 0, this, SLOT( emitStatEntry() ) );
+        return;
+    }
+
     if( url.hasQueryItem( QLatin1String("id") ) ) {
         connect( this, SIGNAL(browseResult(const Herqq::Upnp::HClientActionOp &)),
                  this, SLOT(createStatResult(const Herqq::Upnp::HClientActionOp &)) );
         browseOrSearchObject( url.queryItem( QLatin1String("id") ),
                               browseAction(),
                               BROWSE_METADATA,
-                              QLatin1String("*"),
+                              Projection::filter( m_fields ),
                               0,
                               0,
                               QString() );
@@ -353,6 +691,7 @@ void ControlPointThread::stat( const KUrl &url )
 
 void ControlPointThread::createStatResult(const Herqq::Upnp::HClientActionOp &op)
 {
+    TraceSpan span( "createStatResult" );
     HActionArguments output = op.outputArguments();
     bool ok = disconnect( this, SIGNAL(browseResult(const Herqq::Upnp::HClientActionOp &)),
                           this, SLOT( createStatResult(const Herqq::Upnp::HClientActionOp &)) );
@@ -365,11 +704,16 @@ void ControlPointThread::createStatResult(const Herqq::Upnp::HClientActionOp &op
 
     QString didlString = output[QLatin1String("Result")].value().toString();
     kDebug() << didlString;
-    DIDL::Parser parser;
-    connect( &parser, SIGNAL(error( const QString& )), this, SLOT(slotParseError( const QString& )) );
-    connect( &parser, SIGNAL(containerParsed(DIDL::Container *)), this, SLOT(slotListContainer(DIDL::Container *)) );
-    connect( &parser, SIGNAL(itemParsed(DIDL::Item *)), this, SLOT(slotListItem(DIDL::Item *)) );
-    parser.parse(didlString);
+    emitEntries( didlString, &span, false );
+}
+
+/**
+ * UPnPMS only starts waiting for the entry once
+ * stat() returns, so it can't be emitted from there.
+ */
+void ControlPointThread::emitStatEntry() // SLOT
+{
+    emit listEntry( m_statEntry );
 }
 
 void ControlPointThread::statResolvedPath( const DIDL::Object *object ) // SLOT
@@ -388,7 +732,7 @@ void ControlPointThread::statResolvedPath( const DIDL::Object *object ) // SLOT
     browseOrSearchObject( object->id(),
                           browseAction(),
                           BROWSE_METADATA,
-                          QLatin1String("*"),
+                          Projection::filter( m_fields ),
                           0,
                           0,
                           QString() );
@@ -410,12 +754,21 @@ void ControlPointThread::browseOrSearchObject( const QString &id,
                                                const uint requestedCount,
                                                const QString &sortCriteria )
 {
+    const uint inFlight = ++m_requestsInFlight[m_currentDevice.uuid];
+    Metrics *metrics = Metrics::forDevice( m_currentDevice.uuid );
+    metrics->requestsInFlightPeak = qMax( metrics->requestsInFlightPeak, quint64( inFlight ) );
+    if( replaying() ) {
+        replayBrowseOrSearch( id, secondArgument, filter, startIndex, requestedCount, sortCriteria );
+        return;
+    }
+
     if( !contentDirectory() ) {
         emit error( KIO::ERR_UNSUPPORTED_ACTION,
                     QLatin1String("UPnP device ") + m_currentDevice.info.friendlyName() + QLatin1String(" does not support browsing.") );
     }
 
     PersistentAction *pAction = new PersistentAction( action );
+    pAction->setProperty( "generation", m_requestGeneration );
    
     HActionArguments args = action->info().inputArguments();
   
@@ -440,6 +793,73 @@ void ControlPointThread::browseOrSearchObject( const QString &id,
     pAction->invoke(args);
 }
 
+void ControlPointThread::replayBrowseOrSearch( const QString &id,
+                                               const QString &secondArgument,
+                                               const QString &filter,
+                                               const uint startIndex,
+                                               const uint requestedCount,
+                                               const QString &sortCriteria )
+{
+    const bool browse = secondArgument == QLatin1String(BROWSE_DIRECT_CHILDREN)
+                        || secondArgument == QLatin1String(BROWSE_METADATA);
+
+    // same arguments, in string form, as browseOrSearchObject() would send
+    Cassette::Arguments input;
+    if( browse ) {
+        input << qMakePair( QString::fromLatin1("ObjectID"), id );
+        input << qMakePair( QString::fromLatin1("BrowseFlag"), secondArgument );
+    }
+    else {
+        input << qMakePair( QString::fromLatin1("ContainerID"), id );
+        input << qMakePair( QString::fromLatin1("SearchCriteria"), secondArgument );
+    }
+    input << qMakePair( QString::fromLatin1("Filter"), filter );
+    input << qMakePair( QString::fromLatin1("StartingIndex"), QString::number( startIndex ) );
+    input << qMakePair( QString::fromLatin1("RequestedCount"), QString::number( requestedCount ) );
+    input << qMakePair( QString::fromLatin1("SortCriteria"), sortCriteria );
+
+    ReplayedOp replayed;
+    replayed.op = HClientActionOp( Cassette::toActionArguments( input ) );
+    replayed.uuid = m_currentDevice.uuid;
+    replayed.generation = m_requestGeneration;
+
+    Cassette::Interaction interaction;
+    qint64 delay = 0;
+    if( m_cassette->replay( m_currentDevice.uuid,
+                            browse ? QLatin1String("Browse") : QLatin1String("Search"),
+                            input,
+                            &interaction ) ) {
+        replayed.op.setOutputArguments( Cassette::toActionArguments( interaction.output ) );
+        replayed.ok = interaction.ok;
+        replayed.error = interaction.error;
+        replayed.elapsed = interaction.elapsed;
+        if( m_cassette->realtime() )
+            delay = interaction.elapsed;
+    }
+    else {
+        kDebug() << "Nothing recorded for" << id << secondArgument << startIndex << requestedCount;
+        replayed.ok = false;
+        replayed.error = i18n( "No recorded reply for object %1", id );
+        replayed.elapsed = 0;
+    }
+
+    m_replayQueue.insert( qMakePair( m_replayClock.elapsed() + delay, m_replaySequence++ ), replayed );
+    QTimer::singleShot( delay, this, SLOT( replayNext() ) );
+}
+
+void ControlPointThread::replayNext() // SLOT
+{
+    Q_ASSERT( !m_replayQueue.isEmpty() );
+    // timers fire in due order, so the head is always the one due
+    ReplayedOp replayed = m_replayQueue.begin().value();
+    m_replayQueue.erase( m_replayQueue.begin() );
+
+    m_requestsInFlight[replayed.uuid]--;
+    m_lastErrorString = replayed.ok ? QString() : replayed.error;
+    m_lastResponseMsecs = replayed.elapsed;
+    emitBrowseResult( replayed.op, replayed.generation );
+}
+
 void ControlPointThread::listDir( const KUrl &url )
 {
     kDebug() << url;
@@ -450,6 +870,11 @@ void ControlPointThread::listDir( const KUrl &url )
     }
 
     QString path = url.path(KUrl::RemoveTrailingSlash);
+    m_cacheEntries = false;
+    m_listingPath = QString();
+
+    if( !selectFields( url ) || !selectSortCriteria( url ) )
+        return;
 
     if( !url.queryItem( QLatin1String("searchcapabilities") ).isNull() ) {
         foreach( QString capability, m_currentDevice.searchCapabilities ) {
@@ -462,6 +887,31 @@ void ControlPointThread::listDir( const KUrl &url )
         return;
     }
 
+    if( url.hasQueryItem( QLatin1String("sortcapabilities") ) ) {
+        foreach( const QString &capability, m_currentDevice.sortCapabilities ) {
+            KIO::UDSEntry entry;
+            entry.insert( KIO::UDSEntry::UDS_NAME, capability );
+            entry.insert( KIO::UDSEntry::UDS_FILE_TYPE, S_IFREG );
+            emit listEntry( entry );
+        }
+        emit listingDone();
+        return;
+    }
+
+    if( url.hasQueryItem( QLatin1String("stats") ) ) {
+        m_currentDevice.cache->updateMetrics();
+        typedef QPair<QString, quint64> Value;
+        foreach( const Value &value, Metrics::forDevice( m_currentDevice.uuid )->values() ) {
+            KIO::UDSEntry entry;
+            entry.insert( KIO::UDSEntry::UDS_NAME, value.first );
+            entry.insert( KIO::UDSEntry::UDS_SIZE, value.second );
+            entry.insert( KIO::UDSEntry::UDS_FILE_TYPE, S_IFREG );
+            emit listEntry( entry );
+        }
+        emit listingDone();
+        return;
+    }
+
     if( url.hasQueryItem( QLatin1String("search") ) ) {
         QMap<QString, QString> searchQueries = url.queryItems();
         m_baseSearchPath = url.path( KUrl::AddTrailingSlash );
@@ -475,7 +925,7 @@ void ControlPointThread::listDir( const KUrl &url )
         }
         m_queryString = it.value();
 
-        m_filter = searchQueries.value( QLatin1String("filter"), QLatin1String("*"));
+        m_filter = searchQueries.value( QLatin1String("filter"), Projection::filter( m_fields ) );
 
         m_getCount = searchQueries.contains( QLatin1String("getCount") );
 
@@ -533,15 +983,7 @@ void ControlPointThread::listDir( const KUrl &url )
         }
 
         if( url.hasQueryItem( QLatin1String("id") ) ) {
-            connect( this, SIGNAL(browseResult(const Herqq::Upnp::HClientActionOp &)),
-                    this, SLOT(createSearchListing(const Herqq::Upnp::HClientActionOp &)) );
-            browseOrSearchObject( url.queryItem( QLatin1String("id") ),
-                                  searchAction(),
-                                  m_queryString,
-                                  m_filter,
-                                  0,
-                                  30, // TODO not a good constant, #define this somewhere
-                                  QString() );
+            searchResolvedPath( url.queryItem( QLatin1String("id") ) );
         }
         else {
             connect( m_currentDevice.cache, SIGNAL( pathResolved( const DIDL::Object * ) ),
@@ -551,18 +993,25 @@ void ControlPointThread::listDir( const KUrl &url )
         return;
     }
 
+    if( url.hasQueryItem( QLatin1String("recursive") ) ) {
+        if( url.hasQueryItem( QLatin1String("id") ) ) {
+            startCrawl( url.queryItem( QLatin1String("id") ) );
+        }
+        else {
+            connect( m_currentDevice.cache, SIGNAL( pathResolved( const DIDL::Object * ) ),
+                     this, SLOT( crawlResolvedPath( const DIDL::Object * ) ) );
+            m_currentDevice.cache->resolvePathToObject( path );
+        }
+        return;
+    }
+
+    // only complete entries can answer a stat()
+    m_cacheEntries = m_fields == Projection::AllFields;
     if( url.hasQueryItem( QLatin1String("id") ) ) {
-        connect( this, SIGNAL(browseResult(const Herqq::Upnp::HClientActionOp &)),
-                 this, SLOT(createDirectoryListing(const Herqq::Upnp::HClientActionOp &)) );
-        browseOrSearchObject( url.queryItem( QLatin1String("id") ),
-                              browseAction(),
-                              BROWSE_DIRECT_CHILDREN,
-                              QLatin1String("*"),
-                              0,
-                              0,
-                              QString() );
+        browseResolvedPath( url.queryItem( QLatin1String("id") ) );
         return;
     }
+    m_listingPath = path;
     kDebug() << "RESOLVING PATH TO OBJ";
     connect( m_currentDevice.cache, SIGNAL( pathResolved( const DIDL::Object * ) ),
              this, SLOT( browseResolvedPath( const DIDL::Object *) ) );
@@ -571,13 +1020,17 @@ void ControlPointThread::listDir( const KUrl &url )
 
 void ControlPointThread::browseResolvedPath( const DIDL::Object *object )
 {
-    kDebug() << "PATH RESOLVED" << object->id();
     disconnect( m_currentDevice.cache, SIGNAL( pathResolved( const DIDL::Object * ) ),
                 this, SLOT( browseResolvedPath( const DIDL::Object *) ) );
+    if( !object ) {
+        emit error( KIO::ERR_DOES_NOT_EXIST, QString() );
+        return;
+    }
+    kDebug() << "PATH RESOLVED" << object->id();
     browseResolvedPath(object->id());
 }
 
-void ControlPointThread::browseResolvedPath( const QString &id, uint start, uint count ) // SLOT
+void ControlPointThread::browseResolvedPath( const QString &id, uint start ) // SLOT
 {
     if( id.isNull() ) {
         kDebug() << "ERROR: idString null";
@@ -585,26 +1038,36 @@ void ControlPointThread::browseResolvedPath( const QString &id, uint start, uint
         return;
     }
 
-    if( !browseAction() ) {
+    if( !replaying() && !browseAction() ) {
         emit error( KIO::ERR_COULD_NOT_CONNECT, QString() );
         return;
     }
 
+    if( start == 0 )
+        m_currentDevice.paging->reset();
+    const uint count = m_currentDevice.paging->pageSize();
+
+    if( start == 0 && ( pipelineDepth() > 1 || rangeCount() > 1 ) ) {
+        startPipeline( id, count );
+        return;
+    }
+
     Q_ASSERT(connect( this, SIGNAL( browseResult( const Herqq::Upnp::HClientActionOp & ) ),
                       this, SLOT( createDirectoryListing( const Herqq::Upnp::HClientActionOp&) ) ));
     kDebug() << "BEGINNING browseOrSearch call";
     browseOrSearchObject( id,
                           browseAction(),
                           BROWSE_DIRECT_CHILDREN,
-                          QLatin1String("*"),
+                          Projection::filter( m_fields ),
                           start,
                           count,
-                          QString() );
+                          m_sortCriteria );
 }
 
 void ControlPointThread::browseInvokeDone(HClientAction *action, const HClientActionOp &invocationOp, bool ok, QString error ) // SLOT
 {
     kDebug() << "BROWSEINVOKEDONE";
+    m_requestsInFlight[action->parentService()->parentDevice()->info().udn().toSimpleUuid()]--;
     HActionArguments output = invocationOp.outputArguments();
     if( !ok ) {
         kDebug() << "browse failed" << error;
@@ -613,18 +1076,34 @@ void ControlPointThread::browseInvokeDone(HClientAction *action, const HClientAc
     else {
         Q_ASSERT( output[QLatin1String("Result")] );
         m_lastErrorString = QString();
+
+        Metrics *metrics = Metrics::forDevice( action->parentService()->parentDevice()->info().udn().toSimpleUuid() );
+        metrics->didlCharacters += output[QLatin1String("Result")].value().toString().length();
+        metrics->objectsReceived += output[QLatin1String("NumberReturned")].value().toUInt();
     }
 
     // delete the PersistentAction
     PersistentAction *pAction = static_cast<PersistentAction *>( QObject::sender() );
     pAction->deleteLater();
+    m_lastResponseMsecs = pAction->elapsed();
+
+    if( recording() ) {
+        m_cassette->record( action->parentService()->parentDevice()->info().udn().toSimpleUuid(),
+                            action->info().name(),
+                            invocationOp.inputArguments(),
+                            output,
+                            ok,
+                            error,
+                            pAction->elapsed() );
+    }
 
-    emit browseResult( invocationOp );
+    emitBrowseResult( invocationOp, pAction->property( "generation" ).toUInt() );
 }
 
 void ControlPointThread::createDirectoryListing(const HClientActionOp &op) // SLOT
 {
     kDebug() << "CDR CALLED";
+    TraceSpan span( "createDirectoryListing" );
     bool ok = disconnect( this, SIGNAL( browseResult( const Herqq::Upnp::HClientActionOp&) ),
                           this, SLOT( createDirectoryListing(const Herqq::Upnp::HClientActionOp &) ) );
 
@@ -639,30 +1118,345 @@ void ControlPointThread::createDirectoryListing(const HClientActionOp &op) // SL
 
     QString didlString = output[QLatin1String("Result")].value().toString();
     kDebug() << didlString;
-    DIDL::Parser parser;
-    connect( &parser, SIGNAL(error( const QString& )), this, SLOT(slotParseError( const QString& )) );
-
-    connect( &parser, SIGNAL(containerParsed(DIDL::Container *)), this, SLOT(slotListContainer(DIDL::Container *)) );
-    connect( &parser, SIGNAL(itemParsed(DIDL::Item *)), this, SLOT(slotListItem(DIDL::Item *)) );
-    parser.parse(didlString);
+    emitEntries( didlString, &span );
 
     // NOTE: it is possible to dispatch this call even before
-    // the parsing begins, but perhaps this delay is good for
-    // adding some 'break' to the network connections, so that
-    // disconnection by the remote device can be avoided.
+    // the parsing begins, which is what a pipeline does, see
+    // startPipeline(). By default this delay adds some 'break'
+    // to the network connections, so that disconnection by
+    // the remote device can be avoided.
     HActionArguments input = op.inputArguments();
     QString id = input[QLatin1String("ObjectID")].value().toString();
     uint start = input[QLatin1String("StartingIndex")].value().toUInt();
 
     uint num = output[QLatin1String("NumberReturned")].value().toUInt();
     uint total = output[QLatin1String("TotalMatches")].value().toUInt();
+    m_currentDevice.paging->pageReceived( input[QLatin1String("RequestedCount")].value().toUInt(),
+                                          num,
+                                          didlString.length(),
+                                          m_lastResponseMsecs,
+                                          start + num < total );
     if( num > 0 && ( start + num < total ) ) {
         //TODO: msleep( 1000 );
         browseResolvedPath( id, start + num );
     }
     else {
+        m_currentDevice.cache->listingDone();
+        emit listingDone();
+    }
+}
+
+uint ControlPointThread::pipelineDepth()
+{
+    static const uint depth = qBound( 1, qgetenv( PIPELINE_ENV ).toInt(), PIPELINE_MAXIMUM_DEPTH );
+    return depth;
+}
+
+uint ControlPointThread::rangeCount()
+{
+    static const uint count = qBound( 1, qgetenv( RANGES_ENV ).toInt(), DEVICE_MAXIMUM_REQUESTS );
+    return count;
+}
+
+void ControlPointThread::startPipeline( const QString &id, uint count )
+{
+    kDebug() << "Pipelining" << id << "depth" << pipelineDepth();
+    m_pipeline.id = id;
+    m_pipeline.depth = pipelineDepth();
+    m_pipeline.total = 0;
+    m_pipeline.nextRequest = count;
+    m_pipeline.nextListed = 0;
+    m_pipeline.requested.clear();
+    m_pipeline.arrived.clear();
+
+    connect( this, SIGNAL( browseResult( const Herqq::Upnp::HClientActionOp & ) ),
+             this, SLOT( pipelinedBrowseDone( const Herqq::Upnp::HClientActionOp & ) ) );
+    requestPage( 0, count );
+}
+
+void ControlPointThread::requestPage( uint start, uint count )
+{
+    m_pipeline.requested.insert( start );
+    m_pipeline.lastRequest.start();
+    browseOrSearchObject( m_pipeline.id,
+                          browseAction(),
+                          BROWSE_DIRECT_CHILDREN,
+                          Projection::filter( m_fields ),
+                          start,
+                          count,
+                          m_sortCriteria );
+}
+
+/**
+ * Requests further pages until the pipeline is full or the
+ * device has DEVICE_MAXIMUM_REQUESTS in flight, no sooner
+ * than PIPELINE_REQUEST_INTERVAL after the last one.
+ * Pages waiting to be listed count as in flight, so that
+ * a slow page cannot have the others pile up behind it.
+ */
+void ControlPointThread::fillPipeline() // SLOT
+{
+    m_pipeline.fillScheduled = false;
+    // stopped while waiting
+    if( m_pipeline.id.isNull() )
+        return;
+
+    while( m_pipeline.nextRequest < m_pipeline.total
+           && uint( m_pipeline.requested.size() + m_pipeline.arrived.size() ) < m_pipeline.depth
+           && m_requestsInFlight.value( m_currentDevice.uuid ) < DEVICE_MAXIMUM_REQUESTS ) {
+        const qint64 wait = PIPELINE_REQUEST_INTERVAL - m_pipeline.lastRequest.elapsed();
+        if( wait > 0 ) {
+            m_pipeline.fillScheduled = true;
+            QTimer::singleShot( wait, this, SLOT( fillPipeline() ) );
+            return;
+        }
+        const uint count = m_currentDevice.paging->pageSize();
+        requestPage( m_pipeline.nextRequest, count );
+        m_pipeline.nextRequest += count;
+    }
+}
+
+void ControlPointThread::pipelinedBrowseDone( const HClientActionOp &op ) // SLOT
+{
+    TraceSpan span( "pipelinedBrowseDone" );
+    HActionArguments input = op.inputArguments();
+    const uint start = input[QLatin1String("StartingIndex")].value().toUInt();
+    m_pipeline.requested.remove( start );
+
+    HActionArguments output = op.outputArguments();
+    if( !output[QLatin1String("Result")].isValid() ) {
+        stopPipeline();
+        emit error( KIO::ERR_SLAVE_DEFINED, m_lastErrorString );
+        return;
+    }
+
+    if( start == 0 ) {
+        m_pipeline.total = output[QLatin1String("TotalMatches")].value().toUInt();
+        // the rest of a large container is independent ranges
+        if( m_pipeline.total >= RANGES_MINIMUM_OBJECTS )
+            m_pipeline.depth = qMax( m_pipeline.depth, rangeCount() );
+    }
+    const uint returned = output[QLatin1String("NumberReturned")].value().toUInt();
+    m_currentDevice.paging->pageReceived( input[QLatin1String("RequestedCount")].value().toUInt(),
+                                          returned,
+                                          output[QLatin1String("Result")].value().toString().length(),
+                                          m_lastResponseMsecs,
+                                          start + returned < m_pipeline.total );
+    m_pipeline.arrived.insert( start, op );
+
+    while( m_pipeline.arrived.contains( m_pipeline.nextListed ) ) {
+        HActionArguments page = m_pipeline.arrived.take( m_pipeline.nextListed ).outputArguments();
+        emitEntries( page[QLatin1String("Result")].value().toString(), &span );
+        // stopped by a parse error
+        if( m_pipeline.id.isNull() )
+            return;
+
+        const uint num = page[QLatin1String("NumberReturned")].value().toUInt();
+        if( num == 0 ) {
+            // the server has no more, whatever it said before
+            m_pipeline.total = m_pipeline.nextListed;
+            break;
+        }
+        m_pipeline.nextListed += num;
+    }
+
+    if( m_pipeline.nextListed >= m_pipeline.total ) {
+        stopPipeline();
+        m_currentDevice.cache->listingDone();
         emit listingDone();
+        return;
+    }
+
+    // a page came back shorter than asked for, request the rest
+    // of it, up to where the next page already requested begins
+    if( !m_pipeline.requested.contains( m_pipeline.nextListed )
+        && !m_pipeline.arrived.contains( m_pipeline.nextListed ) ) {
+        uint end = qMin( m_pipeline.nextRequest, m_pipeline.total );
+        foreach( uint requested, m_pipeline.requested ) {
+            if( requested > m_pipeline.nextListed )
+                end = qMin( end, requested );
+        }
+        QMap<uint, HClientActionOp>::const_iterator next = m_pipeline.arrived.upperBound( m_pipeline.nextListed );
+        if( next != m_pipeline.arrived.constEnd() )
+            end = qMin( end, next.key() );
+        if( end > m_pipeline.nextListed )
+            requestPage( m_pipeline.nextListed, end - m_pipeline.nextListed );
     }
+
+    if( !m_pipeline.fillScheduled )
+        fillPipeline();
+}
+
+void ControlPointThread::stopPipeline()
+{
+    disconnect( this, SIGNAL( browseResult( const Herqq::Upnp::HClientActionOp & ) ),
+                this, SLOT( pipelinedBrowseDone( const Herqq::Upnp::HClientActionOp & ) ) );
+    m_requestGeneration++;
+    m_pipeline.id = QString();
+    m_pipeline.requested.clear();
+    m_pipeline.arrived.clear();
+}
+
+/////////////////////////////////////////////
+////          Recursive listing          ////
+/////////////////////////////////////////////
+
+void ControlPointThread::crawlResolvedPath( const DIDL::Object *object ) // SLOT
+{
+    disconnect( m_currentDevice.cache, SIGNAL( pathResolved( const DIDL::Object * ) ),
+                this, SLOT( crawlResolvedPath( const DIDL::Object * ) ) );
+    if( !object ) {
+        emit error( KIO::ERR_DOES_NOT_EXIST, QString() );
+        return;
+    }
+    startCrawl( object->id() );
+}
+
+void ControlPointThread::startCrawl( const QString &id )
+{
+    if( !replaying() && !browseAction() ) {
+        emit error( KIO::ERR_COULD_NOT_CONNECT, QString() );
+        return;
+    }
+
+    kDebug() << "Crawling" << id;
+    m_currentDevice.paging->reset();
+    m_crawl.active = true;
+    m_crawl.root = id;
+    m_crawl.queue.clear();
+    m_crawl.requested.clear();
+    m_crawl.paths.clear();
+    m_crawl.paths.insert( id, QPair<QString, QString>() );
+    m_crawl.queue.enqueue( qMakePair( id, 0u ) );
+
+    connect( this, SIGNAL( browseResult( const Herqq::Upnp::HClientActionOp & ) ),
+             this, SLOT( crawlBrowseDone( const Herqq::Upnp::HClientActionOp & ) ) );
+    fillCrawl();
+}
+
+/**
+ * Requests the next pages of the queue, as long as the crawl
+ * has less than CRAWL_MAXIMUM_REQUESTS in flight and the device
+ * less than DEVICE_MAXIMUM_REQUESTS.
+ */
+void ControlPointThread::fillCrawl()
+{
+    while( !m_crawl.queue.isEmpty()
+           && uint( m_crawl.requested.size() ) < CRAWL_MAXIMUM_REQUESTS
+           && m_requestsInFlight.value( m_currentDevice.uuid ) < DEVICE_MAXIMUM_REQUESTS ) {
+        const QPair<QString, uint> page = m_crawl.queue.dequeue();
+        m_crawl.requested.insert( page );
+        browseOrSearchObject( page.first,
+                              browseAction(),
+                              BROWSE_DIRECT_CHILDREN,
+                              Projection::filter( m_fields ),
+                              page.second,
+                              m_currentDevice.paging->pageSize(),
+                              m_sortCriteria );
+    }
+}
+
+void ControlPointThread::crawlBrowseDone( const HClientActionOp &op ) // SLOT
+{
+    TraceSpan span( "crawlBrowseDone" );
+    HActionArguments input = op.inputArguments();
+    const QString id = input[QLatin1String("ObjectID")].value().toString();
+    const uint start = input[QLatin1String("StartingIndex")].value().toUInt();
+    m_crawl.requested.remove( qMakePair( id, start ) );
+
+    HActionArguments output = op.outputArguments();
+    if( !output[QLatin1String("Result")].isValid() ) {
+        if( id == m_crawl.root && start == 0 ) {
+            stopCrawl();
+            emit error( KIO::ERR_SLAVE_DEFINED, m_lastErrorString );
+            return;
+        }
+        // one bad directory shouldn't spoil a whole library scan
+        kDebug() << "Leaving out" << id << "from" << start << m_lastErrorString;
+    }
+    else {
+        const QString didl = output[QLatin1String("Result")].value().toString();
+        m_crawl.prefix = m_crawl.paths.value( id );
+
+        ListingParser parser;
+        parser.setFields( m_fields );
+        parser.setStringPool( m_currentDevice.cache->strings() );
+        connect( &parser, SIGNAL(error( const QString& )), this, SLOT(slotParseError( const QString& )) );
+        connect( &parser, SIGNAL(entryParsed( const KIO::UDSEntry & )), this, SLOT(crawlEntry( const KIO::UDSEntry & )) );
+        parser.parse( didl );
+        if( span.enabled() )
+            span.setArgument( "objects", QString::number( parser.entries() ) );
+        // stopped by a parse error
+        if( !m_crawl.active )
+            return;
+
+        const uint num = output[QLatin1String("NumberReturned")].value().toUInt();
+        const uint total = output[QLatin1String("TotalMatches")].value().toUInt();
+        m_currentDevice.paging->pageReceived( input[QLatin1String("RequestedCount")].value().toUInt(),
+                                              num,
+                                              didl.length(),
+                                              m_lastResponseMsecs,
+                                              start + num < total );
+        if( num > 0 && start + num < total )
+            m_crawl.queue.enqueue( qMakePair( id, start + num ) );
+    }
+
+    fillCrawl();
+    if( m_crawl.requested.isEmpty() && m_crawl.queue.isEmpty() ) {
+        // unlike a plain listing, entries are only flushed
+        // per page if they have waited long enough, with several
+        // pages in flight the next one is rarely far off
+        flushEntries();
+        stopCrawl();
+        m_currentDevice.cache->listingDone();
+        emit listingDone();
+    }
+}
+
+/**
+ * Makes the names relative to the root of the crawl
+ * and queues the containers found.
+ */
+void ControlPointThread::crawlEntry( const KIO::UDSEntry &parsed ) // SLOT
+{
+    if( !m_crawl.active )
+        return;
+
+    KIO::UDSEntry entry( parsed );
+    QPair<QString, QString> path( entry.stringValue( KIO::UDSEntry::UDS_NAME ),
+                                  entry.stringValue( KIO::UDSEntry::UDS_DISPLAY_NAME ) );
+    if( !m_crawl.prefix.first.isEmpty() ) {
+        path.first = m_crawl.prefix.first + QLatin1Char('/') + path.first;
+        path.second = m_crawl.prefix.second + QLatin1Char('/') + path.second;
+    }
+    entry.insert( KIO::UDSEntry::UDS_NAME, path.first );
+    entry.insert( KIO::UDSEntry::UDS_DISPLAY_NAME, path.second );
+
+    if( entry.isDir() ) {
+        const QString id = entry.stringValue( KIO::UPNP_ID );
+        // a container should only turn up once, but
+        // don't go round in circles if it doesn't
+        if( !m_crawl.paths.contains( id ) ) {
+            m_crawl.paths.insert( id, path );
+            m_crawl.queue.enqueue( qMakePair( id, 0u ) );
+        }
+    }
+
+    if( m_entryBatchSize > 0 )
+        batchEntry( entry );
+    else
+        emit listEntry( entry );
+}
+
+void ControlPointThread::stopCrawl()
+{
+    disconnect( this, SIGNAL( browseResult( const Herqq::Upnp::HClientActionOp & ) ),
+                this, SLOT( crawlBrowseDone( const Herqq::Upnp::HClientActionOp & ) ) );
+    m_requestGeneration++;
+    m_crawl.active = false;
+    m_crawl.queue.clear();
+    m_crawl.requested.clear();
+    m_crawl.paths.clear();
 }
 
 ///////////////////////////////
@@ -670,10 +1464,98 @@ void ControlPointThread::createDirectoryListing(const HClientActionOp &op) // SL
 ///////////////////////////////
 void ControlPointThread::slotParseError( const QString &errorString )
 {
+    // nothing may follow the error
+    m_entryBatch.clear();
+    if( m_crawl.active )
+        stopCrawl();
+    if( !m_pipeline.id.isNull() )
+        stopPipeline();
     emit error(KIO::ERR_SLAVE_DEFINED, errorString);
 }
 
-void ControlPointThread::fillCommon( KIO::UDSEntry &entry, const DIDL::Object *obj )
+/**
+ * Everything fillContainer() and fillItem() read out of
+ * Object::property() and Item::resource(), the parser skips the rest.
+ */
+QStringList ControlPointThread::listingProperties()
+{
+    static const QStringList properties = QStringList()
+        << QLatin1String("date")
+        << QLatin1String("creator")
+        << QLatin1String("artist")
+        << QLatin1String("album")
+        << QLatin1String("genre")
+        << QLatin1String("albumArtURI")
+        << QLatin1String("channelName")
+        << QLatin1String("channelNr")
+        << QLatin1String("originalTrackNumber")
+        << QLatin1String("res")
+        << QLatin1String("size")
+        << QLatin1String("duration")
+        << QLatin1String("bitrate")
+        << QLatin1String("resolution");
+    return properties;
+}
+
+/**
+ * Sets m_sortCriteria from the URL's sort=, empty, leaving the
+ * order to the server, if there is none. Emits error() and
+ * returns false if the server can not sort by a property.
+ */
+bool ControlPointThread::selectSortCriteria( const KUrl &url )
+{
+    m_sortCriteria = QString();
+    if( !url.hasQueryItem( QLatin1String("sort") ) )
+        return true;
+
+    QStringList criteria;
+    foreach( const QString &criterion, url.queryItem( QLatin1String("sort") ).split( QLatin1Char(','), QString::SkipEmptyParts ) ) {
+        // an unencoded '+' arrives as a space
+        QString property = criterion.trimmed();
+        QChar direction = QLatin1Char('+');
+        if( property.startsWith( QLatin1Char('+') ) || property.startsWith( QLatin1Char('-') ) ) {
+            direction = property[0];
+            property = property.mid( 1 );
+        }
+
+        if( !m_currentDevice.sortCapabilities.contains( property )
+            && !m_currentDevice.sortCapabilities.contains( QLatin1String("*") ) ) {
+            emit error( KIO::ERR_SLAVE_DEFINED,
+                        QLatin1String("Bad sort: unsupported property ") + property );
+            return false;
+        }
+        criteria << direction + property;
+    }
+    m_sortCriteria = criteria.join( QLatin1String(",") );
+    return true;
+}
+
+/**
+ * Sets m_fields from the URL's fields=, or from the
+ * default set by setFields(). Emits error() and
+ * returns false if a field is not known.
+ */
+bool ControlPointThread::selectFields( const KUrl &url )
+{
+    m_fields = Projection::AllFields;
+
+    QString names;
+    if( url.hasQueryItem( QLatin1String("fields") ) )
+        names = url.queryItem( QLatin1String("fields") );
+    else if( !m_defaultFields.isNull() )
+        names = m_defaultFields;
+    else
+        return true;
+
+    QString unknown;
+    if( !Projection::parse( names, &m_fields, &unknown ) ) {
+        emit error( KIO::ERR_SLAVE_DEFINED, i18n( "Unknown field %1", unknown ) );
+        return false;
+    }
+    return true;
+}
+
+void ControlPointThread::fillCommon( KIO::UDSEntry &entry, const DIDL::Object *obj, Projection::Fields fields )
 {
     entry.insert( KIO::UDSEntry::UDS_NAME, obj->title() );
     entry.insert( KIO::UDSEntry::UDS_DISPLAY_NAME, QUrl::fromPercentEncoding( obj->title().toLatin1() ) );
@@ -690,63 +1572,117 @@ void ControlPointThread::fillCommon( KIO::UDSEntry &entry, const DIDL::Object *o
     entry.insert( KIO::UPNP_ID, obj->id() );
     entry.insert( KIO::UPNP_PARENT_ID, obj->parentId() );
 
-    fillMetadata(entry, KIO::UPNP_DATE, obj, QLatin1String("date"));
-    fillMetadata(entry, KIO::UPNP_CREATOR, obj, QLatin1String("creator"));
-    fillMetadata(entry, KIO::UPNP_ARTIST, obj, QLatin1String("artist"));
-    fillMetadata(entry, KIO::UPNP_ALBUM, obj, QLatin1String("album"));
-    fillMetadata(entry, KIO::UPNP_GENRE, obj, QLatin1String("genre"));
-    fillMetadata(entry, KIO::UPNP_ALBUMART_URI, obj, QLatin1String("albumArtURI"));
-    fillMetadata(entry, KIO::UPNP_CHANNEL_NAME, obj, QLatin1String("channelName"));
-    fillMetadata(entry, KIO::UPNP_CHANNEL_NUMBER, obj, QLatin1String("channelNr"));
+    if( fields & Projection::Date )
+        fillMetadata(entry, KIO::UPNP_DATE, obj, DIDL::Date);
+    if( fields & Projection::Creator )
+        fillMetadata(entry, KIO::UPNP_CREATOR, obj, DIDL::Creator);
+    if( fields & Projection::Artist )
+        fillMetadata(entry, KIO::UPNP_ARTIST, obj, DIDL::Artist);
+    if( fields & Projection::Album )
+        fillMetadata(entry, KIO::UPNP_ALBUM, obj, DIDL::Album);
+    if( fields & Projection::Genre )
+        fillMetadata(entry, KIO::UPNP_GENRE, obj, DIDL::Genre);
+    if( fields & Projection::AlbumArtUri )
+        fillMetadata(entry, KIO::UPNP_ALBUMART_URI, obj, DIDL::AlbumArtUri);
+    if( fields & Projection::ChannelName )
+        fillMetadata(entry, KIO::UPNP_CHANNEL_NAME, obj, DIDL::ChannelName);
+    if( fields & Projection::ChannelNumber )
+        fillMetadata(entry, KIO::UPNP_CHANNEL_NUMBER, obj, DIDL::ChannelNumber);
 }
 
-void ControlPointThread::fillContainer( KIO::UDSEntry &entry, const DIDL::Container *c )
+void ControlPointThread::fillContainer( KIO::UDSEntry &entry, const DIDL::Container *c, Projection::Fields fields )
 {
-    fillCommon( entry, c );
+    fillCommon( entry, c, fields );
     entry.insert( KIO::UDSEntry::UDS_FILE_TYPE, S_IFDIR );
 
-    fillMetadata(entry, KIO::UPNP_ALBUM_CHILDCOUNT, c, QLatin1String("childCount"));
+    if( fields & Projection::ChildCount )
+        fillMetadata(entry, KIO::UPNP_ALBUM_CHILDCOUNT, c, DIDL::ChildCount);
 }
 
-void ControlPointThread::fillItem( KIO::UDSEntry &entry, const DIDL::Item *item )
+void ControlPointThread::fillItem( KIO::UDSEntry &entry, const DIDL::Item *item, Projection::Fields fields )
 {
-    fillCommon( entry, item );
+    fillCommon( entry, item, fields );
     entry.insert( KIO::UDSEntry::UDS_FILE_TYPE, S_IFREG );
-    if( item->hasResource() ) {
-        DIDL::Resource res = item->resource();
-        entry.insert( KIO::UDSEntry::UDS_MIME_TYPE, res[QLatin1String("mimetype")] );
-        entry.insert( KIO::UDSEntry::UDS_SIZE, res["size"].toULongLong() );
-        entry.insert( KIO::UDSEntry::UDS_TARGET_URL, res["uri"] );
-    }
-    else {
-        long long access = entry.numberValue( KIO::UDSEntry::UDS_ACCESS );
-        // undo slotListFillCommon
-        access ^= S_IRUSR | S_IRGRP | S_IROTH;
-        entry.insert( KIO::UDSEntry::UDS_ACCESS, access );
+    // without Resource whether it can be read is not known, it stays readable
+    if( fields & Projection::Resource ) {
+        if( item->hasResource() ) {
+            const DIDL::Resource &res = item->resource();
+            entry.insert( KIO::UDSEntry::UDS_MIME_TYPE, res.value(DIDL::ResourceMimeType) );
+            if( fields & Projection::ResourceSize )
+                entry.insert( KIO::UDSEntry::UDS_SIZE, res.value(DIDL::ResourceSize).toULongLong() );
+            entry.insert( KIO::UDSEntry::UDS_TARGET_URL, res.value(DIDL::ResourceUri) );
+        }
+        else {
+            long long access = entry.numberValue( KIO::UDSEntry::UDS_ACCESS );
+            // undo slotListFillCommon
+            access ^= S_IRUSR | S_IRGRP | S_IROTH;
+            entry.insert( KIO::UDSEntry::UDS_ACCESS, access );
+        }
     }
 
-    if( !item->refId().isNull() )
+    if( ( fields & Projection::RefId ) && !item->refId().isNull() )
         entry.insert( KIO::UPNP_REF_ID, item->refId() );
 
-    fillMetadata(entry, KIO::UPNP_TRACK_NUMBER, item, QLatin1String("originalTrackNumber"));
+    if( fields & Projection::OriginalTrackNumber )
+        fillMetadata(entry, KIO::UPNP_TRACK_NUMBER, item, DIDL::OriginalTrackNumber);
 
-    fillResourceMetadata(entry, KIO::UPNP_DURATION, item, QLatin1String("duration"));
-    fillResourceMetadata(entry, KIO::UPNP_BITRATE, item, QLatin1String("bitrate"));
-    fillResourceMetadata(entry, KIO::UPNP_IMAGE_RESOLUTION, item, QLatin1String("resolution"));
+    if( fields & Projection::ResourceDuration )
+        fillResourceMetadata(entry, KIO::UPNP_DURATION, item, DIDL::ResourceDuration);
+    if( fields & Projection::ResourceBitrate )
+        fillResourceMetadata(entry, KIO::UPNP_BITRATE, item, DIDL::ResourceBitrate);
+    if( fields & Projection::ResourceResolution )
+        fillResourceMetadata(entry, KIO::UPNP_IMAGE_RESOLUTION, item, DIDL::ResourceResolution);
 }
 
-void ControlPointThread::slotListContainer( DIDL::Container *c )
+/**
+ * Emits the entries of a plain listing straight from the
+ * DIDL-Lite, fillItem() and fillContainer() are only needed
+ * when something else has to be done with the objects.
+ * With @c batch they go out through listEntries(), the last
+ * batch of the page included, otherwise through listEntry().
+ * Per object spans would drown the trace, so the
+ * number of entries goes on the page's span.
+ */
+void ControlPointThread::emitEntries( const QString &didl, TraceSpan *span, bool batch )
 {
-    KIO::UDSEntry entry;
-    fillContainer( entry, c );
-    emit listEntry( entry );
+    ListingParser parser;
+    parser.setFields( m_fields );
+    parser.setStringPool( m_currentDevice.cache->strings() );
+    connect( &parser, SIGNAL(error( const QString& )), this, SLOT(slotParseError( const QString& )) );
+    if( m_cacheEntries )
+        connect( &parser, SIGNAL(entryParsed( const KIO::UDSEntry & )), this, SLOT(cacheEntry( const KIO::UDSEntry & )) );
+    if( batch && m_entryBatchSize > 0 )
+        connect( &parser, SIGNAL(entryParsed( const KIO::UDSEntry & )), this, SLOT(batchEntry( const KIO::UDSEntry & )) );
+    else
+        connect( &parser, SIGNAL(entryParsed( const KIO::UDSEntry & )), this, SIGNAL(listEntry( const KIO::UDSEntry & )) );
+    parser.parse( didl );
+    // the next page is a round trip away
+    flushEntries();
+    if( span->enabled() )
+        span->setArgument( "objects", QString::number( parser.entries() ) );
 }
 
-void ControlPointThread::slotListItem( DIDL::Item *item )
+void ControlPointThread::batchEntry( const KIO::UDSEntry &entry ) // SLOT
 {
-    KIO::UDSEntry entry;
-    fillItem( entry, item );
-    emit listEntry( entry );
+    if( m_entryBatch.isEmpty() )
+        m_entryBatchAge.start();
+    m_entryBatch.append( entry );
+    if( m_entryBatch.size() >= m_entryBatchSize || m_entryBatchAge.elapsed() >= ENTRY_BATCH_MSECS )
+        flushEntries();
+}
+
+void ControlPointThread::cacheEntry( const KIO::UDSEntry &entry ) // SLOT
+{
+    m_currentDevice.cache->insertEntry( m_listingPath, entry );
+}
+
+void ControlPointThread::flushEntries()
+{
+    if( m_entryBatch.isEmpty() )
+        return;
+    const KIO::UDSEntryList batch = m_entryBatch;
+    m_entryBatch.clear();
+    emit listEntries( batch );
 }
 
 ////////////////////////////////////////////
@@ -778,7 +1714,7 @@ void ControlPointThread::searchResolvedPath( const DIDL::Object *object )
     searchResolvedPath(object->id());
 }
 
-void ControlPointThread::searchResolvedPath( const QString &id, uint start, uint count )
+void ControlPointThread::searchResolvedPath( const QString &id, uint start )
 {
     kDebug() << "SearchResolvedPath";
     if( id.isNull() ) {
@@ -787,11 +1723,15 @@ void ControlPointThread::searchResolvedPath( const QString &id, uint start, uint
         return;
     }
 
-    if( !searchAction() ) {
+    if( !replaying() && !searchAction() ) {
         emit error( KIO::ERR_COULD_NOT_CONNECT, QString() );
         return;
     }
 
+    if( start == 0 )
+        m_currentDevice.paging->reset();
+    const uint count = m_currentDevice.paging->pageSize();
+
     Q_ASSERT(connect( this, SIGNAL( browseResult( const Herqq::Upnp::HClientActionOp & ) ),
                       this, SLOT( createSearchListing( const Herqq::Upnp::HClientActionOp&) ) ));
 
@@ -802,12 +1742,13 @@ void ControlPointThread::searchResolvedPath( const QString &id, uint start, uint
                           m_filter,
                           start,
                           count,
-                          QString() );
+                          m_sortCriteria );
 }
 
 void ControlPointThread::createSearchListing(const HClientActionOp &op) // SLOT
 {
     kDebug() << "createSearchListing";
+    TraceSpan span( "createSearchListing" );
     HActionArguments output = op.outputArguments();
     bool ok = disconnect( this, SIGNAL( browseResult(const Herqq::Upnp::HClientActionOp &) ),
                           this, SLOT( createSearchListing(const Herqq::Upnp::HClientActionOp &) ) );
@@ -829,26 +1770,27 @@ void ControlPointThread::createSearchListing(const HClientActionOp &op) // SLOT
 
     QString didlString = output[QLatin1String("Result")].value().toString();
     kDebug() << didlString;
-    DIDL::Parser parser;
-    connect( &parser, SIGNAL(error( const QString& )), this, SLOT(slotParseError( const QString& )) );
-
     if( m_resolveSearchPaths ) {
+        // the entries are only emitted once the path is known,
+        // the ObjectCache wants objects for that
+        DIDL::Parser parser;
+        parser.setWantedProperties( Projection::properties( m_fields ) );
+        parser.setStringPool( m_currentDevice.cache->strings() );
+        connect( &parser, SIGNAL(error( const QString& )), this, SLOT(slotParseError( const QString& )) );
         connect( &parser, SIGNAL(containerParsed(DIDL::Container *)), this, SLOT(slotListSearchContainer(DIDL::Container *)) );
         connect( &parser, SIGNAL(itemParsed(DIDL::Item *)), this, SLOT(slotListSearchItem(DIDL::Item *)) );
+        parser.parse(didlString);
     }
     else {
-        connect( &parser, SIGNAL(containerParsed(DIDL::Container *)), this, SLOT(slotListContainer(DIDL::Container *)) );
-        connect( &parser, SIGNAL(itemParsed(DIDL::Item *)), this, SLOT(slotListItem(DIDL::Item *)) );
-        connect( &parser, SIGNAL(error( const QString& )), this, SLOT(slotParseError( const QString& )) );
+        emitEntries( didlString, &span );
     }
-    parser.parse(didlString);
 
     // NOTE: it is possible to dispatch this call even before
     // the parsing begins, but perhaps this delay is good for
     // adding some 'break' to the network connections, so that
     // disconnection by the remote device can be avoided.
     HActionArguments input = op.inputArguments();
-    QString id = input[QLatin1String("ObjectID")].value().toString();
+    QString id = input[QLatin1String("ContainerID")].value().toString();
     uint start = input[QLatin1String("StartingIndex")].value().toUInt();
 
     uint num = output[QLatin1String("NumberReturned")].value().toUInt();
@@ -857,6 +1799,11 @@ void ControlPointThread::createSearchListing(const HClientActionOp &op) // SLOT
         m_searchListingCounter += num;
 
     uint total = output[QLatin1String("TotalMatches")].value().toUInt();
+    m_currentDevice.paging->pageReceived( input[QLatin1String("RequestedCount")].value().toUInt(),
+                                          num,
+                                          didlString.length(),
+                                          m_lastResponseMsecs,
+                                          start + num < total );
     if( num > 0 && ( start + num < total ) ) {
         //TODO: msleep( 1000 );
         searchResolvedPath( id, start + num );
@@ -870,7 +1817,7 @@ void ControlPointThread::createSearchListing(const HClientActionOp &op) // SLOT
 void ControlPointThread::slotListSearchContainer( DIDL::Container *c )
 {
     KIO::UDSEntry entry;
-    fillContainer( entry, c );
+    fillContainer( entry, c, m_fields );
 
     // ugly hack to get around lack of closures in C++
     setProperty( (QLatin1String("upnp_id_") + c->id()).toLatin1().constData(),
@@ -883,7 +1830,7 @@ void ControlPointThread::slotListSearchContainer( DIDL::Container *c )
 void ControlPointThread::slotListSearchItem( DIDL::Item *item )
 {
     KIO::UDSEntry entry;
-    fillItem( entry, item );
+    fillItem( entry, item, m_fields );
     setProperty( (QLatin1String("upnp_id_") + item->id()).toLatin1().constData(),
                  QVariant::fromValue( entry ) );
     connect( m_currentDevice.cache, SIGNAL( idToPathResolved( const QString &, const QString & ) ),
@@ -21,6 +21,9 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #define CONTROLPOINTTHREAD_H
 
 #include <QCache>
+#include <QElapsedTimer>
+#include <QMap>
+#include <QQueue>
 #include <QSet>
 
 #include <kio/slavebase.h>
@@ -30,6 +33,8 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include <HUpnpCore/HClientActionOp>
 #include <HUpnpCore/HDeviceInfo>
 
+#include "projection.h"
+
 namespace Herqq
 {
   namespace Upnp
@@ -37,6 +42,8 @@ namespace Herqq
     class HControlPoint;
     class HClientDevice;
     class HClientAction;
+    class HClientStateVariable;
+    class HStateVariableEvent;
   }
 }
 
@@ -49,11 +56,40 @@ namespace DIDL
 }
 
 class ObjectCache;
+class PagingController;
+class Cassette;
+class TraceSpan;
 
 #define BROWSE_DIRECT_CHILDREN "BrowseDirectChildren"
 #define BROWSE_METADATA "BrowseMetadata"
 
+// Browse requests a listing may have in flight, see README
+#define PIPELINE_ENV "KIO_UPNP_MS_PIPELINE"
+// however deep the pipeline is asked to be, never keep
+// more requests than this in flight for a listing
+#define PIPELINE_MAXIMUM_DEPTH 4
+// milliseconds at least between two requests of a pipeline
+#define PIPELINE_REQUEST_INTERVAL 100
+// ranges fetched at once from large containers, see README
+#define RANGES_ENV "KIO_UPNP_MS_RANGES"
+// children a container needs for its ranges to be fetched at once
+#define RANGES_MINIMUM_OBJECTS 1000
+// Browse and Search requests in flight to one device, at most
+#define DEVICE_MAXIMUM_REQUESTS 8
+// Browse requests a recursive listing keeps in flight
+#define CRAWL_MAXIMUM_REQUESTS 4
+
+// entries a listing hands over to KIO at once, see listEntries()
+#define ENTRY_BATCH_SIZE 256
+// milliseconds the first entry of a batch waits for it to fill
+#define ENTRY_BATCH_MSECS 200
+
+// milliseconds changed directories are collected for, so that
+// a burst of events makes for one KDirNotify signal each
+#define UPDATE_NOTIFY_MSECS 1000
+
 Q_DECLARE_METATYPE( KIO::UDSEntry );
+Q_DECLARE_METATYPE( KIO::UDSEntryList );
 Q_DECLARE_METATYPE( Herqq::Upnp::HActionArguments );
 /**
   This class implements a upnp kioslave
@@ -65,8 +101,14 @@ class ControlPointThread : public QObject
     struct MediaServerDevice {
         Herqq::Upnp::HClientDevice *device;
         Herqq::Upnp::HDeviceInfo info;
+        // the UDN without the uuid: prefix
+        QString uuid;
         ObjectCache *cache;
+        PagingController *paging;
         QStringList searchCapabilities;
+        QStringList sortCapabilities;
+        // the last one heard of, from GetSystemUpdateID or an event
+        QString systemUpdateId;
     };
 
   public:
@@ -90,6 +132,52 @@ class ControlPointThread : public QObject
      * Each capability is returned as a file entry with the name
      * being the exact proprety supported in the search.
      * It is recommended that a synchronous job be used to test this.
+     * The query option 'sortcapabilities' does the same for the
+     * properties the server can sort by.
+     *
+     * Sorting
+     *
+     * Passing 'sort' with a comma separated list of properties has
+     * the server return the children, or the search results, in
+     * that order, each page being the next window of the sorted
+     * listing. A property prefixed with '-' sorts descending,
+     * otherwise ascending ( '+' has to be percent encoded, as %2B ).
+     * Only properties listed by 'sortcapabilities' are accepted,
+     * for example 'sort=upnp:album,-dc:date'.
+     *
+     * Recursive listing
+     *
+     * Passing the query option 'recursive' lists everything below
+     * the path ( or 'id' ), the way KIO::listRecursive() does, but
+     * without a listDir() and a path resolution per directory.
+     * Containers are browsed by ID, breadth first, with up to
+     * CRAWL_MAXIMUM_REQUESTS Browse requests in flight.
+     * UDS_NAME and UDS_DISPLAY_NAME are paths relative to the
+     * listed directory, entries of different directories come
+     * in whatever order the pages arrive in. A directory which
+     * can not be browsed is left out, the top one is an error.
+     * 'fields' and 'sort' apply as for a plain listing.
+     *
+     * Statistics
+     *
+     * Passing the query option 'stats' lists counters and latency
+     * histograms kept by this slave process for the device, such as
+     * round trips, retries, cache hit rates and time spent throttling.
+     * Each value is returned as a file entry with UDS_NAME being
+     * the name of the value and UDS_SIZE the value.
+     *
+     * Fields
+     *
+     * Passing 'fields' with a comma separated list of DIDL-Lite
+     * properties, without namespace, only puts those in the entries
+     * and only asks the server for those. For example 'fields=res,size'
+     * is enough for a file manager, 'fields=' lists names only.
+     * Name, type, class, id and parent id are always there.
+     * The properties are those filled by default: date, creator,
+     * artist, album, genre, albumArtURI, channelName, channelNr,
+     * originalTrackNumber, res ( mime type and target URL ), size,
+     * duration, bitrate, resolution, childCount and refID.
+     * The "fields" metadata is used if the URL has none.
      *
      * Errors are always reported by error(), so if you do not
      * receive any entries, that means 0 items matched the search.
@@ -128,35 +216,68 @@ class ControlPointThread : public QObject
      *  - id : Optional. A string ID.
      *         When 'id' is passed, stat directly attempts to fetch meta-data for that id.
      *         This can be significantly faster and can be used by applications using the kio-slave
+     *  - fields : Optional. As for listDir().
+     *
+     * Objects listed less than ENTRY_CACHE_MSECS ago are answered
+     * from the listing, without asking the server again.
      */
     void stat( const KUrl &url );
 
+    /**
+     * Fields stat() and listDir() put in the entries when the
+     * URL has no fields= of its own, as from the "fields" metadata.
+     * A null string is every field.
+     */
+    void setFields( const QString &fields ) { m_defaultFields = fields; }
+
+    /**
+     * Entries listDir() collects into one listEntries() batch,
+     * ENTRY_BATCH_SIZE by default. With 0 every entry comes
+     * through listEntry() on its own.
+     */
+    void setEntryBatchSize( int size ) { m_entryBatchSize = size; }
+
     void run();
 
   private slots:
     void rootDeviceOnline(Herqq::Upnp::HClientDevice *device);
     void rootDeviceOffline(Herqq::Upnp::HClientDevice *device);
     void slotParseError( const QString &errorString );
+    void batchEntry( const KIO::UDSEntry &entry );
+    void cacheEntry( const KIO::UDSEntry &entry );
+    void emitStatEntry();
 
-    void slotListContainer( DIDL::Container *c );
-    void slotListItem( DIDL::Item *c );
     void slotListSearchContainer( DIDL::Container *c );
     void slotListSearchItem( DIDL::Item *item );
     void slotEmitSearchEntry( const QString &id, const QString &path );
 
     void browseInvokeDone(Herqq::Upnp::HClientAction *action, const Herqq::Upnp::HClientActionOp &invocationOp, bool ok, QString error );
     void browseResolvedPath( const DIDL::Object * );
-    void browseResolvedPath( const QString &id, uint start = 0, uint count = 30 );
+    void browseResolvedPath( const QString &id, uint start = 0 );
     void createDirectoryListing(const Herqq::Upnp::HClientActionOp &op);
+    void pipelinedBrowseDone( const Herqq::Upnp::HClientActionOp &op );
+    void fillPipeline();
+
+    void crawlResolvedPath( const DIDL::Object * );
+    void crawlBrowseDone( const Herqq::Upnp::HClientActionOp &op );
+    void crawlEntry( const KIO::UDSEntry &entry );
 
     void searchResolvedPath( const DIDL::Object * );
-    void searchResolvedPath( const QString &id, uint start = 0, uint count = 30 );
+    void searchResolvedPath( const QString &id, uint start = 0 );
     void createSearchListing( const Herqq::Upnp::HClientActionOp &op);
 
     void createStatResult( const Herqq::Upnp::HClientActionOp &op);
     void statResolvedPath( const DIDL::Object * );
 
     void searchCapabilitiesInvokeDone(Herqq::Upnp::HClientAction *action, const Herqq::Upnp::HClientActionOp &op, bool ok, QString errorString );
+    void sortCapabilitiesInvokeDone(Herqq::Upnp::HClientAction *action, const Herqq::Upnp::HClientActionOp &op, bool ok, QString errorString );
+    void systemUpdateIdInvokeDone(Herqq::Upnp::HClientAction *action, const Herqq::Upnp::HClientActionOp &op, bool ok, QString errorString );
+
+    void containerUpdateIdsChanged( const Herqq::Upnp::HClientStateVariable *source, const Herqq::Upnp::HStateVariableEvent &event );
+    void systemUpdateIdChanged( const Herqq::Upnp::HClientStateVariable *source, const Herqq::Upnp::HStateVariableEvent &event );
+    void emitChangeNotifications();
+
+    void replayNext();
 
   signals:
     /**
@@ -169,6 +290,13 @@ class ControlPointThread : public QObject
     void connected();
     /** Used for both stat() and listDir() **/
     void listEntry( const KIO::UDSEntry & );
+    /**
+     * Used by listDir() for the entries of a listing, so that
+     * they reach the application a batch at a time. A batch is
+     * emitted once it is full, once its first entry has waited
+     * ENTRY_BATCH_MSECS and at the end of every page.
+     */
+    void listEntries( const KIO::UDSEntryList & );
     void listingDone();
     void error( int type, const QString & ) const;
     void browseResult( const Herqq::Upnp::HClientActionOp& );
@@ -176,6 +304,10 @@ class ControlPointThread : public QObject
   private:
     bool updateDeviceInfo( const KUrl &url );
     bool ensureDevice( const KUrl &url );
+    void fetchSystemUpdateId( MediaServerDevice &dev );
+    void subscribeUpdates( MediaServerDevice &dev );
+    void containerChanged( const QString &uuid, ObjectCache *cache, const QString &id );
+    void notifyChanged( const QString &uuid, const QString &path );
     inline bool deviceFound();
     /**
      * Begins a UPnP Browse() or Search() action
@@ -194,23 +326,71 @@ class ControlPointThread : public QObject
                                const uint requestedCount,
                                const QString &sortCriteria );
 
+    /**
+     * Answers a browseOrSearchObject() from the Cassette
+     * instead of the device, still asynchronously
+     * through browseResult().
+     */
+    void replayBrowseOrSearch( const QString &id,
+                               const QString &secondArgument,
+                               const QString &filter,
+                               const uint startIndex,
+                               const uint requestedCount,
+                               const QString &sortCriteria );
+    bool replaying() const;
+    bool recording() const;
+    void emitBrowseResult( const Herqq::Upnp::HClientActionOp &op, uint generation );
+
+    /**
+     * Lists the children of @c id with up to pipelineDepth()
+     * Browse requests in flight, the first page alone to learn
+     * the number of children. Containers of RANGES_MINIMUM_OBJECTS
+     * or more get up to rangeCount() instead. Pages are listed in
+     * order, whatever order they arrive in.
+     */
+    void startPipeline( const QString &id, uint count );
+    void requestPage( uint start, uint count );
+    void stopPipeline();
+    static uint pipelineDepth();
+    static uint rangeCount();
+
+    void startCrawl( const QString &id );
+    void fillCrawl();
+    void stopCrawl();
+
     // uses m_currentDevice if not specified
     Herqq::Upnp::HClientService* contentDirectory(Herqq::Upnp::HClientDevice *forDevice = NULL) const;
     Herqq::Upnp::HClientAction* browseAction() const;
     Herqq::Upnp::HClientAction* searchAction() const;
 
-    void fillCommon( KIO::UDSEntry &entry, const DIDL::Object *obj );
-    void fillContainer( KIO::UDSEntry &entry, const DIDL::Container *c );
-    void fillItem( KIO::UDSEntry &entry, const DIDL::Item *item );
+    void emitEntries( const QString &didl, TraceSpan *span, bool batch = true );
+    void flushEntries();
+
+    bool selectFields( const KUrl &url );
+    bool selectSortCriteria( const KUrl &url );
+
+    static QStringList listingProperties();
+    static void fillCommon( KIO::UDSEntry &entry, const DIDL::Object *obj,
+                            Projection::Fields fields = Projection::AllFields );
+    static void fillContainer( KIO::UDSEntry &entry, const DIDL::Container *c,
+                               Projection::Fields fields = Projection::AllFields );
+    static void fillItem( KIO::UDSEntry &entry, const DIDL::Item *item,
+                          Projection::Fields fields = Projection::AllFields );
 
     Herqq::Upnp::HControlPoint *m_controlPoint;
 
     MediaServerDevice m_currentDevice;
 
     QString m_queryString;
+    // SortCriteria of the current listing, see selectSortCriteria()
+    QString m_sortCriteria;
     QString m_filter;
     bool m_getCount;
 
+    // of the current stat() or listDir(), see selectFields()
+    Projection::Fields m_fields;
+    QString m_defaultFields;
+
     // used to resolve relative paths
     uint m_searchListingCounter;
     QString m_baseSearchPath;
@@ -219,7 +399,80 @@ class ControlPointThread : public QObject
     QHash<QString, MediaServerDevice> m_devices;
     QString m_lastErrorString;
 
+    // entries of plain listings go to the ObjectCache,
+    // with the path of the directory if it is known
+    bool m_cacheEntries;
+    QString m_listingPath;
+    // answered from the ObjectCache, see emitStatEntry()
+    KIO::UDSEntry m_statEntry;
+
+    int m_entryBatchSize;
+    KIO::UDSEntryList m_entryBatch;
+    QElapsedTimer m_entryBatchAge;
+    // how long the last Browse or Search took, tries included
+    qint64 m_lastResponseMsecs;
+
+    Cassette *m_cassette;
+    struct ReplayedOp {
+        Herqq::Upnp::HClientActionOp op;
+        QString uuid;
+        bool ok;
+        QString error;
+        qint64 elapsed;
+        uint generation;
+    };
+    // ordered by (due time, sequence)
+    QMap<QPair<qint64, quint64>, ReplayedOp> m_replayQueue;
+    quint64 m_replaySequence;
+    QElapsedTimer m_replayClock;
+
+    struct Pipeline {
+        QString id;
+        // pages in flight or waiting to be listed, at most
+        uint depth;
+        uint total;
+        // StartingIndex of the next page to request, and to list
+        uint nextRequest;
+        uint nextListed;
+        // StartingIndex of the pages in flight
+        QSet<uint> requested;
+        // pages which arrived before the ones preceding them
+        QMap<uint, Herqq::Upnp::HClientActionOp> arrived;
+        QElapsedTimer lastRequest;
+        bool fillScheduled;
+    };
+    Pipeline m_pipeline;
+    struct Crawl {
+        bool active;
+        QString root;
+        // ObjectID and StartingIndex of the pages still to request,
+        // in the order containers were found, and of those in flight
+        QQueue< QPair<QString, uint> > queue;
+        QSet< QPair<QString, uint> > requested;
+        // name and display name paths of every container found,
+        // relative to the root
+        QHash< QString, QPair<QString, QString> > paths;
+        // those of the container whose page is being listed
+        QPair<QString, QString> prefix;
+    };
+    Crawl m_crawl;
+    // every request is stamped with the generation it was made
+    // in, and every stop of a pipeline or crawl begins a new one,
+    // so replies to the pages they left in flight are dropped
+    uint m_requestGeneration;
+    // Browse and Search requests in flight, per device
+    QHash<QString, uint> m_requestsInFlight;
+
+    // upnp-ms:// URLs of the directories changed since the last
+    // KDirNotify signals, see emitChangeNotifications()
+    QSet<QString> m_changedDirectories;
+    bool m_notifyScheduled;
+
     friend class ObjectCache;
+    // tests/didlbench.cpp measures the fill*() functions
+    friend class didlbench;
+    // tests/didlscannertest.cpp compares them with ListingParser
+    friend class didlscannertest;
 };
 
 #endif
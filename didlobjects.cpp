@@ -19,8 +19,80 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
 #include "didlobjects.h"
 
+#include <QStringRef>
+
 namespace DIDL {
 
+// in the order of Property and ResourceProperty
+static const char * const propertyNames[PropertyCount] = {
+    "date",
+    "creator",
+    "artist",
+    "album",
+    "genre",
+    "albumArtURI",
+    "channelName",
+    "channelNr",
+    "originalTrackNumber",
+    "childCount"
+};
+
+static const char * const resourcePropertyNames[ResourcePropertyCount] = {
+    "uri",
+    "mimetype",
+    "protocolInfo",
+    "size",
+    "duration",
+    "bitrate",
+    "resolution"
+};
+
+// the tables are short, a hash would cost more than it saves
+Property propertyForName( const QStringRef &name )
+{
+    for( int i = 0; i < PropertyCount; ++i ) {
+        if( name == QLatin1String( propertyNames[i] ) )
+            return Property( i );
+    }
+    return PropertyCount;
+}
+
+Property propertyForName( const QString &name )
+{
+    return propertyForName( QStringRef( &name ) );
+}
+
+ResourceProperty resourcePropertyForName( const QStringRef &name )
+{
+    for( int i = 0; i < ResourcePropertyCount; ++i ) {
+        if( name == QLatin1String( resourcePropertyNames[i] ) )
+            return ResourceProperty( i );
+    }
+    return ResourcePropertyCount;
+}
+
+ResourceProperty resourcePropertyForName( const QString &name )
+{
+    return resourcePropertyForName( QStringRef( &name ) );
+}
+
+QString Resource::value( const QString &name ) const
+{
+    const ResourceProperty property = resourcePropertyForName( name );
+    if( property != ResourcePropertyCount )
+        return m_properties[property];
+    return m_extra.value( name );
+}
+
+void Resource::insert( const QString &name, const QString &value )
+{
+    const ResourceProperty property = resourcePropertyForName( name );
+    if( property != ResourcePropertyCount )
+        m_properties[property] = value;
+    else
+        m_extra.insert( name, value );
+}
+
 Description::Description( const QString &id, const QUrl &ns )
     : SuperObject( SuperObject::Description, id )
     , m_namespace( ns )
@@ -34,24 +106,44 @@ Object::Object( Type type, const QString &id, const QString &parentId, bool rest
 {
 }
 
+void Object::setDataItem( const QString &key, const QString &value )
+{
+    const Property property = propertyForName( key );
+    if( property != PropertyCount )
+        m_properties[property] = value;
+    else
+        m_extra[key] = value;
+}
+
 Container::Container( const QString &id, const QString &parentId, bool restricted )
     : Object( SuperObject::Container, id, parentId, restricted )
 {
 }
 
+Container *Container::copy() const
+{
+    return new Container( *this );
+}
+
 Item::Item( const QString &id, const QString &parentId, bool restricted )
     : Object( SuperObject::Item, id, parentId, restricted )
+    , m_hasResource( false )
+{
+}
+
+Item *Item::copy() const
 {
+    return new Item( *this );
 }
 
 bool Item::hasResource() const
 {
     // if we decide to go the QList<Resource> way, all of these can
     // be changed without affecting the API too much
-    return !m_resource.empty();
+    return m_hasResource;
 }
 
-Resource Item::resource() const
+const Resource &Item::resource() const
 {
     return m_resource;
 }
@@ -59,5 +151,6 @@ Resource Item::resource() const
 void Item::addResource( const Resource &source )
 {
     m_resource = source;
+    m_hasResource = true;
 }
 } //~ namespace
@@ -23,11 +23,81 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include <QUrl>
 #include <QHash>
 
+class QStringRef;
+
 namespace DIDL {
 
-typedef QHash<QString, QString> Resource;
 typedef QHash<QString, QString> ExtraData;
 
+/**
+ * Well known meta-data, kept by every Object in a fixed
+ * slot rather than in a hash. The comments are the
+ * element names ( or attribute names ) they are read from.
+ */
+enum Property {
+    Date,                 // dc:date
+    Creator,              // dc:creator
+    Artist,               // upnp:artist
+    Album,                // upnp:album
+    Genre,                // upnp:genre
+    AlbumArtUri,          // upnp:albumArtURI
+    ChannelName,          // upnp:channelName
+    ChannelNumber,        // upnp:channelNr
+    OriginalTrackNumber,  // upnp:originalTrackNumber
+    ChildCount,           // @childCount of a container
+    PropertyCount
+};
+
+/**
+ * Well known attributes of a <res>, and its content.
+ */
+enum ResourceProperty {
+    ResourceUri,          // the text content
+    ResourceMimeType,     // third field of @protocolInfo
+    ResourceProtocolInfo,
+    ResourceSize,
+    ResourceDuration,
+    ResourceBitrate,
+    ResourceResolution,
+    ResourcePropertyCount
+};
+
+/**
+ * Returns the slot for the local element name @c name,
+ * or PropertyCount if it has none.
+ */
+Property propertyForName( const QStringRef &name );
+Property propertyForName( const QString &name );
+ResourceProperty resourcePropertyForName( const QStringRef &name );
+ResourceProperty resourcePropertyForName( const QString &name );
+
+/**
+ * A <res> element. Well known attributes live in fixed
+ * slots, any others in an overflow hash.
+ */
+class Resource
+{
+  public:
+    QString value( ResourceProperty property ) const { return m_properties[property]; }
+    void setValue( ResourceProperty property, const QString &value ) { m_properties[property] = value; }
+
+    /**
+     * By attribute name, or "uri" and "mimetype" for the
+     * content and mime type.
+     */
+    QString value( const QString &name ) const;
+    void insert( const QString &name, const QString &value );
+
+    /**
+     * Attributes without a slot.
+     */
+    ExtraData extra() const { return m_extra; }
+
+  private:
+    QString m_properties[ResourcePropertyCount];
+    ExtraData m_extra;
+};
+
 class SuperObject
 {
   public:
@@ -38,6 +108,8 @@ class SuperObject
     };
 
     SuperObject( Type t, const QString &id ) : m_type(t), m_id(id) {};
+    // the Parser deletes what it emitted through SuperObject
+    virtual ~SuperObject() {};
     Type type() const { return m_type; };
     QString id() const { return m_id; };
 
@@ -86,28 +158,38 @@ class Object : public SuperObject
     void setTitle( const QString &title ) { m_title = title; };
     void setUpnpClass( const QString &upnpClass ) { m_upnpClass = upnpClass; };
 
+    QString property( Property property ) const { return m_properties[property]; }
+    void setProperty( Property property, const QString &value ) { m_properties[property] = value; }
+
     /**
      * Any remaining meta-data or tags encountered
      * and their text content is available in the data
      * with tag name mapping to text content.
+     * Well known ones are in property() instead.
      *
      * Tag attributes are skipped.
      */
     inline ExtraData data() const { return m_extra; }
 
     /**
-     * Set an extra data item.
-     * Meant to be used by the Parser.
+     * Set an extra data item, goes to its
+     * property() slot if it is a well known one.
      */
-    inline void setDataItem( const QString &key, const QString &value ) {
-      m_extra[key] = value;
-    }
+    void setDataItem( const QString &key, const QString &value );
+
+    /**
+     * Returns a heap allocated copy, owned by the caller.
+     * Objects emitted by the Parser belong to it, anything
+     * keeping one around longer has to copy it.
+     */
+    virtual Object *copy() const = 0;
 
   private:
     QString m_parentId;
     bool m_restricted;
     QString m_title;
     QString m_upnpClass;
+    QString m_properties[PropertyCount];
     ExtraData m_extra;
 };
 
@@ -116,6 +198,7 @@ class Container : public Object
   public:
     Container( const QString &id, const QString &parentId, bool restricted );
 
+    Container *copy() const;
 };
 
 class Item : public Object
@@ -123,8 +206,10 @@ class Item : public Object
   public:
     Item( const QString &id, const QString &parentId, bool restricted );
 
+    Item *copy() const;
+
     bool hasResource() const;
-    Resource resource() const;
+    const Resource &resource() const;
     void addResource( const Resource &res );
 
     void setRefId( const QString &id ) { m_refId = id; }
@@ -135,6 +220,7 @@ class Item : public Object
     // practice. Similarly we should hold a list
     // for multiple resources, but does it happen?
     Resource m_resource;
+    bool m_hasResource;
     QString m_refId;
 
 };
@@ -20,23 +20,53 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include "didlparser.h"
 
 #include <QStringList>
-#include <QXmlStreamReader>
 #include <klocale.h>
 
 #include <kdebug.h>
 
 #include "didlobjects.h"
+#include "didlreader.h"
+#include "didlscanner.h"
+#include "stringpool.h"
+#include "tracer.h"
 
 namespace DIDL {
+static Parser::Backend defaultBackend()
+{
+    static const Parser::Backend backend = qgetenv( SCANNER_ENV ) == "1"
+        ? Parser::ScannerBackend : Parser::StreamReaderBackend;
+    return backend;
+}
+
 Parser::Parser()
     : QObject( 0 )
     , m_reader( 0 )
+    , m_strings( 0 )
+    , m_streamReader( new StreamReader )
+    , m_scanner( 0 )
+    , m_backend( defaultBackend() )
+    , m_wantAll( true )
+    , m_stopped( false )
 {
+    m_reader = m_streamReader;
 }
 
 Parser::~Parser()
 {
-    delete m_reader;
+    deleteObjects();
+    delete m_streamReader;
+    delete m_scanner;
+}
+
+bool Parser::scanned() const
+{
+    return m_scanner && m_reader == m_scanner;
+}
+
+void Parser::deleteObjects()
+{
+    qDeleteAll( m_objects );
+    m_objects.clear();
 }
 
 bool Parser::interpretRestricted(const QStringRef &res)
@@ -46,6 +76,50 @@ bool Parser::interpretRestricted(const QStringRef &res)
     return false;
 }
 
+void Parser::stop()
+{
+    m_stopped = true;
+}
+
+void Parser::setWantedProperties( const QStringList &names )
+{
+    m_wantAll = false;
+    m_wanted = names;
+}
+
+/**
+ * The wanted list is short, comparing against the
+ * reference saves materialising every element name.
+ */
+bool Parser::wanted( const QStringRef &name ) const
+{
+    if( m_wantAll )
+        return true;
+    foreach( const QString &wantedName, m_wanted ) {
+        if( name == wantedName )
+            return true;
+    }
+    return false;
+}
+
+QString Parser::protocolInfoMimeType( const QStringRef &protocolInfo )
+{
+    const QChar *data = protocolInfo.unicode();
+    const int length = protocolInfo.length();
+    int colons[3];
+    int found = 0;
+    for( int i = 0; i < length; ++i ) {
+        if( data[i] != QLatin1Char(':') )
+            continue;
+        if( found == 3 )
+            return QString();
+        colons[found++] = i;
+    }
+    if( found != 3 )
+        return QString();
+    return QString( data + colons[1] + 1, colons[2] - colons[1] - 1 );
+}
+
 void Parser::raiseError( const QString &errorStr )
 {
     m_reader->raiseError( errorStr );
@@ -53,27 +127,81 @@ void Parser::raiseError( const QString &errorStr )
     m_reader->clear();
 }
 
+QString Parser::present( const QString &text )
+{
+    return text.isNull() ? QString( QLatin1String("") ) : text;
+}
+
+QString Parser::intern( const QString &value )
+{
+    return m_strings ? m_strings->intern( value ) : value;
+}
+
+/**
+ * The properties most objects of a listing share
+ * their value for, worth pooling.
+ */
+static bool repeats( Property property )
+{
+    switch( property ) {
+    case Creator:
+    case Artist:
+    case Album:
+    case Genre:
+        return true;
+    default:
+        return false;
+    }
+}
+
 Resource Parser::parseResource()
 {
     Resource r;
-    QString protocolInfo = m_reader->attributes().value(QLatin1String("protocolInfo")).toString();
+    const QXmlStreamAttributes attributes = m_reader->attributes();
+    const QStringRef protocolInfo = attributes.value(QLatin1String("protocolInfo"));
     if( !protocolInfo.isEmpty() ) {
-        QStringList fields = protocolInfo.split(QLatin1String(":"));
-        if( fields.length() != 4 ) {
-            raiseError( i18n("Bad protocolInfo %1", (protocolInfo)) );
+        const QString mimetype = protocolInfoMimeType( protocolInfo );
+        if( mimetype.isNull() ) {
+            raiseError( i18n("Bad protocolInfo %1", protocolInfo.toString()) );
             return Resource();
         }
-        r.insert(QLatin1String("mimetype"), fields[2]);
+        r.setValue(ResourceMimeType, intern( mimetype ));
     }
 
-    foreach( QXmlStreamAttribute attr, m_reader->attributes() ) {
-        r.insert(attr.name().toString(), attr.value().toString());
+    for( int i = 0; i < attributes.size(); ++i ) {
+        const QXmlStreamAttribute &attr = attributes[i];
+        const ResourceProperty property = resourcePropertyForName( attr.name() );
+        if( property == ResourceProtocolInfo )
+            r.setValue(property, intern( attr.value().toString() ));
+        else if( !wanted( attr.name() ) )
+            continue;
+        else if( property != ResourcePropertyCount )
+            r.setValue(property, present( attr.value().toString() ));
+        else
+            r.insert(attr.name().toString(), attr.value().toString());
     }
-    r.insert(QLatin1String("uri"), m_reader->readElementText());
+    r.setValue(ResourceUri, present( m_reader->readElementText() ));
 
     return r;
 }
 
+/**
+ * Reads the element at the cursor into its slot in @c o,
+ * only materialising the element name when it has none.
+ */
+void Parser::parseProperty( Object *o )
+{
+    const Property property = propertyForName( m_reader->name() );
+    if( property != PropertyCount ) {
+        const QString value = present( m_reader->readElementText() );
+        o->setProperty( property, repeats( property ) ? intern( value ) : value );
+    }
+    else {
+        const QString name = m_reader->name().toString();
+        o->setDataItem( name, m_reader->readElementText() );
+    }
+}
+
 bool Parser::parseObjectCommon( Object *o )
 {
     if( m_reader->name() == QLatin1String("title") ) {
@@ -81,7 +209,7 @@ bool Parser::parseObjectCommon( Object *o )
         return true;
     }
     else if( m_reader->name() == QLatin1String("class") ) {
-        o->setUpnpClass( m_reader->readElementText() );
+        o->setUpnpClass( intern( m_reader->readElementText() ) );
         return true;
     }
     return false;
@@ -99,15 +227,27 @@ void Parser::parseItem()
 
     while( m_reader->readNextStartElement() ) {
         if( parseObjectCommon( item ) ) {
+            if( titlesAndIdsOnly() && !item->title().isNull() && !item->upnpClass().isNull() ) {
+                // nothing else is wanted, move on to the end of the item
+                m_reader->skipCurrentElement();
+                break;
+            }
         }
         else if( m_reader->name() == QLatin1String("res") ) {
-            item->addResource( parseResource() );
+            if( wanted( m_reader->name() ) )
+                item->addResource( parseResource() );
+            else
+                m_reader->skipCurrentElement();
+        }
+        else if( wanted( m_reader->name() ) ) {
+            parseProperty( item );
         }
         else {
-            item->setDataItem( m_reader->name().toString(), m_reader->readElementText() );
+            m_reader->skipCurrentElement();
         }
     }
 
+    m_objects << item;
     emit itemParsed( item );
 }
 
@@ -120,17 +260,25 @@ void Parser::parseContainer()
         interpretRestricted( attributes.value(QLatin1String("restricted")) ) );
 
     if( attributes.hasAttribute(QLatin1String("childCount")) )
-        container->setDataItem( QLatin1String("childCount"),
-                                attributes.value(QLatin1String("childCount")).toString() );
+        container->setProperty( ChildCount,
+                                present( attributes.value(QLatin1String("childCount")).toString() ) );
 
     while( m_reader->readNextStartElement() ) {
         if( parseObjectCommon( container ) ) {
+            if( titlesAndIdsOnly() && !container->title().isNull() && !container->upnpClass().isNull() ) {
+                m_reader->skipCurrentElement();
+                break;
+            }
+        }
+        else if( wanted( m_reader->name() ) ) {
+            parseProperty( container );
         }
         else {
-            container->setDataItem( m_reader->name().toString(), m_reader->readElementText() );
+            m_reader->skipCurrentElement();
         }
     }
 
+    m_objects << container;
     emit containerParsed( container );
 }
 
@@ -141,15 +289,79 @@ void Parser::parseDescription()
         attributes.value(QLatin1String("id")).toString(),
         attributes.value(QLatin1String("nameSpace")).toString() );
     description->setDescription( m_reader->readElementText() );
+    m_objects << description;
+    emit descriptionParsed( description );
+}
+
+/**
+ * Returns the Scanner if it is to try the next
+ * document, 0 if QXmlStreamReader is to read it.
+ */
+Scanner *Parser::scanner()
+{
+    if( m_backend != ScannerBackend )
+        return 0;
+    if( !m_scanner )
+        m_scanner = new Scanner;
+    return m_scanner;
 }
 
 void Parser::parse(const QString &input)
 {
-    if( m_reader ) {
-        delete m_reader;
+    // includes the time spent in slots connected to *Parsed()
+    TraceSpan span( "DIDL::Parser::parse" );
+    if( span.enabled() )
+        span.setArgument( "characters", QString::number( input.length() ) );
+
+    deleteObjects();
+    m_streamReader->clear();
+    Scanner *scanner = this->scanner();
+    if( scanner && scanner->setDocument( input ) ) {
+        m_reader = scanner;
+    }
+    else {
+        if( scanner )
+            kDebug() << "Reading with QXmlStreamReader," << scanner->unusual();
+        m_streamReader->addData(input);
+        m_reader = m_streamReader;
+    }
+    if( span.enabled() )
+        span.setArgument( "scanned", QString::fromLatin1( scanned() ? "true" : "false" ) );
+    parseDocument();
+}
+
+void Parser::parse(const QByteArray &input)
+{
+    TraceSpan span( "DIDL::Parser::parse" );
+    if( span.enabled() )
+        span.setArgument( "bytes", QString::number( input.size() ) );
+
+    deleteObjects();
+    m_streamReader->clear();
+    Scanner *scanner = this->scanner();
+    if( scanner && scanner->setDocument( input ) ) {
+        m_reader = scanner;
+    }
+    else {
+        if( scanner )
+            kDebug() << "Reading with QXmlStreamReader," << scanner->unusual();
+        m_streamReader->addData(input);
+        m_reader = m_streamReader;
     }
-    m_reader = new QXmlStreamReader(input);
-    while( !m_reader->atEnd() ) {
+    if( span.enabled() )
+        span.setArgument( "scanned", QString::fromLatin1( scanned() ? "true" : "false" ) );
+    parseDocument();
+}
+
+/**
+ * The document is complete, but was handed over through
+ * addData(), so reading past the root element would end in
+ * a PrematureEndOfDocumentError. The loop stops at its end tag.
+ */
+void Parser::parseDocument()
+{
+    m_stopped = false;
+    while( !m_reader->atEnd() && !m_stopped ) {
         if( !m_reader->readNextStartElement() )
             break;
         if( m_reader->name() == QLatin1String("item") ) {
@@ -22,8 +22,13 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
 #include <QObject>
 #include <QHash>
+#include <QStringList>
 
-class QXmlStreamReader;
+class QStringRef;
+class StringPool;
+
+// set to 1 to read documents with the DIDL::Scanner by default
+#define SCANNER_ENV "KIO_UPNP_MS_SCANNER"
 
 namespace DIDL {
 
@@ -32,8 +37,10 @@ class Item;
 class Description;
 class SuperObject;
 class Object;
-
-typedef QHash<QString, QString> Resource;
+class Resource;
+class Reader;
+class StreamReader;
+class Scanner;
 
 /**
  * This class implements a parser for the 
@@ -46,6 +53,13 @@ typedef QHash<QString, QString> Resource;
  * root element. Their children can be accessed through the
  * elements themselves.
  * 
+ * Every object emitted while parsing one document is owned
+ * by the parser and stays valid until the next parse()
+ * or until the parser is destroyed, so a parser kept on
+ * the stack for one response frees that response's objects
+ * in one go. Receivers that keep an object for longer,
+ * like the ObjectCache, take an Object::copy().
+ *
  * @see DIDL::Container
  * @see DIDL::Item
  * @see DIDL::Description
@@ -56,8 +70,54 @@ class Parser : public QObject
 {
   Q_OBJECT
   public:
+    enum Backend {
+        // QXmlStreamReader, reads anything
+        StreamReaderBackend,
+        // DIDL::Scanner, faster on what CDS servers send
+        // and falls back to QXmlStreamReader on the rest
+        ScannerBackend
+    };
+
     Parser();
-    ~Parser();
+    virtual ~Parser();
+
+    /**
+     * Chooses how documents are read, from the next parse() on.
+     * Defaults to ScannerBackend if KIO_UPNP_MS_SCANNER is 1,
+     * StreamReaderBackend otherwise. Either way the same
+     * objects and errors are emitted.
+     */
+    void setBackend( Backend backend ) { m_backend = backend; }
+    Backend backend() const { return m_backend; }
+
+    /**
+     * Whether the last document was read by the Scanner,
+     * rather than by QXmlStreamReader.
+     */
+    bool scanned() const;
+
+    /**
+     * Restricts what is collected into Object::data() and
+     * Item::resource() to the elements and <res> attributes
+     * named in @c names, for example "date" or "size". Everything
+     * else is skipped without being copied out of the document.
+     * A <res> is only read at all if "res" is wanted.
+     * IDs, title, class and childCount are always collected.
+     *
+     * An empty list gives a titles-and-IDs parse, which moves
+     * on to the next object as soon as title and class are read.
+     *
+     * By default everything is collected.
+     */
+    void setWantedProperties( const QStringList &names );
+
+    /**
+     * Values that repeat across a listing, like upnp:class,
+     * genre, artist or the mime type, are taken from @c pool
+     * so that equal ones share their data. The pool is not
+     * owned by the parser. By default nothing is pooled.
+     */
+    void setStringPool( StringPool *pool ) { m_strings = pool; }
 
   public slots:
     /**
@@ -66,10 +126,27 @@ class Parser : public QObject
      * with the complete XML input until one
      * off @c done() or @c error() is called.
      * 
-     * Calling this again will restart the parser.
+     * Calling this again will restart the parser,
+     * deleting the objects of the previous document.
      */
     void parse(const QString &input);
 
+    /**
+     * Parses the encoded document in @c input, honouring its
+     * XML declaration and defaulting to UTF-8. Saves decoding
+     * into a QString first when the raw reply is at hand.
+     */
+    void parse(const QByteArray &input);
+
+    /**
+     * Stops parsing once the object being emitted
+     * has been handled, without reading the rest
+     * of the document. done() is still emitted.
+     * Meant to be called from a slot connected to
+     * one of the *Parsed() signals.
+     */
+    void stop();
+
   signals:
     /**
      * Emitted in case of an error at any point
@@ -82,35 +159,62 @@ class Parser : public QObject
      */
     void done();
 
-    // NOTE should we emit pointers?
     /**
      * Emitted when a top-level <item> is completely parsed
-     * The caller should delete the item.
+     * The item belongs to the parser, see below.
      */
     void itemParsed(DIDL::Item *);
 
     /**
      * Emitted when a top-level <container> is completely parsed.
-     * The caller should delete the container.
+     * The container belongs to the parser, see below.
      */
     void containerParsed(DIDL::Container *);
 
     /**
      * Emitted for a top-level <desc> element is parsed.
-     * The caller should delete the description.
+     * The description belongs to the parser, see below.
      */
     void descriptionParsed(DIDL::Description *);
 
- private:
+ protected:
     /**
      * The restricted attribute of a DIDL object is a "1"
      * or "0", convert to a boolean
      */
     bool interpretRestricted(const QStringRef &res);
-    void parseItem();
-    void parseContainer();
+
+    /**
+     * Returns the third of the four fields of a protocolInfo,
+     * or a null string if it does not have four fields.
+     */
+    static QString protocolInfoMimeType( const QStringRef &protocolInfo );
+
+    /**
+     * Slots tell a missing property by it being null,
+     * so properties which are present are never null.
+     */
+    static QString present( const QString &text );
+
+    // the pooled copy of @c value, if there is a pool
+    QString intern( const QString &value );
+
+    // called with the reader on the start tag of a top-level
+    // element, they have to leave it on the matching end tag
+    virtual void parseItem();
+    virtual void parseContainer();
+
+    // emits error() and stops the parser
+    void raiseError( const QString &errorStr=QString() );
+
+    // one of the two below, for the current document
+    Reader *m_reader;
+    StringPool *m_strings;
+
+ private:
     void parseDescription();
     Resource parseResource();
+    void parseProperty( Object *o );
 
    /**
      * returns true if it actually parsed something,
@@ -118,10 +222,22 @@ class Parser : public QObject
      */
     bool parseObjectCommon( Object *o );
 
-    // emits error() and stops the parser
-    void raiseError( const QString &errorStr=QString() );
-
-    QXmlStreamReader *m_reader;
+    bool wanted( const QStringRef &name ) const;
+    bool titlesAndIdsOnly() const { return !m_wantAll && m_wanted.isEmpty(); }
+    void parseDocument();
+    void deleteObjects();
+    Scanner *scanner();
+
+    // reused by every parse()
+    StreamReader *m_streamReader;
+    Scanner *m_scanner;
+    Backend m_backend;
+
+    bool m_wantAll;
+    QStringList m_wanted;
+    bool m_stopped;
+    // everything emitted for the current document
+    QList<SuperObject *> m_objects;
 };
 
 } //~ namespace
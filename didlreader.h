@@ -0,0 +1,79 @@
+/********************************************************************
+ This file is part of the KDE project.
+
+Copyright (C) 2010 Nikhil Marathe <nsm.nikhil@gmail.com>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*********************************************************************/
+
+#ifndef DIDL_READER_H
+#define DIDL_READER_H
+
+#include <QXmlStreamReader>
+
+namespace DIDL {
+
+/**
+ * The part of QXmlStreamReader the parsers use,
+ * so that the Scanner can stand in for it.
+ * The functions behave like their QXmlStreamReader
+ * namesakes.
+ */
+class Reader
+{
+  public:
+    virtual ~Reader() {}
+
+    virtual bool atEnd() const = 0;
+    virtual bool hasError() const = 0;
+    virtual QString errorString() const = 0;
+    virtual void raiseError( const QString &message ) = 0;
+    virtual void clear() = 0;
+
+    virtual bool readNextStartElement() = 0;
+    virtual QStringRef name() const = 0;
+    virtual QXmlStreamAttributes attributes() const = 0;
+    virtual QString readElementText() = 0;
+    virtual void skipCurrentElement() = 0;
+};
+
+/**
+ * Reads with QXmlStreamReader, which takes any well-formed
+ * document and reports exactly what is wrong with the others.
+ */
+class StreamReader : public Reader
+{
+  public:
+    void addData( const QString &data ) { m_reader.addData( data ); }
+    void addData( const QByteArray &data ) { m_reader.addData( data ); }
+
+    bool atEnd() const { return m_reader.atEnd(); }
+    bool hasError() const { return m_reader.hasError(); }
+    QString errorString() const { return m_reader.errorString(); }
+    void raiseError( const QString &message ) { m_reader.raiseError( message ); }
+    void clear() { m_reader.clear(); }
+
+    bool readNextStartElement() { return m_reader.readNextStartElement(); }
+    QStringRef name() const { return m_reader.name(); }
+    QXmlStreamAttributes attributes() const { return m_reader.attributes(); }
+    QString readElementText() { return m_reader.readElementText(); }
+    void skipCurrentElement() { m_reader.skipCurrentElement(); }
+
+  private:
+    QXmlStreamReader m_reader;
+};
+
+} //~ namespace
+
+#endif
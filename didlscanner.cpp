@@ -0,0 +1,693 @@
+/********************************************************************
+ This file is part of the KDE project.
+
+Copyright (C) 2010 Nikhil Marathe <nsm.nikhil@gmail.com>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*********************************************************************/
+
+#include "didlscanner.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace DIDL {
+
+static inline bool isSpace( ushort c )
+{
+    // a carriage return would need normalising
+    return c == ' ' || c == '\t' || c == '\n';
+}
+
+// non-ASCII names are left to QXmlStreamReader
+static inline bool isNameStart( ushort c )
+{
+    return ( c >= 'a' && c <= 'z' ) || ( c >= 'A' && c <= 'Z' ) || c == '_';
+}
+
+static inline bool isNameChar( ushort c )
+{
+    return isNameStart( c ) || ( c >= '0' && c <= '9' ) || c == '-' || c == '.';
+}
+
+// characters scanText() stops at
+static inline bool isTextSpecial( ushort c )
+{
+    return c == '<' || c == '&' || c == '>'
+        || ( c < 0x20 && c != '\t' && c != '\n' ) || c >= 0xfffd;
+}
+
+// characters scanAttributeValue() stops at
+static inline bool isValueSpecial( ushort c, ushort quote )
+{
+    return c == quote || c == '&' || c == '<' || c < 0x20 || c >= 0xfffd;
+}
+
+static inline bool isXmlChar( uint c )
+{
+    return c == 0x9 || c == 0xa || c == 0xd
+        || ( c >= 0x20 && c <= 0xd7ff )
+        || ( c >= 0xe000 && c <= 0xfffd )
+        || ( c >= 0x10000 && c <= 0x10ffff );
+}
+
+#ifdef __SSE2__
+// lanes below U+0020 or at U+FFFD and above
+static inline __m128i unusualLanes( __m128i chunk )
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i control = _mm_cmpeq_epi16( _mm_subs_epu16( chunk, _mm_set1_epi16( 0x1f ) ), zero );
+    const __m128i belowFffd = _mm_cmpeq_epi16( _mm_subs_epu16( chunk, _mm_set1_epi16( short( 0xfffc ) ) ), zero );
+    return _mm_or_si128( control, _mm_andnot_si128( belowFffd, _mm_set1_epi16( -1 ) ) );
+}
+
+// the first lane set in a _mm_movemask_epi8() of 16 bit lanes
+static inline int firstLane( int bits )
+{
+#ifdef __GNUC__
+    return __builtin_ctz( bits ) / 2;
+#else
+    int lane = 0;
+    while( !( bits & 1 ) ) {
+        bits >>= 2;
+        ++lane;
+    }
+    return lane;
+#endif
+}
+#endif
+
+Scanner::Scanner()
+    : m_data( 0 )
+    , m_size( 0 )
+    , m_current( -1 )
+{
+}
+
+bool Scanner::setDocument( const QString &document )
+{
+    clear();
+    m_unusual = QString();
+    m_document = document;
+    if( !scan() ) {
+        clear();
+        return false;
+    }
+    return true;
+}
+
+bool Scanner::setDocument( const QByteArray &document )
+{
+    // QXmlStreamReader honours the declared encoding,
+    // decoding anything but UTF-8 is left to it
+    if( document.startsWith( "<?xml" ) ) {
+        const int end = document.indexOf( "?>" );
+        const int encoding = end == -1 ? -1 : document.lastIndexOf( "encoding", end );
+        if( encoding != -1 ) {
+            int i = encoding + 8;
+            while( i < end && document[i] != '"' && document[i] != '\'' )
+                ++i;
+            const int valueEnd = i < end ? document.indexOf( document[i], i + 1 ) : -1;
+            const QByteArray name = valueEnd == -1 ? QByteArray() : document.mid( i + 1, valueEnd - i - 1 ).toLower();
+            if( name != "utf-8" && name != "utf8" ) {
+                clear();
+                m_unusual = QLatin1String("not UTF-8");
+                return false;
+            }
+        }
+    }
+    return setDocument( QString::fromUtf8( document.constData(), document.size() ) );
+}
+
+bool Scanner::fail( const char *reason )
+{
+    m_unusual = QLatin1String( reason );
+    return false;
+}
+
+/**
+ * Returns the index of the '<' ending the text at @c from,
+ * the end of the document, or -1 if the text is unusual.
+ */
+int Scanner::scanText( int from, bool *entities )
+{
+    int i = from;
+#ifdef __SSE2__
+    const __m128i lt = _mm_set1_epi16( '<' );
+    const __m128i amp = _mm_set1_epi16( '&' );
+    const __m128i gt = _mm_set1_epi16( '>' );
+    const __m128i tab = _mm_set1_epi16( '\t' );
+    const __m128i newline = _mm_set1_epi16( '\n' );
+#endif
+    forever {
+#ifdef __SSE2__
+        for( ; i + 8 <= m_size; i += 8 ) {
+            const __m128i chunk = _mm_loadu_si128( reinterpret_cast<const __m128i *>( m_data + i ) );
+            __m128i lanes = _mm_or_si128( _mm_cmpeq_epi16( chunk, lt ), _mm_cmpeq_epi16( chunk, amp ) );
+            lanes = _mm_or_si128( lanes, _mm_cmpeq_epi16( chunk, gt ) );
+            const __m128i allowed = _mm_or_si128( _mm_cmpeq_epi16( chunk, tab ), _mm_cmpeq_epi16( chunk, newline ) );
+            lanes = _mm_or_si128( lanes, _mm_andnot_si128( allowed, unusualLanes( chunk ) ) );
+            const int bits = _mm_movemask_epi8( lanes );
+            if( bits ) {
+                i += firstLane( bits );
+                break;
+            }
+        }
+#endif
+        while( i < m_size && !isTextSpecial( m_data[i] ) )
+            ++i;
+        if( i == m_size || m_data[i] == '<' )
+            return i;
+
+        if( m_data[i] == '&' ) {
+            const int end = entityEnd( i );
+            if( end == -1 ) {
+                fail( "unknown entity reference" );
+                return -1;
+            }
+            *entities = true;
+            i = end;
+        }
+        else if( m_data[i] == '>' ) {
+            if( i - from >= 2 && m_data[i - 1] == ']' && m_data[i - 2] == ']' ) {
+                fail( "']]>' in text" );
+                return -1;
+            }
+            ++i;
+        }
+        else {
+            fail( "control character or noncharacter" );
+            return -1;
+        }
+    }
+}
+
+/**
+ * Returns the index of the closing @c quote,
+ * or -1 if the value is unusual.
+ */
+int Scanner::scanAttributeValue( int from, ushort quote, bool *entities )
+{
+    int i = from;
+#ifdef __SSE2__
+    const __m128i quotes = _mm_set1_epi16( quote );
+    const __m128i amp = _mm_set1_epi16( '&' );
+    const __m128i lt = _mm_set1_epi16( '<' );
+#endif
+    forever {
+#ifdef __SSE2__
+        for( ; i + 8 <= m_size; i += 8 ) {
+            const __m128i chunk = _mm_loadu_si128( reinterpret_cast<const __m128i *>( m_data + i ) );
+            __m128i lanes = _mm_or_si128( _mm_cmpeq_epi16( chunk, quotes ), _mm_cmpeq_epi16( chunk, amp ) );
+            lanes = _mm_or_si128( lanes, _mm_cmpeq_epi16( chunk, lt ) );
+            lanes = _mm_or_si128( lanes, unusualLanes( chunk ) );
+            const int bits = _mm_movemask_epi8( lanes );
+            if( bits ) {
+                i += firstLane( bits );
+                break;
+            }
+        }
+#endif
+        while( i < m_size && !isValueSpecial( m_data[i], quote ) )
+            ++i;
+        if( i == m_size ) {
+            fail( "unterminated attribute value" );
+            return -1;
+        }
+        if( m_data[i] == quote )
+            return i;
+
+        if( m_data[i] == '&' ) {
+            const int end = entityEnd( i );
+            if( end == -1 ) {
+                fail( "unknown entity reference" );
+                return -1;
+            }
+            *entities = true;
+            i = end;
+        }
+        else {
+            fail( "'<' or whitespace needing normalisation in an attribute value" );
+            return -1;
+        }
+    }
+}
+
+/**
+ * Returns the index after the reference starting with
+ * the '&' at @c from, or -1 if it is not one we decode.
+ */
+int Scanner::entityEnd( int from ) const
+{
+    int i = from + 1;
+    if( i < m_size && m_data[i] == '#' ) {
+        ++i;
+        const bool hex = i < m_size && m_data[i] == 'x';
+        if( hex )
+            ++i;
+        uint value = 0;
+        int digits = 0;
+        for( ; i < m_size && m_data[i] != ';'; ++i ) {
+            const ushort c = m_data[i];
+            uint digit;
+            if( c >= '0' && c <= '9' )
+                digit = c - '0';
+            else if( hex && c >= 'a' && c <= 'f' )
+                digit = c - 'a' + 10;
+            else if( hex && c >= 'A' && c <= 'F' )
+                digit = c - 'A' + 10;
+            else
+                return -1;
+            if( ++digits > 7 )
+                return -1;
+            value = value * ( hex ? 16 : 10 ) + digit;
+        }
+        if( i == m_size || digits == 0 || !isXmlChar( value ) )
+            return -1;
+        return i + 1;
+    }
+
+    static const char * const names[] = { "amp;", "lt;", "gt;", "quot;", "apos;" };
+    for( uint n = 0; n < sizeof( names ) / sizeof( names[0] ); ++n ) {
+        const char *name = names[n];
+        int j = 0;
+        while( name[j] && i + j < m_size && m_data[i + j] == name[j] )
+            ++j;
+        if( !name[j] )
+            return i + j;
+    }
+    return -1;
+}
+
+/**
+ * Returns the index after the name at @c from, or -1 if
+ * there is none. @c localOffset is set to the offset of
+ * the local name, after the prefix and colon if any.
+ */
+int Scanner::scanName( int from, int *localOffset ) const
+{
+    int i = from;
+    if( i >= m_size || !isNameStart( m_data[i] ) )
+        return -1;
+    ++i;
+    int colon = -1;
+    while( i < m_size ) {
+        if( isNameChar( m_data[i] ) )
+            ++i;
+        else if( m_data[i] == ':' && colon == -1 && i + 1 < m_size && isNameStart( m_data[i + 1] ) )
+            colon = i++;
+        else
+            break;
+    }
+    *localOffset = colon == -1 ? 0 : colon + 1 - from;
+    return i;
+}
+
+bool Scanner::sameName( int a, int b, int length ) const
+{
+    for( int i = 0; i < length; ++i ) {
+        if( m_data[a + i] != m_data[b + i] )
+            return false;
+    }
+    return true;
+}
+
+bool Scanner::declared( int begin, int length ) const
+{
+    if( length == 3 && m_data[begin] == 'x' && m_data[begin + 1] == 'm' && m_data[begin + 2] == 'l' )
+        return true;
+    for( int i = m_declarations.size() - 1; i >= 0; --i ) {
+        const Declaration &declaration = m_declarations[i];
+        if( declaration.prefixLength == length && sameName( declaration.prefixBegin, begin, length ) )
+            return true;
+    }
+    return false;
+}
+
+/**
+ * Forgets the declarations of the element
+ * closed with @c depth elements left open.
+ */
+void Scanner::leaveScope( int depth )
+{
+    int size = m_declarations.size();
+    while( size > 0 && m_declarations[size - 1].depth >= depth )
+        --size;
+    m_declarations.resize( size );
+}
+
+static inline bool equals( const ushort *data, int length, const char *latin1 )
+{
+    int i = 0;
+    for( ; i < length; ++i ) {
+        if( !latin1[i] || data[i] != latin1[i] )
+            return false;
+    }
+    return !latin1[i];
+}
+
+/**
+ * Tokenizes the whole document, so that nothing is
+ * emitted from a document the Scanner cannot read.
+ */
+bool Scanner::scan()
+{
+    m_data = reinterpret_cast<const ushort *>( m_document.unicode() );
+    m_size = m_document.size();
+    m_tokens.reserve( m_size / 64 );
+
+    int p = 0;
+    if( m_size > 5 && equals( m_data, 5, "<?xml" ) && isSpace( m_data[5] ) ) {
+        p = m_document.indexOf( QLatin1String("?>"), 5 );
+        if( p == -1 || m_document.lastIndexOf( QLatin1Char('<'), p ) != 0 )
+            return fail( "bad XML declaration" );
+        p += 2;
+    }
+
+    QVector<int> open;
+    bool rootDone = false;
+    forever {
+        const int textBegin = p;
+        bool entities = false;
+        p = scanText( p, &entities );
+        if( p == -1 )
+            return false;
+        if( open.isEmpty() ) {
+            for( int i = textBegin; i < p; ++i ) {
+                if( !isSpace( m_data[i] ) )
+                    return fail( "text outside the root element" );
+            }
+        }
+        else if( entities ) {
+            m_tokens[open.last()].entities = true;
+        }
+        if( p == m_size )
+            break;
+
+        if( p + 1 == m_size )
+            return fail( "truncated tag" );
+
+        // an end tag
+        if( m_data[p + 1] == '/' ) {
+            if( open.isEmpty() )
+                return fail( "end tag without start tag" );
+            const int nameBegin = p + 2;
+            int localOffset;
+            const int nameEnd = scanName( nameBegin, &localOffset );
+            const Token &start = m_tokens[open.last()];
+            if( nameEnd == -1 || nameEnd - nameBegin != start.qualifiedLength
+                || !sameName( nameBegin, start.qualifiedBegin, start.qualifiedLength ) )
+                return fail( "mismatched end tag" );
+            int q = nameEnd;
+            while( q < m_size && isSpace( m_data[q] ) )
+                ++q;
+            if( q == m_size || m_data[q] != '>' )
+                return fail( "bad end tag" );
+
+            const Token end = { nameBegin, nameEnd - nameBegin, localOffset, p, -1, 0, 0, false };
+            m_tokens[open.last()].match = m_tokens.size();
+            m_tokens.append( end );
+            open.resize( open.size() - 1 );
+            leaveScope( open.size() );
+            rootDone = open.isEmpty();
+            p = q + 1;
+            continue;
+        }
+
+        if( m_data[p + 1] == '!' || m_data[p + 1] == '?' )
+            return fail( "comment, CDATA section, DOCTYPE or processing instruction" );
+        if( rootDone )
+            return fail( "more than one root element" );
+
+        // a start tag
+        const int nameBegin = p + 1;
+        int localOffset;
+        const int nameEnd = scanName( nameBegin, &localOffset );
+        if( nameEnd == -1 )
+            return fail( "bad start tag" );
+        Token start = { nameBegin, nameEnd - nameBegin, localOffset, 0, -1, m_attributes.size(), 0, false };
+        const int depth = open.size();
+
+        int q = nameEnd;
+        bool empty = false;
+        forever {
+            const int spaceBegin = q;
+            while( q < m_size && isSpace( m_data[q] ) )
+                ++q;
+            if( q == m_size )
+                return fail( "truncated start tag" );
+            if( m_data[q] == '>' ) {
+                ++q;
+                break;
+            }
+            if( m_data[q] == '/' ) {
+                if( q + 1 == m_size || m_data[q + 1] != '>' )
+                    return fail( "bad start tag" );
+                empty = true;
+                q += 2;
+                break;
+            }
+            if( q == spaceBegin )
+                return fail( "bad start tag" );
+
+            const int attributeBegin = q;
+            int attributeLocalOffset;
+            const int attributeEnd = scanName( q, &attributeLocalOffset );
+            if( attributeEnd == -1 )
+                return fail( "bad attribute" );
+            q = attributeEnd;
+            while( q < m_size && isSpace( m_data[q] ) )
+                ++q;
+            if( q == m_size || m_data[q] != '=' )
+                return fail( "bad attribute" );
+            ++q;
+            while( q < m_size && isSpace( m_data[q] ) )
+                ++q;
+            if( q == m_size || ( m_data[q] != '"' && m_data[q] != '\'' ) )
+                return fail( "bad attribute" );
+            const int valueBegin = q + 1;
+            bool valueEntities = false;
+            const int valueEnd = scanAttributeValue( valueBegin, m_data[q], &valueEntities );
+            if( valueEnd == -1 )
+                return false;
+            q = valueEnd + 1;
+
+            const int attributeLength = attributeEnd - attributeBegin;
+            const ushort *attributeName = m_data + attributeBegin;
+            if( attributeLocalOffset == 0 && equals( attributeName, attributeLength, "xmlns" ) )
+                continue;
+            if( attributeLocalOffset == 6 && equals( attributeName, 5, "xmlns" ) ) {
+                if( valueEnd == valueBegin )
+                    return fail( "empty namespace declaration" );
+                const Declaration declaration = { attributeBegin + 6, attributeLength - 6, depth };
+                m_declarations.append( declaration );
+                continue;
+            }
+            for( int i = start.firstAttribute; i < m_attributes.size(); ++i ) {
+                if( m_attributes[i].qualifiedLength == attributeLength
+                    && sameName( m_attributes[i].qualifiedBegin, attributeBegin, attributeLength ) )
+                    return fail( "duplicate attribute" );
+            }
+            const Attribute attribute = { attributeBegin, attributeLength, attributeLocalOffset,
+                                          valueBegin, valueEnd - valueBegin, valueEntities };
+            m_attributes.append( attribute );
+        }
+        start.attributeCount = m_attributes.size() - start.firstAttribute;
+        start.contentBegin = q;
+
+        // now that the declarations of the tag itself are known
+        if( localOffset && !declared( nameBegin, localOffset - 1 ) )
+            return fail( "undeclared namespace prefix" );
+        for( int i = start.firstAttribute; i < m_attributes.size(); ++i ) {
+            const Attribute &attribute = m_attributes[i];
+            if( attribute.localOffset && !declared( attribute.qualifiedBegin, attribute.localOffset - 1 ) )
+                return fail( "undeclared namespace prefix" );
+        }
+
+        const int index = m_tokens.size();
+        m_tokens.append( start );
+        if( empty ) {
+            const Token end = { nameBegin, nameEnd - nameBegin, localOffset, q, -1, 0, 0, false };
+            m_tokens[index].match = index + 1;
+            m_tokens.append( end );
+            leaveScope( depth );
+            rootDone = depth == 0;
+        }
+        else {
+            open.append( index );
+        }
+        p = q;
+    }
+
+    if( !rootDone )
+        return fail( "unterminated document" );
+    return true;
+}
+
+/**
+ * The text from @c begin to @c end, with references
+ * decoded. Null if empty, as by QXmlStreamReader.
+ */
+QString Scanner::text( int begin, int end, bool entities ) const
+{
+    if( begin == end )
+        return QString();
+    if( !entities )
+        return QString( reinterpret_cast<const QChar *>( m_data + begin ), end - begin );
+
+    QString result;
+    result.reserve( end - begin );
+    int run = begin;
+    for( int i = begin; i < end; ++i ) {
+        if( m_data[i] != '&' )
+            continue;
+        result.append( QStringRef( &m_document, run, i - run ) );
+        const int referenceEnd = entityEnd( i );
+        if( m_data[i + 1] == '#' ) {
+            const bool hex = m_data[i + 2] == 'x';
+            const uint value = QStringRef( &m_document, i + ( hex ? 3 : 2 ), referenceEnd - i - ( hex ? 4 : 3 ) )
+                                   .toString().toUInt( 0, hex ? 16 : 10 );
+            if( value > 0xffff ) {
+                result.append( QChar( QChar::highSurrogate( value ) ) );
+                result.append( QChar( QChar::lowSurrogate( value ) ) );
+            }
+            else {
+                result.append( QChar( value ) );
+            }
+        }
+        else {
+            switch( m_data[i + 1] ) {
+            case 'a':
+                result.append( QLatin1Char( m_data[i + 2] == 'm' ? '&' : '\'' ) );
+                break;
+            case 'l':
+                result.append( QLatin1Char('<') );
+                break;
+            case 'g':
+                result.append( QLatin1Char('>') );
+                break;
+            default:
+                result.append( QLatin1Char('"') );
+            }
+        }
+        i = referenceEnd - 1;
+        run = referenceEnd;
+    }
+    result.append( QStringRef( &m_document, run, end - run ) );
+    return result;
+}
+
+bool Scanner::atEnd() const
+{
+    return hasError() || m_current >= m_tokens.size();
+}
+
+void Scanner::raiseError( const QString &message )
+{
+    // an error without a message is still an error
+    m_error = message.isNull() ? QString( QLatin1String("") ) : message;
+}
+
+void Scanner::clear()
+{
+    m_document = QString();
+    m_data = 0;
+    m_size = 0;
+    m_tokens.clear();
+    m_attributes.clear();
+    m_declarations.clear();
+    m_current = -1;
+    m_error = QString();
+}
+
+bool Scanner::readNextStartElement()
+{
+    if( hasError() )
+        return false;
+    if( m_tokens.isEmpty() ) {
+        // what QXmlStreamReader says once clear()ed
+        m_error = QLatin1String("Premature end of document.");
+        return false;
+    }
+    if( m_current + 1 >= m_tokens.size() ) {
+        m_current = m_tokens.size();
+        return false;
+    }
+    ++m_current;
+    return m_tokens[m_current].match != -1;
+}
+
+QStringRef Scanner::name() const
+{
+    if( m_current < 0 || m_current >= m_tokens.size() )
+        return QStringRef();
+    const Token &token = m_tokens[m_current];
+    return QStringRef( &m_document, token.qualifiedBegin + token.localOffset,
+                       token.qualifiedLength - token.localOffset );
+}
+
+QXmlStreamAttributes Scanner::attributes() const
+{
+    QXmlStreamAttributes result;
+    if( m_current < 0 || m_current >= m_tokens.size() || m_tokens[m_current].match == -1 )
+        return result;
+
+    const Token &token = m_tokens[m_current];
+    result.reserve( token.attributeCount );
+    for( int i = token.firstAttribute; i < token.firstAttribute + token.attributeCount; ++i ) {
+        const Attribute &attribute = m_attributes[i];
+        const QString name( reinterpret_cast<const QChar *>( m_data + attribute.qualifiedBegin + attribute.localOffset ),
+                            attribute.qualifiedLength - attribute.localOffset );
+        // present but empty values are empty, not null
+        const QString value = attribute.valueLength == 0 ? QString( QLatin1String("") )
+            : text( attribute.valueBegin, attribute.valueBegin + attribute.valueLength, attribute.entities );
+        result.append( QString(), name, value );
+    }
+    return result;
+}
+
+QString Scanner::readElementText()
+{
+    if( m_current < 0 || m_current >= m_tokens.size() || m_tokens[m_current].match == -1 )
+        return QString();
+
+    const Token &start = m_tokens[m_current];
+    if( start.match != m_current + 1 ) {
+        // stop at the child element, like QXmlStreamReader
+        const Token &child = m_tokens[m_current + 1];
+        const QString result = text( start.contentBegin, child.qualifiedBegin - 1, start.entities );
+        ++m_current;
+        m_error = QLatin1String("Expected character data.");
+        return result;
+    }
+    const int end = start.match;
+    m_current = end;
+    return text( start.contentBegin, m_tokens[end].contentBegin, start.entities );
+}
+
+void Scanner::skipCurrentElement()
+{
+    if( m_current >= 0 && m_current < m_tokens.size() && m_tokens[m_current].match != -1 ) {
+        m_current = m_tokens[m_current].match;
+        return;
+    }
+    // on an end tag, skip to the end tag of the enclosing element
+    int i = m_current + 1;
+    while( i < m_tokens.size() && m_tokens[i].match != -1 )
+        i = m_tokens[i].match + 1;
+    m_current = qMin( i, m_tokens.size() );
+}
+
+} //~ namespace
@@ -0,0 +1,143 @@
+/********************************************************************
+ This file is part of the KDE project.
+
+Copyright (C) 2010 Nikhil Marathe <nsm.nikhil@gmail.com>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*********************************************************************/
+
+#ifndef DIDL_SCANNER_H
+#define DIDL_SCANNER_H
+
+#include <QString>
+#include <QVector>
+
+#include "didlreader.h"
+
+namespace DIDL {
+
+/**
+ * A Reader for the plain XML CDS servers send, which finds
+ * tags, quotes and entity references eight characters at a
+ * time ( with SSE2, else one at a time ) and matches every
+ * element with its end tag in a single pass over the document.
+ * Skipping an element is then a jump, and readElementText()
+ * copies the text in one go.
+ *
+ * setDocument() refuses anything outside that subset, leaving
+ * it to QXmlStreamReader:
+ *  - comments, CDATA sections, processing instructions
+ *    other than the XML declaration and DOCTYPEs
+ *  - entity references other than the predefined ones
+ *    and character references
+ *  - carriage returns, tabs or newlines in attribute values,
+ *    control characters and U+FFFD and above, since these
+ *    need normalising, are errors or hint at bad encoding
+ *  - undeclared namespace prefixes, duplicate attributes
+ *    and anything else that is not well-formed
+ *  - a byte document declaring an encoding other than UTF-8
+ *
+ * Attributes keep their local name and value,
+ * but not their namespace URI.
+ */
+class Scanner : public Reader
+{
+  public:
+    Scanner();
+
+    /**
+     * Scans @c document, returning false if the
+     * Scanner cannot read it, see unusual().
+     */
+    bool setDocument( const QString &document );
+    bool setDocument( const QByteArray &document );
+
+    /**
+     * Why setDocument() last returned false.
+     */
+    QString unusual() const { return m_unusual; }
+
+    bool atEnd() const;
+    bool hasError() const { return !m_error.isNull(); }
+    QString errorString() const { return m_error; }
+    void raiseError( const QString &message );
+    void clear();
+
+    bool readNextStartElement();
+    QStringRef name() const;
+    QXmlStreamAttributes attributes() const;
+    QString readElementText();
+    void skipCurrentElement();
+
+  private:
+    // a start or an end tag
+    struct Token {
+        int qualifiedBegin;
+        int qualifiedLength;
+        // of the local name within the qualified one
+        int localOffset;
+        // start tags: after the '>', end tags: at the '<'
+        int contentBegin;
+        // start tags: the index of their end tag, end tags: -1
+        int match;
+        int firstAttribute;
+        int attributeCount;
+        // the text directly inside has entity references
+        bool entities;
+    };
+
+    struct Attribute {
+        int qualifiedBegin;
+        int qualifiedLength;
+        int localOffset;
+        int valueBegin;
+        int valueLength;
+        bool entities;
+    };
+
+    struct Declaration {
+        int prefixBegin;
+        int prefixLength;
+        // number of elements open when it goes out of scope
+        int depth;
+    };
+
+    bool scan();
+    bool fail( const char *reason );
+    int scanText( int from, bool *entities );
+    int scanAttributeValue( int from, ushort quote, bool *entities );
+    int entityEnd( int from ) const;
+    int scanName( int from, int *localOffset ) const;
+    bool declared( int begin, int length ) const;
+    void leaveScope( int depth );
+    bool sameName( int a, int b, int length ) const;
+    QString text( int begin, int end, bool entities ) const;
+
+    QString m_document;
+    const ushort *m_data;
+    int m_size;
+
+    QVector<Token> m_tokens;
+    QVector<Attribute> m_attributes;
+    QVector<Declaration> m_declarations;
+    // token being read, -1 before the first
+    int m_current;
+
+    QString m_error;
+    QString m_unusual;
+};
+
+} //~ namespace
+
+#endif
@@ -28,6 +28,8 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
 #include <QCoreApplication>
 
+#include "tracer.h"
+
 /*
  * The main thread running in UPnPMS is mainly a forwarder
  * of calls to the ControlPointThread. The KIO system is
@@ -90,7 +92,11 @@ void UPnPMS::waitLoop()
 
 void UPnPMS::stat( const KUrl &url )
 {
+    TraceSpan span( "UPnPMS::stat" );
+    if( span.enabled() )
+        span.setArgument( "url", url.prettyUrl() );
     kDebug() << "STATSTATSTAT-----|||||||||||||||||||||||||||||||||||||||||||||||";
+    m_cpthread->setFields( metaData( QLatin1String("fields") ) );
     connect( this, SIGNAL( startStat( const KUrl &) ),
              m_cpthread, SLOT( stat( const KUrl &) ) );
     connect( m_cpthread, SIGNAL( listEntry( const KIO::UDSEntry &) ),
@@ -101,11 +107,18 @@ void UPnPMS::stat( const KUrl &url )
 
 void UPnPMS::get( const KUrl &url )
 {
+    TraceSpan span( "UPnPMS::get" );
+    if( span.enabled() )
+        span.setArgument( "url", url.prettyUrl() );
     kDebug() << "GETGETGETGETGET-----|||||||||||||||||||||||||||||||||||||||||||||||";
+    // the redirection needs the resource, whatever the fields
+    KUrl statUrl( url );
+    statUrl.removeQueryItem( QLatin1String("fields") );
+    m_cpthread->setFields( QString() );
     connect( this, SIGNAL( startStat( const KUrl &) ),
              m_cpthread, SLOT( stat( const KUrl &) ) );
     connect( m_cpthread, SIGNAL( listEntry( const KIO::UDSEntry & ) ), this, SLOT( slotRedirect( const KIO::UDSEntry & ) ) );
-    emit startStat( url );
+    emit startStat( statUrl );
     waitLoop();
 }
 
@@ -122,11 +135,20 @@ void UPnPMS::slotError( int type, const QString &message )
 
 void UPnPMS::listDir( const KUrl &url )
 {
+    TraceSpan span( "UPnPMS::listDir" );
+    if( span.enabled() )
+        span.setArgument( "url", url.prettyUrl() );
     kDebug() << "LISTDIR-----|||||||||||||||||||||||||||||||||||||||||||||||";
+    // lets benchmarks compare with entries sent one by one
+    const QString batchSize = metaData( QLatin1String("entry-batch") );
+    m_cpthread->setEntryBatchSize( batchSize.isEmpty() ? ENTRY_BATCH_SIZE : batchSize.toInt() );
+    m_cpthread->setFields( metaData( QLatin1String("fields") ) );
     connect( this, SIGNAL( startListDir( const KUrl &) ),
              m_cpthread, SLOT( listDir( const KUrl &) ) );
     connect( m_cpthread, SIGNAL( listEntry( const KIO::UDSEntry &) ),
                        this, SLOT( slotListEntry( const KIO::UDSEntry & ) ) );
+    connect( m_cpthread, SIGNAL( listEntries( const KIO::UDSEntryList &) ),
+                       this, SLOT( slotListEntries( const KIO::UDSEntryList & ) ) );
     connect( m_cpthread, SIGNAL( listingDone() ),
                        this, SLOT( slotListingDone() ) );
     emit startListDir( url );
@@ -171,12 +193,19 @@ void UPnPMS::slotListEntry( const KIO::UDSEntry &entry )
     listEntry( entry, false );
 }
 
+void UPnPMS::slotListEntries( const KIO::UDSEntryList &entries )
+{
+    listEntries( entries );
+}
+
 void UPnPMS::slotListingDone()
 {
     disconnect( this, SIGNAL( startListDir( const KUrl &) ),
              m_cpthread, SLOT( listDir( const KUrl &) ) );
     disconnect( m_cpthread, SIGNAL( listEntry( const KIO::UDSEntry &) ),
               this, SLOT( slotListEntry( const KIO::UDSEntry & ) ) );
+    disconnect( m_cpthread, SIGNAL( listEntries( const KIO::UDSEntryList &) ),
+              this, SLOT( slotListEntries( const KIO::UDSEntryList & ) ) );
     disconnect( m_cpthread, SIGNAL( listingDone() ),
                        this, SLOT( slotListingDone() ) );
     KIO::UDSEntry entry;
@@ -187,6 +216,7 @@ void UPnPMS::slotListingDone()
 
 void UPnPMS::openConnection()
 {
+    TraceSpan span( "UPnPMS::openConnection" );
     kDebug() << "OPENCONNECTION-----|||||||||||||||||||||||||||||||||||||||||||||||";
     if( m_connectedHost.isNull() ) {
         error( KIO::ERR_UNKNOWN_HOST, QString() );
@@ -0,0 +1,203 @@
+/********************************************************************
+ This file is part of the KDE project.
+
+Copyright (C) 2010 Nikhil Marathe <nsm.nikhil@gmail.com>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*********************************************************************/
+
+#include "listingparser.h"
+
+#include <sys/stat.h>
+
+#include <QUrl>
+#include "didlreader.h"
+
+#include <klocale.h>
+
+#include "upnp-ms-types.h"
+
+struct Field {
+    const char *name;
+    uint uds;
+    // shared by many objects of a listing, see StringPool
+    bool repeats;
+    Projection::Field projected;
+};
+
+// child elements of <item> and <container>, what fillCommon() fills
+static const Field objectFields[] = {
+    { "date", KIO::UPNP_DATE, false, Projection::Date },
+    { "creator", KIO::UPNP_CREATOR, true, Projection::Creator },
+    { "artist", KIO::UPNP_ARTIST, true, Projection::Artist },
+    { "album", KIO::UPNP_ALBUM, true, Projection::Album },
+    { "genre", KIO::UPNP_GENRE, true, Projection::Genre },
+    { "albumArtURI", KIO::UPNP_ALBUMART_URI, false, Projection::AlbumArtUri },
+    { "channelName", KIO::UPNP_CHANNEL_NAME, false, Projection::ChannelName },
+    { "channelNr", KIO::UPNP_CHANNEL_NUMBER, false, Projection::ChannelNumber }
+};
+
+// child elements only fillItem() fills
+static const Field itemFields[] = {
+    { "originalTrackNumber", KIO::UPNP_TRACK_NUMBER, false, Projection::OriginalTrackNumber }
+};
+
+// <res> attributes passed through as they are,
+// protocolInfo and size need converting
+static const Field resourceFields[] = {
+    { "duration", KIO::UPNP_DURATION, false, Projection::ResourceDuration },
+    { "bitrate", KIO::UPNP_BITRATE, false, Projection::ResourceBitrate },
+    { "resolution", KIO::UPNP_IMAGE_RESOLUTION, false, Projection::ResourceResolution }
+};
+enum { ResourceFieldCount = sizeof( resourceFields ) / sizeof( Field ) };
+
+template<int N>
+static inline int fieldIndex( const Field (&fields)[N], const QStringRef &name )
+{
+    for( int i = 0; i < N; ++i ) {
+        if( name == QLatin1String( fields[i].name ) )
+            return i;
+    }
+    return -1;
+}
+
+ListingParser::ListingParser()
+    : m_entries( 0 )
+    , m_fields( Projection::AllFields )
+{
+}
+
+void ListingParser::parseItem()
+{
+    parseObject( true );
+}
+
+void ListingParser::parseContainer()
+{
+    parseObject( false );
+}
+
+void ListingParser::parseObject( bool isItem )
+{
+    KIO::UDSEntry entry;
+
+    const QXmlStreamAttributes attributes = m_reader->attributes();
+    entry.insert( KIO::UPNP_ID, attributes.value(QLatin1String("id")).toString() );
+    entry.insert( KIO::UPNP_PARENT_ID, attributes.value(QLatin1String("parentID")).toString() );
+    if( isItem ) {
+        if( ( m_fields & Projection::RefId ) && attributes.hasAttribute(QLatin1String("refID")) )
+            entry.insert( KIO::UPNP_REF_ID, attributes.value(QLatin1String("refID")).toString() );
+    }
+    else if( ( m_fields & Projection::ChildCount ) && attributes.hasAttribute(QLatin1String("childCount")) ) {
+        entry.insert( KIO::UPNP_ALBUM_CHILDCOUNT,
+                      present( attributes.value(QLatin1String("childCount")).toString() ) );
+    }
+
+    QString title;
+    // only the last <res> counts, like with Item::addResource()
+    bool hasResource = false;
+    QString mimeType;
+    QString size;
+    QString uri;
+    QString resourceValues[ResourceFieldCount];
+
+    while( m_reader->readNextStartElement() ) {
+        const QStringRef name = m_reader->name();
+        int i;
+        if( name == QLatin1String("title") ) {
+            // a '/' would be taken for a separator, as in Parser::parseObjectCommon()
+            title = m_reader->readElementText().replace( QLatin1String("/"), QLatin1String("%2f") );
+        }
+        else if( name == QLatin1String("class") ) {
+            const QString upnpClass = intern( m_reader->readElementText() );
+            if( !upnpClass.isNull() )
+                entry.insert( KIO::UPNP_CLASS, upnpClass );
+        }
+        else if( ( i = fieldIndex( objectFields, name ) ) != -1 && ( m_fields & objectFields[i].projected ) ) {
+            const QString value = present( m_reader->readElementText() );
+            entry.insert( objectFields[i].uds, objectFields[i].repeats ? intern( value ) : value );
+        }
+        else if( !isItem ) {
+            m_reader->skipCurrentElement();
+        }
+        else if( ( i = fieldIndex( itemFields, name ) ) != -1 && ( m_fields & itemFields[i].projected ) ) {
+            entry.insert( itemFields[i].uds, present( m_reader->readElementText() ) );
+        }
+        else if( name == QLatin1String("res") && ( m_fields & Projection::Resource ) ) {
+            const QXmlStreamAttributes resAttributes = m_reader->attributes();
+            hasResource = true;
+            mimeType = QString();
+            size = QString();
+            for( int j = 0; j < ResourceFieldCount; ++j )
+                resourceValues[j] = QString();
+
+            for( int j = 0; j < resAttributes.size(); ++j ) {
+                const QXmlStreamAttribute &attr = resAttributes[j];
+                if( attr.name() == QLatin1String("protocolInfo") ) {
+                    if( attr.value().isEmpty() )
+                        continue;
+                    mimeType = protocolInfoMimeType( attr.value() );
+                    if( mimeType.isNull() ) {
+                        raiseError( i18n("Bad protocolInfo %1", attr.value().toString()) );
+                        return;
+                    }
+                    mimeType = intern( mimeType );
+                }
+                else if( attr.name() == QLatin1String("size") ) {
+                    if( !( m_fields & Projection::ResourceSize ) )
+                        continue;
+                    size = attr.value().toString();
+                }
+                else if( ( i = fieldIndex( resourceFields, attr.name() ) ) != -1
+                         && ( m_fields & resourceFields[i].projected ) ) {
+                    resourceValues[i] = present( attr.value().toString() );
+                }
+            }
+            uri = m_reader->readElementText();
+        }
+        else {
+            m_reader->skipCurrentElement();
+        }
+    }
+
+    entry.insert( KIO::UDSEntry::UDS_NAME, title );
+    entry.insert( KIO::UDSEntry::UDS_DISPLAY_NAME, QUrl::fromPercentEncoding( title.toLatin1() ) );
+
+    long long access = 0;
+    // an item without a resource has nothing to read, one
+    // projected without can't be told apart, so it stays readable
+    if( !isItem || hasResource || !( m_fields & Projection::Resource ) )
+        access |= S_IRUSR | S_IRGRP | S_IROTH;
+    entry.insert( KIO::UDSEntry::UDS_ACCESS, access );
+
+    if( isItem ) {
+        entry.insert( KIO::UDSEntry::UDS_FILE_TYPE, S_IFREG );
+        if( hasResource ) {
+            entry.insert( KIO::UDSEntry::UDS_MIME_TYPE, mimeType );
+            if( m_fields & Projection::ResourceSize )
+                entry.insert( KIO::UDSEntry::UDS_SIZE, size.toULongLong() );
+            entry.insert( KIO::UDSEntry::UDS_TARGET_URL, uri );
+        }
+        for( int j = 0; j < ResourceFieldCount; ++j ) {
+            if( !resourceValues[j].isNull() )
+                entry.insert( resourceFields[j].uds, resourceValues[j] );
+        }
+    }
+    else {
+        entry.insert( KIO::UDSEntry::UDS_FILE_TYPE, S_IFDIR );
+    }
+
+    m_entries++;
+    emit entryParsed( entry );
+}
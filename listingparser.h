@@ -0,0 +1,70 @@
+/********************************************************************
+ This file is part of the KDE project.
+
+Copyright (C) 2010 Nikhil Marathe <nsm.nikhil@gmail.com>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*********************************************************************/
+
+#ifndef LISTINGPARSER_H
+#define LISTINGPARSER_H
+
+#include <kio/udsentry.h>
+
+#include "didlparser.h"
+#include "projection.h"
+
+/**
+ * Parses DIDL-Lite straight into the UDSEntries of a listing,
+ * without going through DIDL::Item and DIDL::Container.
+ *
+ * Elements and <res> attributes are looked up in a fixed table
+ * of the UDS fields they fill, everything else is skipped.
+ * The entries are the ones ControlPointThread::fillItem() and
+ * fillContainer() would build from the objects.
+ *
+ * itemParsed() and containerParsed() are never emitted,
+ * error() and done() are, as by DIDL::Parser.
+ */
+class ListingParser : public DIDL::Parser
+{
+  Q_OBJECT
+  public:
+    ListingParser();
+
+    /**
+     * Only puts @c fields in the entries, elements and
+     * attributes for other fields are skipped.
+     * By default every field is.
+     */
+    void setFields( Projection::Fields fields ) { m_fields = fields; }
+
+    // entries emitted since construction
+    quint64 entries() const { return m_entries; }
+
+  signals:
+    void entryParsed( const KIO::UDSEntry &entry );
+
+  protected:
+    void parseItem();
+    void parseContainer();
+
+  private:
+    void parseObject( bool isItem );
+
+    quint64 m_entries;
+    Projection::Fields m_fields;
+};
+
+#endif
@@ -0,0 +1,144 @@
+/********************************************************************
+ This file is part of the KDE project.
+
+Copyright (C) 2010 Nikhil Marathe <nsm.nikhil@gmail.com>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*********************************************************************/
+
+#include "metrics.h"
+
+#include <QHash>
+
+Histogram::Histogram()
+    : m_count( 0 )
+    , m_sum( 0 )
+{
+    for( int i = 0; i < Buckets; ++i )
+        m_buckets[i] = 0;
+}
+
+void Histogram::add( qint64 value )
+{
+    if( value < 0 )
+        value = 0;
+    int i = 0;
+    while( i < Buckets - 1 && ( Q_INT64_C(1) << i ) <= value )
+        ++i;
+    m_buckets[i]++;
+    m_count++;
+    m_sum += value;
+}
+
+Metrics::Metrics()
+    : tries( 0 )
+    , retries( 0 )
+    , timeouts( 0 )
+    , backoffMsecs( 0 )
+    , failures( 0 )
+    , requestsInFlightPeak( 0 )
+    , browseInvocations( 0 )
+    , searchInvocations( 0 )
+    , didlCharacters( 0 )
+    , objectsReceived( 0 )
+    , pathHits( 0 )
+    , pathMisses( 0 )
+    , idHits( 0 )
+    , idMisses( 0 )
+    , entryHits( 0 )
+    , entryMisses( 0 )
+    , missingHits( 0 )
+    , indexHits( 0 )
+    , indexWrites( 0 )
+    , containersChanged( 0 )
+    , notifications( 0 )
+    , cacheBytes( 0 )
+    , cacheBudget( 0 )
+    , cacheTrims( 0 )
+    , segmentsResolved( 0 )
+    , throttleMsecs( 0 )
+{
+}
+
+Metrics *Metrics::forDevice( const QString &uuid )
+{
+    // devices come and go, but their numbers are
+    // worth keeping for as long as the slave lives
+    static QHash<QString, Metrics *> metrics;
+    Metrics *&m = metrics[uuid];
+    if( !m )
+        m = new Metrics;
+    return m;
+}
+
+void Metrics::actionDone( const QString &action, qint64 msecs, bool ok )
+{
+    if( !ok )
+        failures++;
+    if( action == QLatin1String("Browse") ) {
+        browseInvocations++;
+        browseLatency.add( msecs );
+    }
+    else if( action == QLatin1String("Search") ) {
+        searchInvocations++;
+        searchLatency.add( msecs );
+    }
+}
+
+static void addHistogram( Metrics::Values &values, const QString &name, const Histogram &histogram )
+{
+    values << qMakePair( name + QLatin1String(".count"), histogram.count() );
+    values << qMakePair( name + QLatin1String(".sum_ms"), histogram.sum() );
+    for( int i = 0; i < Histogram::Buckets; ++i ) {
+        if( histogram.bucket( i ) == 0 )
+            continue;
+        values << qMakePair( name + QLatin1String(".lt_") + QString::number( Q_INT64_C(1) << i ) + QLatin1String("ms"),
+                             histogram.bucket( i ) );
+    }
+}
+
+Metrics::Values Metrics::values() const
+{
+    Values values;
+    values << qMakePair( QString::fromLatin1("actions.tries"), tries );
+    values << qMakePair( QString::fromLatin1("actions.retries"), retries );
+    values << qMakePair( QString::fromLatin1("actions.timeouts"), timeouts );
+    values << qMakePair( QString::fromLatin1("actions.backoff.ms"), backoffMsecs );
+    values << qMakePair( QString::fromLatin1("actions.failures"), failures );
+    values << qMakePair( QString::fromLatin1("requests.in_flight.peak"), requestsInFlightPeak );
+    values << qMakePair( QString::fromLatin1("browse.invocations"), browseInvocations );
+    addHistogram( values, QLatin1String("browse.latency"), browseLatency );
+    values << qMakePair( QString::fromLatin1("search.invocations"), searchInvocations );
+    addHistogram( values, QLatin1String("search.latency"), searchLatency );
+    values << qMakePair( QString::fromLatin1("didl.characters"), didlCharacters );
+    values << qMakePair( QString::fromLatin1("didl.objects"), objectsReceived );
+    values << qMakePair( QString::fromLatin1("cache.path.hits"), pathHits );
+    values << qMakePair( QString::fromLatin1("cache.path.misses"), pathMisses );
+    values << qMakePair( QString::fromLatin1("cache.id.hits"), idHits );
+    values << qMakePair( QString::fromLatin1("cache.id.misses"), idMisses );
+    values << qMakePair( QString::fromLatin1("cache.entry.hits"), entryHits );
+    values << qMakePair( QString::fromLatin1("cache.entry.misses"), entryMisses );
+    values << qMakePair( QString::fromLatin1("cache.missing.hits"), missingHits );
+    values << qMakePair( QString::fromLatin1("cache.bytes"), cacheBytes );
+    values << qMakePair( QString::fromLatin1("cache.budget"), cacheBudget );
+    values << qMakePair( QString::fromLatin1("cache.trims"), cacheTrims );
+    values << qMakePair( QString::fromLatin1("cache.index.hits"), indexHits );
+    values << qMakePair( QString::fromLatin1("cache.index.writes"), indexWrites );
+    values << qMakePair( QString::fromLatin1("events.containers.changed"), containersChanged );
+    values << qMakePair( QString::fromLatin1("events.notifications"), notifications );
+    values << qMakePair( QString::fromLatin1("resolve.segments"), segmentsResolved );
+    addHistogram( values, QLatin1String("resolve.latency"), resolveLatency );
+    values << qMakePair( QString::fromLatin1("throttle.ms"), throttleMsecs );
+    return values;
+}
@@ -0,0 +1,126 @@
+/********************************************************************
+ This file is part of the KDE project.
+
+Copyright (C) 2010 Nikhil Marathe <nsm.nikhil@gmail.com>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*********************************************************************/
+
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <QList>
+#include <QPair>
+#include <QString>
+
+/**
+ * Counts values into power of two buckets,
+ * bucket i holding values below 2^i.
+ */
+class Histogram
+{
+  public:
+    enum { Buckets = 24 };
+
+    Histogram();
+    void add( qint64 value );
+    quint64 count() const { return m_count; }
+    quint64 sum() const { return m_sum; }
+    quint64 bucket( int i ) const { return m_buckets[i]; }
+
+  private:
+    quint64 m_buckets[Buckets];
+    quint64 m_count;
+    quint64 m_sum;
+};
+
+/**
+ * Counters and latency histograms for one MediaServer,
+ * kept for the lifetime of the slave process.
+ *
+ * Listing upnp-ms://<uuid>/?stats returns one entry
+ * per value, UDS_NAME being the name of the value
+ * and UDS_SIZE the value itself.
+ */
+class Metrics
+{
+  public:
+    typedef QList< QPair<QString, quint64> > Values;
+
+    static Metrics *forDevice( const QString &uuid );
+
+    /**
+     * Called by PersistentAction once it is done
+     * with an action, however many tries it took.
+     */
+    void actionDone( const QString &action, qint64 msecs, bool ok );
+
+    Values values() const;
+
+    // every try of every action
+    quint64 tries;
+    quint64 retries;
+    quint64 timeouts;
+    // waited before retrying
+    quint64 backoffMsecs;
+    // actions which failed even after retrying
+    quint64 failures;
+
+    // most Browse and Search requests in flight at once
+    quint64 requestsInFlightPeak;
+
+    quint64 browseInvocations;
+    quint64 searchInvocations;
+    Histogram browseLatency;
+    Histogram searchLatency;
+
+    // HUpnp hands over decoded text, so these are
+    // characters of DIDL-Lite rather than bytes on the wire
+    quint64 didlCharacters;
+    // NumberReturned, summed up
+    quint64 objectsReceived;
+
+    quint64 pathHits;
+    quint64 pathMisses;
+    quint64 idHits;
+    quint64 idMisses;
+    // stat()s answered from listings, or not
+    quint64 entryHits;
+    quint64 entryMisses;
+    // path segments known not to exist, answered without a Browse
+    quint64 missingHits;
+    // paths and IDs found in the index earlier slaves left
+    quint64 indexHits;
+    quint64 indexWrites;
+    // containers events said changed, and the
+    // KDirNotify signals sent for them
+    quint64 containersChanged;
+    quint64 notifications;
+    // bytes the ObjectCache takes and may take, as of the
+    // last ?stats, and times memory pressure shrank it
+    quint64 cacheBytes;
+    quint64 cacheBudget;
+    quint64 cacheTrims;
+    // round trips made by path resolution
+    quint64 segmentsResolved;
+    Histogram resolveLatency;
+
+    // spent in block() between resolution steps
+    quint64 throttleMsecs;
+
+  private:
+    Metrics();
+};
+
+#endif
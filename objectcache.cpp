@@ -21,6 +21,10 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
 #include <QDir>
 #include <QEventLoop>
+#include <QFile>
+#include <QSet>
+
+#include <climits>
 #include <QTimer>
 
 #include <kdebug.h>
@@ -29,41 +33,233 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
 #include "controlpointthread.h"
 #include "didlparser.h"
+#include "metrics.h"
+#include "tracer.h"
+#include "upnp-ms-types.h"
 
 using namespace Herqq;
 using namespace Herqq::Upnp;
 
 void block(unsigned long msecs)
 {
+    TraceSpan span( "throttle" );
     QEventLoop local;
     QTimer::singleShot( msecs, &local, SLOT(quit()) );
     local.exec();
 }
 
-ObjectCache::ObjectCache( ControlPointThread *cpt )
+/*
+ * Costs are what the cached values take on the heap, roughly:
+ * QString and QHash bookkeeping are guessed, strings shared
+ * between values are counted for each of them.
+ */
+namespace {
+
+// a QCache node and the QHash node behind it
+const int NODE_BYTES = 64;
+// a QString's header and allocation overhead
+const int STRING_BYTES = 32;
+// a UDSEntry field and its hash node
+const int FIELD_BYTES = 48;
+
+int stringCost( const QString &string )
+{
+    return STRING_BYTES + string.capacity() * int( sizeof( QChar ) );
+}
+
+int objectCost( const QString &path, const DIDL::Object *object )
+{
+    int cost = NODE_BYTES + stringCost( path )
+               + ( object->type() == DIDL::SuperObject::Item ? sizeof( DIDL::Item ) : sizeof( DIDL::Container ) )
+               + stringCost( object->id() ) + stringCost( object->parentId() )
+               + stringCost( object->title() ) + stringCost( object->upnpClass() );
+    for( int i = 0; i < DIDL::PropertyCount; ++i ) {
+        const QString value = object->property( DIDL::Property( i ) );
+        if( !value.isNull() )
+            cost += stringCost( value );
+    }
+    return cost;
+}
+
+int pathCost( const QString &id, const QString &path )
+{
+    return NODE_BYTES + stringCost( id ) + sizeof( QString ) + stringCost( path );
+}
+
+int entryCost( const QString &id, const KIO::UDSEntry &entry )
+{
+    int cost = NODE_BYTES + stringCost( id ) + sizeof( CachedEntry );
+    foreach( uint field, entry.listFields() ) {
+        cost += FIELD_BYTES;
+        if( !entry.isNumber( field ) )
+            cost += stringCost( entry.stringValue( field ) );
+    }
+    return cost;
+}
+
+/**
+ * Returns the percentage of the system's memory
+ * still available, or -1 if there is no telling.
+ */
+int availableMemoryPercent()
+{
+#ifdef Q_OS_LINUX
+    QFile meminfo( QLatin1String("/proc/meminfo") );
+    if( !meminfo.open( QIODevice::ReadOnly ) )
+        return -1;
+
+    qint64 total = -1;
+    qint64 available = -1;
+    // older kernels don't estimate what is available
+    qint64 freeAndCached = 0;
+    foreach( const QByteArray &line, meminfo.readAll().split( '\n' ) ) {
+        const QList<QByteArray> fields = line.simplified().split( ' ' );
+        if( fields.size() < 2 )
+            continue;
+        if( fields[0] == "MemTotal:" )
+            total = fields[1].toLongLong();
+        else if( fields[0] == "MemAvailable:" )
+            available = fields[1].toLongLong();
+        else if( fields[0] == "MemFree:" || fields[0] == "Cached:" )
+            freeAndCached += fields[1].toLongLong();
+    }
+    if( total <= 0 )
+        return -1;
+    if( available < 0 )
+        available = freeAndCached;
+    return int( available * 100 / total );
+#else
+    return -1;
+#endif
+}
+
+}
+
+ObjectCache::ObjectCache( ControlPointThread *cpt, const QString &uuid )
     : QObject( cpt )
+    , m_childCount( 0 )
     , m_idToPathRequestsInProgress( false )
+    , m_indexFileName( PathIndex::fileName( uuid ) )
+    , m_budget( qint64( CACHE_BUDGET_KB ) * 1024 )
+    , m_budgetShift( 0 )
+    , m_insertions( 0 )
     , m_cpt( cpt )
+    , m_metrics( Metrics::forDevice( uuid ) )
 {
+    // at least a megabyte, the object being resolved
+    // has to fit whatever the memory pressure
+    const QByteArray budget = qgetenv( CACHE_BUDGET_ENV );
+    if( budget.toLongLong() > 0 )
+        m_budget = qMax( budget.toLongLong(), Q_INT64_C(1024) ) * 1024;
+    applyBudget();
+    m_lastMemoryCheck.start();
+    m_missingCache.setMaxCost( MISSING_CACHE_SIZE );
+    m_resolve.pathIndex = -1;
+    m_resolve.object = 0;
+    m_indexTimer = new QTimer( this );
+    m_indexTimer->setSingleShot( true );
+    m_indexTimer->setInterval( INDEX_SAVE_MSECS );
+    connect( m_indexTimer, SIGNAL( timeout() ), this, SLOT( saveIndex() ) );
     reset();
 }
 
-void ObjectCache::reset()
+ObjectCache::~ObjectCache()
 {
-    m_resolve.pathIndex = -1;
-    m_resolve.object = 0;
+    // timers only fire while a request runs, and
+    // the slave may be ended before the next one
+    saveIndex();
+}
 
+/**
+ * Events can arrive during the throttle of a resolution,
+ * so a reset leaves the resolution in progress alone.
+ */
+void ObjectCache::reset()
+{
     m_updatesHash.clear();
     m_reverseCache.clear();
     m_idToPathCache.clear();
+    m_entryCache.clear();
+    m_missingCache.clear();
+    m_fromIndex.clear();
+    m_children.clear();
+    m_childCount = 0;
+
+    insertRoot();
+}
 
-    m_reverseCache.insert( QString(),
-                           new DIDL::Container( QLatin1String("0"), QLatin1String("-1"), false ) );
+/**
+ * Resolution starts from the root, which has to
+ * be put back if a listing pushed it out.
+ */
+void ObjectCache::insertRoot()
+{
+    DIDL::Container *root = new DIDL::Container( QLatin1String("0"), QLatin1String("-1"), false );
+    m_reverseCache.insert( QString(), root, objectCost( QString(), root ) );
     m_idToPathCache.insert( QLatin1String("0"),
-                            new QString() );
+                            new QString(), pathCost( QLatin1String("0"), QString() ) );
+
+    root = new DIDL::Container( QLatin1String("0"), QLatin1String("-1"), false );
+    m_reverseCache.insert( QLatin1String("/"), root, objectCost( QLatin1String("/"), root ) );
+}
+
+/**
+ * Objects get half of the budget, as resolving them is what
+ * takes round trips, paths and entries a quarter each.
+ * Lowering a QCache's maximum evicts right away.
+ */
+void ObjectCache::applyBudget()
+{
+    const qint64 budget = qMin( m_budget >> m_budgetShift, qint64( INT_MAX ) );
+    m_reverseCache.setMaxCost( int( budget / 2 ) );
+    m_idToPathCache.setMaxCost( int( budget / 4 ) );
+    m_entryCache.setMaxCost( int( budget / 4 ) );
+}
+
+/**
+ * Slaves live on in the background, so they give
+ * memory back while the system is running out of it.
+ */
+void ObjectCache::checkMemory()
+{
+    if( m_lastMemoryCheck.elapsed() < MEMORY_CHECK_MSECS )
+        return;
+    m_lastMemoryCheck.restart();
+
+    const int available = availableMemoryPercent();
+    if( available < 0 )
+        return;
+    if( available < MEMORY_PRESSURE_PERCENT && m_budgetShift < 3 ) {
+        m_budgetShift++;
+        m_metrics->cacheTrims++;
+        kDebug() << "Memory is short, shrinking caches to" << ( m_budget >> m_budgetShift ) << "bytes";
+        applyBudget();
+    }
+    else if( available >= 2 * MEMORY_PRESSURE_PERCENT && m_budgetShift > 0 ) {
+        m_budgetShift = 0;
+        applyBudget();
+    }
+}
 
-    m_reverseCache.insert( QLatin1String("/"),
-                           new DIDL::Container( QLatin1String("0"), QLatin1String("-1"), false ) );
+void ObjectCache::updateMetrics()
+{
+    m_metrics->cacheBytes = m_reverseCache.totalCost() + m_idToPathCache.totalCost() + m_entryCache.totalCost();
+    m_metrics->cacheBudget = m_budget >> m_budgetShift;
+}
+
+/**
+ * Makes the containers above @c path the most recently
+ * used, so that they outlive the leaves below them.
+ * Every resolution starts from the deepest known
+ * ancestor, losing those costs a round trip each.
+ */
+void ObjectCache::touchAncestors( const QString &path )
+{
+    int separator = path.lastIndexOf( QDir::separator() );
+    while( separator > 0 ) {
+        m_reverseCache.object( path.left( separator ) );
+        separator = path.lastIndexOf( QDir::separator(), separator - 1 );
+    }
 }
 
 QString ObjectCache::idForName( const QString &name )
@@ -71,7 +267,120 @@ QString ObjectCache::idForName( const QString &name )
     const DIDL::Object * const cachedObject = m_reverseCache.object( name );
     if( cachedObject != 0 )
         return cachedObject->id();
-    return QString();
+
+    PathIndex::Object indexed;
+    if( !m_index.findPath( name, &indexed ) )
+        return QString();
+
+    m_metrics->indexHits++;
+    DIDL::Object *object;
+    if( indexed.container )
+        object = new DIDL::Container( indexed.id, indexed.parentId, false );
+    else
+        object = new DIDL::Item( indexed.id, indexed.parentId, false );
+    object->setTitle( indexed.title );
+    m_reverseCache.insert( name, object, objectCost( name, object ) );
+    m_idToPathCache.insert( indexed.id, new QString( name ), pathCost( indexed.id, name ) );
+    addChild( indexed.parentId, indexed.id, name );
+    m_fromIndex.insert( name, indexed.id );
+    return indexed.id;
+}
+
+void ObjectCache::openIndex( const QString &systemUpdateId )
+{
+    m_systemUpdateId = systemUpdateId;
+    if( m_index.open( m_indexFileName, systemUpdateId ) )
+        kDebug() << "Using index of" << m_index.size() << "objects from" << m_indexFileName;
+}
+
+/**
+ * Collects what is new to the index as it is learned,
+ * looking through the caches for it would reorder them.
+ * It is written at the end of the listing, or
+ * INDEX_SAVE_MSECS later.
+ */
+void ObjectCache::addToIndex( const QString &path, const DIDL::Object *object )
+{
+    if( m_systemUpdateId.isEmpty() )
+        return;
+    PathIndex::Object indexed;
+    if( m_index.findPath( path, &indexed ) && indexed.id == object->id() )
+        return;
+
+    indexed.id = object->id();
+    indexed.parentId = object->parentId();
+    indexed.title = object->title();
+    indexed.container = object->type() == DIDL::SuperObject::Container;
+    if( !m_indexPending.contains( indexed.id ) )
+        m_indexLearned << indexed.id;
+    m_indexPending.insert( indexed.id, indexed );
+    if( !m_indexTimer->isActive() )
+        m_indexTimer->start();
+}
+
+void ObjectCache::listingDone()
+{
+    if( m_lastIndexWrite.isValid() && m_lastIndexWrite.elapsed() < INDEX_SAVE_MSECS )
+        return;
+    saveIndex();
+}
+
+void ObjectCache::saveIndex() // SLOT
+{
+    m_indexTimer->stop();
+    // without a SystemUpdateID, the next
+    // slave could not tell if it is valid
+    if( m_indexPending.isEmpty() || m_systemUpdateId.isEmpty() )
+        return;
+
+    TraceSpan span( "saveIndex" );
+    // what this slave learned last goes first, then what
+    // the previous ones did, in case there are too many
+    QHash<QString, PathIndex::Object> candidates;
+    QList<QString> order;
+    for( int i = m_indexLearned.size() - 1; i >= 0; --i )
+        order << m_indexLearned[i];
+    foreach( const PathIndex::Object &indexed, m_index.objects() ) {
+        if( !m_indexPending.contains( indexed.id ) ) {
+            candidates.insert( indexed.id, indexed );
+            order << indexed.id;
+        }
+    }
+    QHash<QString, PathIndex::Object>::const_iterator pending;
+    for( pending = m_indexPending.constBegin(); pending != m_indexPending.constEnd(); ++pending )
+        candidates.insert( pending.key(), pending.value() );
+
+    // an object only goes in with its parents, so that
+    // what is left out is never above what is not
+    QList<PathIndex::Object> objects;
+    QSet<QString> kept;
+    foreach( const QString &id, order ) {
+        QList<QString> missing;
+        QString current = id;
+        while( !kept.contains( current ) && candidates.contains( current )
+               && missing.size() <= candidates.size() ) {
+            missing.prepend( current );
+            current = candidates[current].parentId;
+        }
+        // a parent loop, or no room for all of it
+        if( missing.size() > candidates.size()
+            || objects.size() + missing.size() > PATH_INDEX_SIZE )
+            continue;
+        foreach( const QString &added, missing ) {
+            kept.insert( added );
+            objects << candidates[added];
+        }
+    }
+    if( span.enabled() )
+        span.setArgument( "objects", QString::number( objects.size() ) );
+
+    m_index.close();
+    if( PathIndex::write( m_indexFileName, m_systemUpdateId, objects ) )
+        m_metrics->indexWrites++;
+    m_index.open( m_indexFileName, m_systemUpdateId );
+    m_indexPending.clear();
+    m_indexLearned.clear();
+    m_lastIndexWrite.start();
 }
 
 
@@ -86,6 +395,16 @@ void ObjectCache::resolvePathToObject( const QString &path )
 
     QString startAt;
 
+    m_resolve.fullPath = path;
+    m_resolve.timer.start();
+    checkMemory();
+    // every resolution starts from there
+    if( !m_reverseCache.contains( QString() ) || !m_reverseCache.contains( QLatin1String("/") ) )
+        insertRoot();
+    Tracer *tracer = Tracer::instance();
+    if( tracer )
+        m_resolve.started = tracer->now();
+
     // path is without a trailing slash, but we still want
     // to check for the last part of the path
     // to avoid a mandatory UPnP call. So the do { } while;
@@ -94,10 +413,12 @@ void ObjectCache::resolvePathToObject( const QString &path )
         QString segment = path.left(subpathLength);
         QString id = idForName( segment );
         if( !id.isNull() ) {
+            touchAncestors( segment );
             // we already had it cached
             // this only happens on the first loop run
             if( id == idForName( path ) ) {
-                emit pathResolved( m_reverseCache[path] );
+                m_metrics->pathHits++;
+                emitPathResolved( m_reverseCache[path], true );
                 return;
             }
             else {
@@ -124,8 +445,8 @@ void ObjectCache::resolvePathToObject( const QString &path )
 // check it, and if allowed, use Search
 // but remember to handle multiple results
     m_resolve.pathIndex = SEP_POS( path, startAt.length() ) ;
+    m_metrics->pathMisses++;
 
-    m_resolve.fullPath = path;
     resolvePathToObjectInternal();
 }
 
@@ -137,15 +458,27 @@ void ObjectCache::resolvePathToObjectInternal()
     m_resolve.lookingFor = m_resolve.fullPath.mid( m_resolve.pathIndex, SEP_POS( m_resolve.fullPath, m_resolve.pathIndex ) - m_resolve.pathIndex );
 
     m_resolve.object = 0;
-    if( !m_cpt->browseAction() ) {
+    m_resolve.id = m_reverseCache[m_resolve.segment]->id();
+    if( isMissing( m_resolve.id, m_resolve.lookingFor ) ) {
+        m_metrics->missingHits++;
+        // the caller only waits for pathResolved() once this returns
+        QTimer::singleShot( 0, this, SLOT( emitNotFound() ) );
+        return;
+    }
+
+    Tracer *tracer = Tracer::instance();
+    if( tracer )
+        m_resolve.segmentStarted = tracer->now();
+    if( !m_cpt->replaying() && !m_cpt->browseAction() ) {
         kDebug() << "Failed to get a valid Browse action";
         emit m_cpt->error( KIO::ERR_COULD_NOT_CONNECT, QString() );
         return;
     }
 
+    m_metrics->segmentsResolved++;
     connect( m_cpt, SIGNAL( browseResult( const Herqq::Upnp::HClientActionOp & ) ),
              this, SLOT( attemptResolution( const Herqq::Upnp::HClientActionOp & ) ) );
-    m_cpt->browseOrSearchObject( m_reverseCache[m_resolve.segment]->id(),
+    m_cpt->browseOrSearchObject( m_resolve.id,
                                  m_cpt->browseAction(),
                                  BROWSE_DIRECT_CHILDREN,
                                  QLatin1String("dc:title"),
@@ -168,6 +501,10 @@ void ObjectCache::attemptResolution( const HClientActionOp &op )
     }
 
     DIDL::Parser parser;
+    // only the title and IDs are of interest, and
+    // resolveId() stops the parser once it has its object
+    parser.setWantedProperties( QStringList() );
+    parser.setStringPool( &m_strings );
     connect( &parser, SIGNAL(itemParsed(DIDL::Item *)),
                        this, SLOT(slotResolveId(DIDL::Item *)) );
     connect( &parser, SIGNAL(containerParsed(DIDL::Container *)),
@@ -178,22 +515,33 @@ void ObjectCache::attemptResolution( const HClientActionOp &op )
     // we block because devices ( atleast MediaTomb )
     // seem to block continous TCP connections after some time
     // this interval might need modification
-    block(500);
-
-    // TODO have some kind of slot to stop the parser as 
-    // soon as we find our guy, so that the rest of the
-    // document isn't parsed.
+    throttle();
+
+    Tracer *tracer = Tracer::instance();
+    if( tracer ) {
+        TraceArguments arguments;
+        arguments << TraceArgument( "segment", m_resolve.lookingFor );
+        arguments << TraceArgument( "found", QString::fromLatin1( m_resolve.object ? "true" : "false" ) );
+        tracer->complete( "resolve segment", m_resolve.segmentStarted, arguments );
+    }
 
     // if we didn't find the ID, no point in continuing
     if( !m_resolve.object ) {
         kDebug() << "NULL RESOLUTION";
-        emit pathResolved( 0 );
+        MissingObject *missing = new MissingObject;
+        missing->updateId = output[QLatin1String("UpdateID")].value().toString();
+        missing->age.start();
+        m_missingCache.insert( qMakePair( m_resolve.id, m_resolve.lookingFor ), missing );
+        emitPathResolved( 0, false );
         return;
     }
     else {
         QString pathToInsert = ( m_resolve.segment + QDir::separator() + m_resolve.object->title() );
-        m_reverseCache.insert( pathToInsert, m_resolve.object );
-        m_idToPathCache.insert( m_resolve.object->id(), new QString( pathToInsert ) );
+        m_reverseCache.insert( pathToInsert, m_resolve.object, objectCost( pathToInsert, m_resolve.object ) );
+        m_idToPathCache.insert( m_resolve.object->id(), new QString( pathToInsert ),
+                                pathCost( m_resolve.object->id(), pathToInsert ) );
+        addChild( m_resolve.object->parentId(), m_resolve.object->id(), pathToInsert );
+        addToIndex( pathToInsert, m_resolve.object );
         // TODO: if we already have the id, should we just update the
         // ContainerUpdateIDs
 // TODO no more QPairs
@@ -207,12 +555,54 @@ void ObjectCache::attemptResolution( const HClientActionOp &op )
     // if we are done, emit the relevant Object
     // otherwise recurse with a new (m_)resolve :)
     if( m_resolve.pathIndex == -1 )
-        emit pathResolved( m_resolve.object );
+        emitPathResolved( m_resolve.object, false );
     else
         resolvePathToObjectInternal();
 
 }
 
+bool ObjectCache::isMissing( const QString &containerId, const QString &name )
+{
+    const QPair<QString, QString> key( containerId, name );
+    const MissingObject * const missing = m_missingCache.object( key );
+    if( !missing )
+        return false;
+    // without eventing, changes are only heard of from
+    // update(), so don't trust it for too long either
+    if( missing->age.elapsed() > MISSING_CACHE_MSECS
+        || ( hasUpdateId( containerId ) && m_updatesHash[containerId].first != missing->updateId ) ) {
+        m_missingCache.remove( key );
+        return false;
+    }
+    return true;
+}
+
+void ObjectCache::emitNotFound() // SLOT
+{
+    emitPathResolved( 0, true );
+}
+
+void ObjectCache::throttle()
+{
+    QElapsedTimer timer;
+    timer.start();
+    block( RESOLUTION_THROTTLE );
+    m_metrics->throttleMsecs += timer.elapsed();
+}
+
+void ObjectCache::emitPathResolved( const DIDL::Object *object, bool cached )
+{
+    m_metrics->resolveLatency.add( m_resolve.timer.elapsed() );
+    Tracer *tracer = Tracer::instance();
+    if( tracer ) {
+        TraceArguments arguments;
+        arguments << TraceArgument( "path", m_resolve.fullPath );
+        arguments << TraceArgument( "cached", QString::fromLatin1( cached ? "true" : "false" ) );
+        tracer->complete( "resolvePathToObject", m_resolve.started, arguments );
+    }
+    emit pathResolved( object );
+}
+
 #undef SEP_POS
 #undef LAST_SEP_POS
 
@@ -220,7 +610,12 @@ void ObjectCache::resolveId( DIDL::Object *object )
 {
     // set m_resolvedId and update cache
     if( object->title() == m_resolve.lookingFor ) {
-        m_resolve.object = object;
+        // the parser deletes its objects, the caches keep theirs
+        m_resolve.object = object->copy();
+        // found our guy, the rest of the listing is of no interest
+        DIDL::Parser *parser = qobject_cast<DIDL::Parser *>( sender() );
+        if( parser )
+            parser->stop();
     }
 }
 
@@ -239,14 +634,19 @@ bool ObjectCache::hasUpdateId( const QString &id )
     return m_updatesHash.contains( id );
 }
 
+/**
+ * Names missing from the container are checked against
+ * the value recorded here when isMissing() looks at them.
+ */
 bool ObjectCache::update( const QString &id, const QString &containerUpdateId )
 {
     if( !hasUpdateId( id ) ) {
+        // nothing to compare with, a listing or the
+        // first event after subscribing tells the value
         const QString * const cachedPath = m_idToPathCache.object( id );
         if( cachedPath != 0 )
-            m_updatesHash[id] = UpdateValueAndPath( QString(), *cachedPath );
-        else
-            return false;
+            m_updatesHash[id] = UpdateValueAndPath( containerUpdateId, *cachedPath );
+        return false;
     }
 
     if( m_updatesHash[id].first != containerUpdateId ) {
@@ -263,15 +663,191 @@ QString ObjectCache::pathForId( const QString &id )
     return m_updatesHash[id].second;
 }
 
+void ObjectCache::invalidate( const QString &id )
+{
+    // its own entry counts its children
+    m_entryCache.remove( id );
+    // children may have been renamed, taking the paths
+    // below them along, so only the container itself stays
+    forgetChildren( id );
+    if( !m_reverseCache.contains( QString() ) || !m_reverseCache.contains( QLatin1String("/") ) )
+        insertRoot();
+}
+
+/**
+ * Records that the caches hold @c id, at @c path if it
+ * is not null. Looking for what is below a container
+ * in the caches themselves would reorder them.
+ */
+void ObjectCache::addChild( const QString &parentId, const QString &id, const QString &path )
+{
+    QHash<QString, QString> &children = m_children[parentId];
+    QHash<QString, QString>::iterator it = children.find( id );
+    if( it == children.end() ) {
+        children.insert( id, path );
+        m_childCount++;
+    }
+    else if( !path.isNull() ) {
+        it.value() = path;
+    }
+
+    const int cached = m_reverseCache.count() + m_idToPathCache.count()
+                       + m_entryCache.count() + m_updatesHash.size();
+    if( m_childCount > 2 * cached + MISSING_CACHE_SIZE )
+        pruneChildren();
+}
+
+void ObjectCache::forgetChildren( const QString &parentId )
+{
+    const QHash<QString, QString> children = m_children.take( parentId );
+    m_childCount -= children.size();
+    QHash<QString, QString>::const_iterator it;
+    for( it = children.constBegin(); it != children.constEnd(); ++it ) {
+        m_entryCache.remove( it.key() );
+        m_idToPathCache.remove( it.key() );
+        m_updatesHash.remove( it.key() );
+        if( !it.value().isNull() )
+            m_reverseCache.remove( it.value() );
+        forgetChildren( it.key() );
+    }
+}
+
+/**
+ * Drops the IDs the caches no longer hold from m_children,
+ * which only happens once it grew to twice their size, so
+ * that it takes constant time per object on average.
+ * Containers with children left are kept, for invalidate()
+ * to get to them.
+ */
+void ObjectCache::pruneChildren()
+{
+    QMutableHashIterator<QString, QHash<QString, QString> > parent( m_children );
+    while( parent.hasNext() ) {
+        QMutableHashIterator<QString, QString> child( parent.next().value() );
+        while( child.hasNext() ) {
+            child.next();
+            if( m_entryCache.contains( child.key() )
+                || m_idToPathCache.contains( child.key() )
+                || m_updatesHash.contains( child.key() )
+                || ( !child.value().isNull() && m_reverseCache.contains( child.value() ) )
+                || m_children.contains( child.key() ) )
+                continue;
+            child.remove();
+            m_childCount--;
+        }
+        if( parent.value().isEmpty() )
+            parent.remove();
+    }
+}
+
+void ObjectCache::discardIndex()
+{
+    m_index.close();
+    m_indexPending.clear();
+    m_indexLearned.clear();
+    m_systemUpdateId.clear();
+
+    // their containers were never browsed, so
+    // no event would tell if they changed
+    QHash<QString, QString>::const_iterator it;
+    for( it = m_fromIndex.constBegin(); it != m_fromIndex.constEnd(); ++it ) {
+        m_reverseCache.remove( it.key() );
+        m_idToPathCache.remove( it.value() );
+    }
+    m_fromIndex.clear();
+    if( !m_reverseCache.contains( QString() ) || !m_reverseCache.contains( QLatin1String("/") ) )
+        insertRoot();
+}
+
+void ObjectCache::insertEntry( const QString &parentPath, const KIO::UDSEntry &entry )
+{
+    const QString id = entry.stringValue( KIO::UPNP_ID );
+    CachedEntry *cached = new CachedEntry;
+    cached->entry = entry;
+    cached->age.start();
+    m_entryCache.insert( id, cached, entryCost( id, entry ) );
+    checkMemory();
+
+    const QString parentId = entry.stringValue( KIO::UPNP_PARENT_ID );
+    if( parentPath.isNull() ) {
+        addChild( parentId, id, QString() );
+        return;
+    }
+
+    const QString title = entry.stringValue( KIO::UDSEntry::UDS_NAME );
+    DIDL::Object *object;
+    if( entry.isDir() )
+        object = new DIDL::Container( id, parentId, false );
+    else
+        object = new DIDL::Item( id, parentId, false );
+    object->setTitle( title );
+    object->setUpnpClass( entry.stringValue( KIO::UPNP_CLASS ) );
+
+    // the same form attemptResolution() gives paths
+    const QString path = ( parentPath == QLatin1String("/") ? QString() : parentPath )
+                         + QDir::separator() + title;
+    addToIndex( path, object );
+    m_reverseCache.insert( path, object, objectCost( path, object ) );
+    m_idToPathCache.insert( id, new QString( path ), pathCost( id, path ) );
+    addChild( parentId, id, path );
+    // a large listing would push out the path to it
+    if( ++m_insertions % ANCESTOR_TOUCH_INTERVAL == 0 )
+        touchAncestors( path );
+    m_missingCache.remove( qMakePair( parentId, title ) );
+
+    if( !m_reverseCache.contains( QString() ) || !m_reverseCache.contains( QLatin1String("/") ) )
+        insertRoot();
+}
+
+bool ObjectCache::entryForId( const QString &id, KIO::UDSEntry *entry )
+{
+    CachedEntry *cached = m_entryCache.object( id );
+    if( cached && cached->age.elapsed() > ENTRY_CACHE_MSECS ) {
+        m_entryCache.remove( id );
+        cached = 0;
+    }
+    if( !cached ) {
+        m_metrics->entryMisses++;
+        return false;
+    }
+    m_metrics->entryHits++;
+    *entry = cached->entry;
+    return true;
+}
+
+bool ObjectCache::entryForPath( const QString &path, KIO::UDSEntry *entry )
+{
+    const DIDL::Object * const object = m_reverseCache.object( path );
+    if( !object ) {
+        m_metrics->entryMisses++;
+        return false;
+    }
+    return entryForId( object->id(), entry );
+}
+
 void ObjectCache::resolveIdToPath( const QString &id )
 {
     const QString * const cachedPath = m_idToPathCache.object( id );
     if( cachedPath != 0 ) {
+        m_metrics->idHits++;
         kDebug() << "I know the path for" << id << "it is" << *cachedPath;
         emit idToPathResolved( id, *cachedPath );
         return;
     }
 
+    const QString indexedPath = m_index.pathForId( id );
+    if( !indexedPath.isNull() ) {
+        m_metrics->indexHits++;
+        m_idToPathCache.insert( id, new QString( indexedPath ), pathCost( id, indexedPath ) );
+        PathIndex::Object indexed;
+        if( m_index.findPath( indexedPath, &indexed ) )
+            addChild( indexed.parentId, id, QString() );
+        m_fromIndex.insert( indexedPath, id );
+        emit idToPathResolved( id, indexedPath );
+        return;
+    }
+
+    m_metrics->idMisses++;
     m_idToPathRequests << id;
 
     // only drive if we aren't already running
@@ -293,7 +869,7 @@ void ObjectCache::resolveNextIdToPath()
 
 void ObjectCache::resolveIdToPathInternal()
 {
-    if( !m_cpt->browseAction() ) {
+    if( !m_cpt->replaying() && !m_cpt->browseAction() ) {
         kDebug() << "Failed to get a valid Browse action";
         emit m_cpt->error( KIO::ERR_COULD_NOT_CONNECT, QString() );
         return;
@@ -325,6 +901,9 @@ void ObjectCache::attemptIdToPathResolution( const HClientActionOp &op )
     kDebug() << "In attempt for" << m_idResolve.currentId << "got"<< output["Result"].value().toString();
 
     DIDL::Parser parser;
+    // only the title and IDs are of interest
+    parser.setWantedProperties( QStringList() );
+    parser.setStringPool( &m_strings );
     connect( &parser, SIGNAL(itemParsed(DIDL::Item *)),
                        this, SLOT(slotBuildPathForId(DIDL::Item *)) );
     connect( &parser, SIGNAL(containerParsed(DIDL::Container *)),
@@ -335,7 +914,7 @@ void ObjectCache::attemptIdToPathResolution( const HClientActionOp &op )
     // we block because devices ( atleast MediaTomb )
     // seem to block continous TCP connections after some time
     // this interval might need modification
-    block(500);
+    throttle();
 
 // TODO fill stuff here
 
@@ -21,11 +21,16 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #define OBJECTCACHE_H
 
 #include <QCache>
+#include <QElapsedTimer>
 #include <QQueue>
 
+#include <kio/udsentry.h>
+
 #include <HUpnpCore/HUpnp>
 
 #include "didlobjects.h"
+#include "pathindex.h"
+#include "stringpool.h"
 
 namespace Herqq
 {
@@ -35,7 +40,40 @@ namespace Herqq
     }
 }
 
+class QTimer;
+
 class ControlPointThread;
+class Metrics;
+
+// milliseconds to pause after every resolution step, since
+// devices ( atleast MediaTomb ) seem to block continous
+// TCP connections after some time
+#define RESOLUTION_THROTTLE 500
+
+// milliseconds an entry from a listing answers stat() for
+#define ENTRY_CACHE_MSECS 30000
+
+// kilobytes the objects, paths and entries of a device may
+// take together, see README
+#define CACHE_BUDGET_ENV "KIO_UPNP_MS_CACHE_KB"
+#define CACHE_BUDGET_KB 32768
+// the budget is halved, down to an eighth, while less than
+// this percentage of the system's memory is available
+#define MEMORY_PRESSURE_PERCENT 10
+// milliseconds between two looks at the system's memory
+#define MEMORY_CHECK_MSECS 5000
+// entries a listing inserts between two refreshes of the
+// path to the directory listed
+#define ANCESTOR_TOUCH_INTERVAL 64
+// names known not to exist in a container, at most
+#define MISSING_CACHE_SIZE 1000
+// milliseconds such a name is known not to exist for, should
+// no change of the container be heard of before
+#define MISSING_CACHE_MSECS 60000
+// milliseconds what was resolved or listed waits to be
+// written to the index, and that at least lie between two
+// writes at the end of listings
+#define INDEX_SAVE_MSECS 10000
 
 // we map to DIDL object since <desc> have no cache value
 // why not cache just the ID? QCache wants a pointer. So might
@@ -43,6 +81,21 @@ class ControlPointThread;
 typedef QCache<QString, DIDL::Object> NameToObjectCache;
 typedef QCache<QString, QString> IdToPathCache;
 
+struct CachedEntry {
+    KIO::UDSEntry entry;
+    QElapsedTimer age;
+};
+// by ID, so that listings by ID can fill it too
+typedef QCache<QString, CachedEntry> IdToEntryCache;
+
+struct MissingObject {
+    // of the container when the name was looked for
+    QString updateId;
+    QElapsedTimer age;
+};
+// (container ID, name) of names which were not found
+typedef QCache<QPair<QString, QString>, MissingObject> MissingObjectCache;
+
 typedef QPair<QString, QString> UpdateValueAndPath;
 
 // maps ID -> (update value, path) where path is a valid
@@ -52,13 +105,20 @@ class ObjectCache : public QObject
 {
     Q_OBJECT
 public:
-    ObjectCache( ControlPointThread *cpt );
+    /**
+     * @c uuid is the device the cache is for,
+     * its Metrics record hit rates.
+     */
+    ObjectCache( ControlPointThread *cpt, const QString &uuid );
+    ~ObjectCache();
     void reset();
     bool hasUpdateId( const QString &id );
     /**
      * Updates the containerUpdateId for the container @c id.
      * If the value has changed, returns true, otherwise returns
-     * false.
+     * false, as it does the first time @c id is updated.
+     * Names not found in the container before a change
+     * are looked for again.
      */
     bool update( const QString &id, const QString &containerUpdateId );
 
@@ -67,6 +127,61 @@ public:
      */
     QString pathForId( const QString &id );
 
+    /**
+     * Forgets the entries and paths of everything below the
+     * container @c id, once an event or reply said it changed.
+     */
+    void invalidate( const QString &id );
+
+    /**
+     * Keeps an entry of a listing, with every field, for
+     * entryForId() and entryForPath(). With the @c parentPath
+     * of the listing, if known, its path and ID are cached
+     * too, so that resolving it takes no round trip.
+     */
+    void insertEntry( const QString &parentPath, const KIO::UDSEntry &entry );
+
+    /**
+     * Fills @c entry and returns true if a listing
+     * inserted the entry less than ENTRY_CACHE_MSECS ago.
+     */
+    bool entryForId( const QString &id, KIO::UDSEntry *entry );
+    bool entryForPath( const QString &path, KIO::UDSEntry *entry );
+
+    /**
+     * Maps the PathIndex a previous slave left for the device,
+     * if the device's SystemUpdateID is still @c systemUpdateId,
+     * and keeps what is resolved from now on for the next one.
+     */
+    void openIndex( const QString &systemUpdateId );
+
+    /**
+     * Writes what the listing just done added to the index,
+     * unless it was written less than INDEX_SAVE_MSECS ago,
+     * which leaves it to the next write.
+     */
+    void listingDone();
+
+    /**
+     * Stops using and writing the index, once the device's
+     * SystemUpdateID changed. It reflects the device before
+     * the change, and there is no telling which of its
+     * paths still hold.
+     */
+    void discardIndex();
+
+    /**
+     * Values repeating across the device's listings,
+     * shared by its cached objects and its listings.
+     */
+    StringPool *strings() { return &m_strings; }
+
+    /**
+     * Puts the bytes the caches take, and
+     * may take, into the device's Metrics.
+     */
+    void updateMetrics();
+
 signals:
     void pathResolved( const DIDL::Object * );
     void idToPathResolved( const QString &id, const QString &path );
@@ -98,10 +213,27 @@ private slots:
     void slotResolveId( DIDL::Container *object );
     void slotBuildPathForId( DIDL::Item * );
     void slotBuildPathForId( DIDL::Container * );
+    void emitNotFound();
+    /**
+     * Writes the paths and IDs resolved or listed since
+     * the last call to the index, if there are any.
+     */
+    void saveIndex();
 
 private:
+    void insertRoot();
+    void applyBudget();
+    void checkMemory();
+    void touchAncestors( const QString &path );
     QString idForName( const QString &name );
+    void addToIndex( const QString &path, const DIDL::Object *object );
+    void addChild( const QString &parentId, const QString &id, const QString &path );
+    void forgetChildren( const QString &parentId );
+    void pruneChildren();
     void resolvePathToObjectInternal();
+    bool isMissing( const QString &containerId, const QString &name );
+    void emitPathResolved( const DIDL::Object *object, bool cached );
+    void throttle();
     void resolveNextIdToPath();
     void resolveIdToPathInternal();
     void resolveId( DIDL::Object *object );
@@ -127,6 +259,19 @@ private:
     // the path in m_updatesHash.
     ContainerUpdatesHash m_updatesHash;
 
+    IdToEntryCache m_entryCache;
+
+    // Dolphin and file dialogs probe for .directory, .hidden
+    // and the like, each costing a Browse and a throttle
+    MissingObjectCache m_missingCache;
+
+    // parent ID -> ID -> path, null if there is none, of what
+    // the caches took in, so that invalidate() finds what is
+    // below a container without looking through them all.
+    // The caches evict without telling, see pruneChildren()
+    QHash<QString, QHash<QString, QString> > m_children;
+    int m_childCount;
+
     /**
      * Make sure you don't have two
      * resolutions taking place at the same time.
@@ -138,10 +283,15 @@ private:
     struct {
         int pathIndex;
         QString segment;
+        // of the container segment
         QString id;
         QString lookingFor;
         QString fullPath;
         DIDL::Object *object;
+        // on the trace clock, see Tracer::now()
+        qint64 started;
+        qint64 segmentStarted;
+        QElapsedTimer timer;
     } m_resolve;
 
     struct {
@@ -155,7 +305,34 @@ private:
     QQueue<QString> m_idToPathRequests;
     bool m_idToPathRequestsInProgress;
 
+    // what earlier slaves resolved, only consulted
+    // once the cache has nothing for a path or ID
+    PathIndex m_index;
+    // path -> ID of what the caches took from the index
+    QHash<QString, QString> m_fromIndex;
+    QString m_indexFileName;
+    // of the device when it was connected to,
+    // the index is written for this one
+    QString m_systemUpdateId;
+    // learned since the index was last written, by ID,
+    // and their IDs in the order they were learned
+    QHash<QString, PathIndex::Object> m_indexPending;
+    QList<QString> m_indexLearned;
+    // a write rewrites the whole index, so they are batched
+    QTimer *m_indexTimer;
+    QElapsedTimer m_lastIndexWrite;
+
+    // in bytes, of all caches together
+    qint64 m_budget;
+    // the budget is divided by 2^m_budgetShift
+    // under memory pressure
+    int m_budgetShift;
+    QElapsedTimer m_lastMemoryCheck;
+    uint m_insertions;
+
     ControlPointThread *m_cpt;
+    StringPool m_strings;
+    Metrics *m_metrics;
 };
 
 #endif
@@ -0,0 +1,80 @@
+/********************************************************************
+ This file is part of the KDE project.
+
+Copyright (C) 2010 Nikhil Marathe <nsm.nikhil@gmail.com>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*********************************************************************/
+
+#include "pagingcontroller.h"
+
+#include <kdebug.h>
+
+// weight of the newest page in the estimates
+#define PAGING_WEIGHT 0.5
+
+PagingController::PagingController()
+    : m_pageSize( PAGING_FIRST_PAGE )
+    , m_serverLimit( 0 )
+    , m_charactersPerObject( 0 )
+    , m_msecsPerObject( 0 )
+    , m_overheadMsecs( -1 )
+{
+}
+
+void PagingController::reset()
+{
+    m_pageSize = PAGING_FIRST_PAGE;
+    if( m_serverLimit )
+        m_pageSize = qMin( m_pageSize, m_serverLimit );
+}
+
+static double weigh( double estimate, double value )
+{
+    return estimate == 0 ? value : estimate + PAGING_WEIGHT * ( value - estimate );
+}
+
+void PagingController::pageReceived( uint requested, uint returned, int characters, qint64 msecs, bool more )
+{
+    if( returned == 0 )
+        return;
+
+    // a server which returns less than it was asked for, and
+    // has more, returns no more than that at once
+    if( more && requested > returned )
+        m_serverLimit = m_serverLimit ? qMin( m_serverLimit, returned ) : returned;
+
+    m_charactersPerObject = weigh( m_charactersPerObject, double( characters ) / returned );
+
+    if( m_overheadMsecs == -1 || msecs < m_overheadMsecs )
+        m_overheadMsecs = msecs;
+    m_msecsPerObject = weigh( m_msecsPerObject, double( msecs - m_overheadMsecs ) / returned );
+
+    // spend at least as long on the objects as on the round trip,
+    // so that slow links get large pages rather than many
+    const double target = qMax( double( PAGING_TARGET_MSECS ), double( m_overheadMsecs ) );
+    double size = double( m_pageSize ) * PAGING_MAXIMUM_GROWTH;
+    if( m_msecsPerObject > 0 )
+        size = qMin( size, target / m_msecsPerObject );
+    // the estimates are noisy, shrink gently
+    size = qMax( size, double( m_pageSize ) / 2 );
+    if( m_charactersPerObject > 0 )
+        size = qMin( size, PAGING_MAXIMUM_CHARACTERS / m_charactersPerObject );
+    if( m_serverLimit )
+        size = qMin( size, double( m_serverLimit ) );
+
+    m_pageSize = qMax( uint( 1 ), uint( size ) );
+    kDebug() << "Next page" << m_pageSize << "objects," << msecs << "ms for" << returned
+             << "round trip" << m_overheadMsecs << "ms" << m_charactersPerObject << "characters each";
+}
@@ -0,0 +1,83 @@
+/********************************************************************
+ This file is part of the KDE project.
+
+Copyright (C) 2010 Nikhil Marathe <nsm.nikhil@gmail.com>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*********************************************************************/
+
+#ifndef PAGINGCONTROLLER_H
+#define PAGINGCONTROLLER_H
+
+#include <QtGlobal>
+
+// objects asked for by the first page of a listing,
+// few enough for the first entries to show up quickly
+#define PAGING_FIRST_PAGE 16
+// milliseconds a page should take, once the round trip
+// itself is paid for
+#define PAGING_TARGET_MSECS 500
+// a page grows at most this many times from one to the next
+#define PAGING_MAXIMUM_GROWTH 4
+// characters of DIDL-Lite a page may hold, about 2 MB as a QString,
+// which keeps memory bounded however large the container
+#define PAGING_MAXIMUM_CHARACTERS ( 1 << 20 )
+
+/**
+ * Chooses the RequestedCount of Browse and Search pages
+ * for one MediaServer.
+ *
+ * A listing starts with a small page and grows its pages
+ * from there, towards taking PAGING_TARGET_MSECS on top of the
+ * fixed cost of a round trip, as estimated from the pages
+ * so far. Pages never hold more than PAGING_MAXIMUM_CHARACTERS
+ * at the characters per object seen, nor more objects than
+ * the server returned when asked for more.
+ */
+class PagingController
+{
+  public:
+    PagingController();
+
+    /**
+     * Starts a new listing at PAGING_FIRST_PAGE,
+     * keeping what was learnt about the server.
+     */
+    void reset();
+
+    /**
+     * RequestedCount for the next page.
+     */
+    uint pageSize() const { return m_pageSize; }
+
+    /**
+     * Adapts pageSize() to a page of @c requested objects
+     * which took @c msecs and returned @c returned of them,
+     * in @c characters of DIDL-Lite. @c more is whether the
+     * server had further objects.
+     */
+    void pageReceived( uint requested, uint returned, int characters, qint64 msecs, bool more );
+
+  private:
+    uint m_pageSize;
+    // the most objects the server returns at once, 0 if unknown
+    uint m_serverLimit;
+    // estimates, exponentially weighted
+    double m_charactersPerObject;
+    double m_msecsPerObject;
+    // fixed cost of a round trip, the fastest one seen
+    qint64 m_overheadMsecs;
+};
+
+#endif
@@ -0,0 +1,393 @@
+/********************************************************************
+ This file is part of the KDE project.
+
+Copyright (C) 2010 Nikhil Marathe <nsm.nikhil@gmail.com>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*********************************************************************/
+
+#include "pathindex.h"
+
+#include <QDir>
+#include <QHash>
+#include <QStringList>
+#include <QVector>
+
+#include <cstring>
+
+#include <kdebug.h>
+#include <ksavefile.h>
+#include <kstandarddirs.h>
+
+#define PATH_INDEX_MAGIC "UPNPMSIX"
+// written in host byte order, so an index from a
+// machine of the other endianness has another version
+#define PATH_INDEX_VERSION 1
+
+/*
+ * The file is laid out as
+ *   Header
+ *   Record[count]      sorted by (parent ID, title)
+ *   quint32[count]     indices of the records, sorted by ID
+ *   QChar[strings]     the IDs and titles, without terminators
+ * so that everything is suitably aligned where the file is mapped.
+ */
+struct PathIndex::Header {
+    char magic[8];
+    quint32 version;
+    quint32 count;
+    quint32 stringsLength;
+    quint32 updateId;
+    quint32 updateIdLength;
+    quint32 reserved;
+};
+
+// offsets and lengths are in QChars, into the strings
+struct PathIndex::Record {
+    quint32 id;
+    quint32 idLength;
+    quint32 parentId;
+    quint32 parentIdLength;
+    quint32 title;
+    quint32 titleLength;
+    quint32 container;
+};
+
+namespace {
+
+// compares without a copy of what is in the file
+inline int compare( const QChar *data, quint32 length, const QString &string )
+{
+    return QString::compare( QString::fromRawData( data, length ), string );
+}
+
+struct ObjectLessThan
+{
+    ObjectLessThan( const QList<PathIndex::Object> &objects, bool byId )
+        : m_objects( objects ), m_byId( byId ) {}
+
+    bool operator()( int left, int right ) const
+    {
+        const PathIndex::Object &a = m_objects[left];
+        const PathIndex::Object &b = m_objects[right];
+        if( m_byId )
+            return a.id < b.id;
+        if( a.parentId != b.parentId )
+            return a.parentId < b.parentId;
+        return a.title < b.title;
+    }
+
+    const QList<PathIndex::Object> &m_objects;
+    bool m_byId;
+};
+
+// parent IDs repeat for every child, so
+// every distinct string is stored once
+quint32 appendString( const QString &string, QString *strings, QHash<QString, quint32> *offsets )
+{
+    QHash<QString, quint32>::const_iterator it = offsets->constFind( string );
+    if( it != offsets->constEnd() )
+        return it.value();
+    const quint32 offset = strings->length();
+    strings->append( string );
+    offsets->insert( string, offset );
+    return offset;
+}
+
+}
+
+PathIndex::PathIndex()
+    : m_data( 0 )
+    , m_count( 0 )
+    , m_records( 0 )
+    , m_byId( 0 )
+    , m_strings( 0 )
+    , m_stringsLength( 0 )
+{
+}
+
+PathIndex::~PathIndex()
+{
+    close();
+}
+
+QString PathIndex::fileName( const QString &uuid )
+{
+    const QByteArray directory = qgetenv( PATH_INDEX_ENV );
+    if( !directory.isEmpty() ) {
+        QDir dir( QFile::decodeName( directory ) );
+        if( !dir.exists() && !dir.mkpath( QLatin1String(".") ) )
+            return QString();
+        return dir.absoluteFilePath( uuid + QLatin1String(".index") );
+    }
+    return KStandardDirs::locateLocal( "cache", QLatin1String("kio_upnp_ms/") + uuid + QLatin1String(".index") );
+}
+
+bool PathIndex::open( const QString &fileName, const QString &systemUpdateId )
+{
+    close();
+    if( fileName.isEmpty() || systemUpdateId.isEmpty() )
+        return false;
+
+    m_file.setFileName( fileName );
+    if( !m_file.open( QIODevice::ReadOnly ) )
+        return false;
+
+    const qint64 size = m_file.size();
+    if( size < (qint64)sizeof( Header ) ) {
+        m_file.close();
+        return false;
+    }
+
+    const uchar *data = m_file.map( 0, size );
+    if( !data ) {
+        kDebug() << "Cannot map" << fileName;
+        m_file.close();
+        return false;
+    }
+
+    const Header *header = reinterpret_cast<const Header *>( data );
+    const quint64 expected = sizeof( Header )
+                             + quint64( header->count ) * ( sizeof( Record ) + sizeof( quint32 ) )
+                             + quint64( header->stringsLength ) * sizeof( QChar );
+    if( qstrncmp( header->magic, PATH_INDEX_MAGIC, sizeof( header->magic ) ) != 0
+        || header->version != PATH_INDEX_VERSION
+        || expected != quint64( size ) ) {
+        kDebug() << "Ignoring unusable index" << fileName;
+        m_file.unmap( const_cast<uchar *>( data ) );
+        m_file.close();
+        return false;
+    }
+
+    m_data = data;
+    m_count = header->count;
+    m_records = reinterpret_cast<const Record *>( data + sizeof( Header ) );
+    m_byId = reinterpret_cast<const quint32 *>( m_records + m_count );
+    m_strings = reinterpret_cast<const QChar *>( m_byId + m_count );
+    m_stringsLength = header->stringsLength;
+
+    // a truncated or garbled file must not lead
+    // to reads outside the mapping later on
+    bool valid = quint64( header->updateId ) + header->updateIdLength <= m_stringsLength;
+    for( quint32 i = 0; valid && i < m_count; ++i ) {
+        const Record &r = m_records[i];
+        valid = m_byId[i] < m_count
+                && quint64( r.id ) + r.idLength <= m_stringsLength
+                && quint64( r.parentId ) + r.parentIdLength <= m_stringsLength
+                && quint64( r.title ) + r.titleLength <= m_stringsLength;
+    }
+
+    if( !valid
+        || compare( m_strings + header->updateId, header->updateIdLength, systemUpdateId ) != 0 ) {
+        kDebug() << "Index" << fileName << "is out of date";
+        close();
+        return false;
+    }
+
+    return true;
+}
+
+void PathIndex::close()
+{
+    if( m_data )
+        m_file.unmap( const_cast<uchar *>( m_data ) );
+    m_file.close();
+    m_data = 0;
+    m_count = 0;
+    m_records = 0;
+    m_byId = 0;
+    m_strings = 0;
+    m_stringsLength = 0;
+}
+
+int PathIndex::size() const
+{
+    return m_count;
+}
+
+const PathIndex::Record *PathIndex::record( int index ) const
+{
+    return m_records + index;
+}
+
+QString PathIndex::string( quint32 offset, quint32 length ) const
+{
+    // a deep copy, the mapping may be gone before the string
+    return QString( m_strings + offset, length );
+}
+
+PathIndex::Object PathIndex::object( const Record *r ) const
+{
+    Object o;
+    o.id = string( r->id, r->idLength );
+    o.parentId = string( r->parentId, r->parentIdLength );
+    o.title = string( r->title, r->titleLength );
+    o.container = r->container != 0;
+    return o;
+}
+
+const PathIndex::Record *PathIndex::findChild( const QString &parentId, const QString &title ) const
+{
+    int low = 0;
+    int high = int( m_count ) - 1;
+    while( low <= high ) {
+        const int middle = ( low + high ) / 2;
+        const Record *r = record( middle );
+        int cmp = compare( m_strings + r->parentId, r->parentIdLength, parentId );
+        if( cmp == 0 )
+            cmp = compare( m_strings + r->title, r->titleLength, title );
+        if( cmp == 0 )
+            return r;
+        if( cmp < 0 )
+            low = middle + 1;
+        else
+            high = middle - 1;
+    }
+    return 0;
+}
+
+const PathIndex::Record *PathIndex::findId( const QString &id ) const
+{
+    int low = 0;
+    int high = int( m_count ) - 1;
+    while( low <= high ) {
+        const int middle = ( low + high ) / 2;
+        const Record *r = record( m_byId[middle] );
+        const int cmp = compare( m_strings + r->id, r->idLength, id );
+        if( cmp == 0 )
+            return r;
+        if( cmp < 0 )
+            low = middle + 1;
+        else
+            high = middle - 1;
+    }
+    return 0;
+}
+
+bool PathIndex::findPath( const QString &path, Object *object ) const
+{
+    if( !isOpen() )
+        return false;
+
+    const QStringList segments = path.split( QDir::separator(), QString::SkipEmptyParts );
+    if( segments.isEmpty() )
+        return false;
+
+    QString parentId = QLatin1String("0");
+    const Record *r = 0;
+    foreach( const QString &segment, segments ) {
+        r = findChild( parentId, segment );
+        if( !r )
+            return false;
+        parentId = string( r->id, r->idLength );
+    }
+
+    *object = this->object( r );
+    return true;
+}
+
+QString PathIndex::pathForId( const QString &id ) const
+{
+    if( !isOpen() )
+        return QString();
+
+    QString path;
+    QString current = id;
+    // a parent loop in a garbled index must not hang us
+    for( quint32 depth = 0; current != QLatin1String("0"); ++depth ) {
+        const Record *r = findId( current );
+        if( !r || depth >= m_count )
+            return QString();
+        path.prepend( QDir::separator() + string( r->title, r->titleLength ) );
+        current = string( r->parentId, r->parentIdLength );
+    }
+    return path;
+}
+
+QList<PathIndex::Object> PathIndex::objects() const
+{
+    QList<Object> objects;
+    objects.reserve( m_count );
+    for( quint32 i = 0; i < m_count; ++i )
+        objects << object( record( i ) );
+    return objects;
+}
+
+bool PathIndex::write( const QString &fileName,
+                       const QString &systemUpdateId,
+                       const QList<Object> &objects )
+{
+    if( fileName.isEmpty() || systemUpdateId.isEmpty() )
+        return false;
+
+    QList<int> byPath;
+    for( int i = 0; i < objects.size(); ++i )
+        byPath << i;
+    QList<int> byId = byPath;
+    qSort( byPath.begin(), byPath.end(), ObjectLessThan( objects, false ) );
+    qSort( byId.begin(), byId.end(), ObjectLessThan( objects, true ) );
+
+    QString strings;
+    QHash<QString, quint32> offsets;
+
+    Header header;
+    memcpy( header.magic, PATH_INDEX_MAGIC, sizeof( header.magic ) );
+    header.version = PATH_INDEX_VERSION;
+    header.count = objects.size();
+    header.updateId = appendString( systemUpdateId, &strings, &offsets );
+    header.updateIdLength = systemUpdateId.length();
+    header.reserved = 0;
+
+    QVector<Record> records;
+    records.reserve( objects.size() );
+    // where each object ends up, for the ID order
+    QVector<quint32> position( objects.size() );
+    foreach( int i, byPath ) {
+        const Object &o = objects[i];
+        Record r;
+        r.id = appendString( o.id, &strings, &offsets );
+        r.idLength = o.id.length();
+        r.parentId = appendString( o.parentId, &strings, &offsets );
+        r.parentIdLength = o.parentId.length();
+        r.title = appendString( o.title, &strings, &offsets );
+        r.titleLength = o.title.length();
+        r.container = o.container ? 1 : 0;
+        position[i] = records.size();
+        records << r;
+    }
+
+    QVector<quint32> idOrder;
+    idOrder.reserve( objects.size() );
+    foreach( int i, byId )
+        idOrder << position[i];
+
+    header.stringsLength = strings.length();
+
+    // replaced in one go, so that a slave mapping the old
+    // index, or killed halfway through, sees either one
+    KSaveFile file( fileName );
+    if( !file.open() ) {
+        kDebug() << "Cannot write index" << fileName << file.errorString();
+        return false;
+    }
+    file.write( reinterpret_cast<const char *>( &header ), sizeof( Header ) );
+    file.write( reinterpret_cast<const char *>( records.constData() ), records.size() * sizeof( Record ) );
+    file.write( reinterpret_cast<const char *>( idOrder.constData() ), idOrder.size() * sizeof( quint32 ) );
+    file.write( reinterpret_cast<const char *>( strings.constData() ), strings.length() * sizeof( QChar ) );
+    if( !file.finalize() ) {
+        kDebug() << "Cannot write index" << fileName << file.errorString();
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,126 @@
+/********************************************************************
+ This file is part of the KDE project.
+
+Copyright (C) 2010 Nikhil Marathe <nsm.nikhil@gmail.com>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*********************************************************************/
+
+#ifndef PATHINDEX_H
+#define PATHINDEX_H
+
+#include <QFile>
+#include <QList>
+#include <QString>
+
+#define PATH_INDEX_ENV "KIO_UPNP_MS_INDEX"
+
+// objects an index keeps at most, those resolved or
+// listed last are kept
+#define PATH_INDEX_SIZE 100000
+
+/**
+ * The IDs and titles of a device's objects, kept on disk so
+ * that a new slave process can resolve paths the previous
+ * ones did without browsing for every segment again.
+ *
+ * An index is a file per device, in the KDE cache directory
+ * or the directory KIO_UPNP_MS_INDEX points to, which is
+ * mapped into memory rather than read. Records are sorted by
+ * (parent ID, title) for paths, and by ID for IDs, so both
+ * are found by binary search.
+ *
+ * Every index holds the SystemUpdateID of the device when it
+ * was written. Any change to a ContentDirectory changes its
+ * SystemUpdateID, so an index is only used while they match.
+ */
+class PathIndex
+{
+  public:
+    struct Object {
+        QString id;
+        QString parentId;
+        QString title;
+        bool container;
+    };
+
+    PathIndex();
+    ~PathIndex();
+
+    /**
+     * Returns the index file of the device @c uuid,
+     * or an empty string if there is no place for it.
+     */
+    static QString fileName( const QString &uuid );
+
+    /**
+     * Maps @c fileName if it was written while the device
+     * had @c systemUpdateId. Returns false if there is no such
+     * index, or it is not usable.
+     */
+    bool open( const QString &fileName, const QString &systemUpdateId );
+    void close();
+    bool isOpen() const { return m_data != 0; }
+    int size() const;
+
+    /**
+     * Walks @c path, in the form ObjectCache keeps them,
+     * from the root. Returns false if any segment is
+     * not in the index.
+     */
+    bool findPath( const QString &path, Object *object ) const;
+
+    /**
+     * Returns the path of @c id, or a null string
+     * if it or one of its parents is not in the index.
+     */
+    QString pathForId( const QString &id ) const;
+
+    /**
+     * Every object of the index, for a new
+     * index to be written from.
+     */
+    QList<Object> objects() const;
+
+    /**
+     * Replaces @c fileName by an index of @c objects, whose
+     * parents are expected to be among them, up to the root.
+     */
+    static bool write( const QString &fileName,
+                       const QString &systemUpdateId,
+                       const QList<Object> &objects );
+
+  private:
+    struct Header;
+    struct Record;
+
+    const Record *record( int index ) const;
+    const Record *findChild( const QString &parentId, const QString &title ) const;
+    const Record *findId( const QString &id ) const;
+    QString string( quint32 offset, quint32 length ) const;
+    Object object( const Record *record ) const;
+
+    Q_DISABLE_COPY( PathIndex )
+
+    QFile m_file;
+    const uchar *m_data;
+    quint32 m_count;
+    const Record *m_records;
+    // indices of m_records, sorted by ID
+    const quint32 *m_byId;
+    const QChar *m_strings;
+    quint32 m_stringsLength;
+};
+
+#endif
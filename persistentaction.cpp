@@ -19,7 +19,6 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
 #include "persistentaction.h"
 
-#include <QThread>
 #include <QTimer>
 
 #include <kdebug.h>
@@ -29,20 +28,23 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include <HUpnpCore/HActionArguments>
 #include <HUpnpCore/HActionInfo>
 #include <HUpnpCore/HClientActionOp>
+#include <HUpnpCore/HClientDevice>
+#include <HUpnpCore/HClientService>
+#include <HUpnpCore/HDeviceInfo>
+#include <HUpnpCore/HUdn>
 
-using namespace Herqq::Upnp;
+#include "metrics.h"
 
-class Sleeper : public QThread
-{
-public:
-    static void msleep( ulong msecs ) { QThread::msleep( msecs ); }
-};
+#include "tracer.h"
+
+using namespace Herqq::Upnp;
 
 PersistentAction::PersistentAction( Herqq::Upnp::HClientAction *action, QObject *parent, uint maximumTries )
     : QObject( parent )
     , m_maximumTries( maximumTries )
     , m_timer( new QTimer( this ) )
     , m_action( action )
+    , m_metrics( Metrics::forDevice( action->parentService()->parentDevice()->info().udn().toSimpleUuid() ) )
 {
     connect( m_timer, SIGNAL( timeout() ), this, SLOT( timeout() ) );
 }
@@ -51,41 +53,81 @@ void PersistentAction::timeout()
 {
     kDebug() << "TIMEOUT";
     m_timer->stop();
+    m_metrics->timeouts++;
     // disconnect so that we don't get multiple invokeComplete calls in case it just finishes
     bool ok = disconnect( m_action, SIGNAL( invokeComplete(Herqq::Upnp::HClientAction*, const Herqq::Upnp::HClientActionOp&) ),
                        this, SLOT( invokeComplete(Herqq::Upnp::HClientAction*, const Herqq::Upnp::HClientActionOp&) ) );
     Q_UNUSED( ok );
-    HClientActionOp op;
+    // with the arguments of the try, so that whoever gets
+    // it can tell which request failed, as with any other
+    HClientActionOp op( m_inputArgs );
     op.setReturnValue( Herqq::Upnp::UpnpActionFailed );
     op.setErrorDescription( QLatin1String("Action timed out") );
 
-    HActionArguments empty;
-    invokeComplete(m_action, op);
+    tryDone(m_action, op);
 }
 
 void PersistentAction::invoke( const Herqq::Upnp::HActionArguments &args )
 {
     m_inputArgs = args;
     m_tries = 0;
-    m_delay = 1000;
+    m_elapsed.start();
+    m_delay = PERSISTENT_ACTION_RETRY_DELAY;
+    m_backoff.invalidate();
     invoke();
 }
 
 void PersistentAction::invoke()
 {
+    if( m_backoff.isValid() ) {
+        m_metrics->backoffMsecs += m_backoff.elapsed();
+        m_backoff.invalidate();
+        Tracer *tracer = Tracer::instance();
+        if( tracer )
+            tracer->complete( "PersistentAction backoff", m_backoffStarted );
+    }
+
     kDebug() << "Beginning invoke" << m_action << m_action->info().name() << "Try number" << m_tries;
     bool ok = connect( m_action, SIGNAL( invokeComplete(Herqq::Upnp::HClientAction*, const Herqq::Upnp::HClientActionOp &) ),
                        this, SLOT( invokeComplete(Herqq::Upnp::HClientAction*, const Herqq::Upnp::HClientActionOp &) ));
     Q_ASSERT(ok);
     Q_UNUSED(ok);
-    HClientActionOp op = m_action->beginInvoke( m_inputArgs );
-    m_timer->start( 5000 );
+    m_metrics->tries++;
+    Tracer *tracer = Tracer::instance();
+    if( tracer )
+        m_tryStarted = tracer->now();
+    m_op = m_action->beginInvoke( m_inputArgs );
+    m_timer->start( PERSISTENT_ACTION_TIMEOUT );
 }
 
 void PersistentAction::invokeComplete(Herqq::Upnp::HClientAction *action, const Herqq::Upnp::HClientActionOp &invocationOp) // SLOT
+{
+    // the HClientAction reports every invocation of it,
+    // including those of other PersistentActions
+    if( invocationOp.id() != m_op.id() )
+        return;
+    tryDone( action, invocationOp );
+}
+
+void PersistentAction::tryDone(Herqq::Upnp::HClientAction *action, const Herqq::Upnp::HClientActionOp &invocationOp)
 {
     kDebug() << "INVOKE COMPLETE" << action;
     m_timer->stop();
+    // invoke() connects again for a retry, and after a
+    // timeout() this is disconnected already
+    disconnect( m_action, SIGNAL( invokeComplete(Herqq::Upnp::HClientAction*, const Herqq::Upnp::HClientActionOp&) ),
+                this, SLOT( invokeComplete(Herqq::Upnp::HClientAction*, const Herqq::Upnp::HClientActionOp&) ) );
+
+    Tracer *tracer = Tracer::instance();
+    if( tracer ) {
+        TraceArguments arguments;
+        arguments << TraceArgument( "action", m_action->info().name() );
+        arguments << TraceArgument( "try", QString::number( m_tries ) );
+        arguments << TraceArgument( "result", invocationOp.returnValue() == Herqq::Upnp::UpnpSuccess
+                                              ? QString::fromLatin1( "ok" )
+                                              : invocationOp.errorDescription() );
+        tracer->complete( "PersistentAction try", m_tryStarted, arguments );
+    }
 
     if( invocationOp.returnValue() != Herqq::Upnp::UpnpSuccess ) {
         kDebug() << "Error occured";
@@ -93,30 +135,28 @@ void PersistentAction::invokeComplete(Herqq::Upnp::HClientAction *action, const
         kDebug() << errorString;
 
         if( m_tries < m_maximumTries ) {
-            kDebug() << "Sleeping for" << m_delay << "msecs before retrying";
-            Sleeper::msleep( m_delay );
+            kDebug() << "Waiting for" << m_delay << "msecs before retrying";
+            // the slave goes on with other requests and
+            // their replies in the meantime
+            m_backoff.start();
+            if( tracer )
+                m_backoffStarted = tracer->now();
+            QTimer::singleShot( m_delay, this, SLOT( invoke() ) );
             m_tries++;
+            m_metrics->retries++;
             m_delay = m_delay * 2;
-            invoke();
             return;
         }
         else {
             kDebug() << "Failed even after" << m_tries << "tries. Giving up!";
-            bool ok = disconnect( m_action, SIGNAL( invokeComplete(Herqq::Upnp::HClientAction*, const Herqq::Upnp::HClientActionOp&) ),
-                        this, SLOT( invokeComplete(Herqq::Upnp::HClientAction*, const Herqq::Upnp::HClientActionOp&) ) );
-            Q_ASSERT( ok );
-            Q_UNUSED( ok );
+            m_metrics->actionDone( m_action->info().name(), elapsed(), false );
             emit invokeComplete( action, invocationOp, false, errorString );
             return;
         }
     }
 
     kDebug() << "EVERYTHING FINE";
-    bool ok = disconnect( m_action, SIGNAL( invokeComplete(Herqq::Upnp::HClientAction*, const Herqq::Upnp::HClientActionOp&) ),
-                this, SLOT( invokeComplete(Herqq::Upnp::HClientAction*, const Herqq::Upnp::HClientActionOp &) ) );
-    Q_ASSERT( ok );
-    Q_UNUSED( ok );
-
+    m_metrics->actionDone( m_action->info().name(), elapsed(), true );
     emit invokeComplete( action, invocationOp, true, QString() );
 }
 
@@ -20,12 +20,20 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #ifndef PERSISTENTACTION_H
 #define PERSISTENTACTION_H
 
+#include <QElapsedTimer>
 #include <QObject>
 
 #include <HUpnpCore/HActionArguments>
 #include <HUpnpCore/HClientActionOp>
 
 class QTimer;
+class Metrics;
+
+// milliseconds to wait for a reply before considering the try failed
+#define PERSISTENT_ACTION_TIMEOUT 5000
+// milliseconds waited before the first retry, doubled for every further one
+#define PERSISTENT_ACTION_RETRY_DELAY 1000
+#define PERSISTENT_ACTION_MAXIMUM_TRIES 3
 
 namespace Herqq
 {
@@ -52,9 +60,13 @@ class PersistentAction : public QObject
 {
     Q_OBJECT
 public:
-    PersistentAction( Herqq::Upnp::HClientAction *action,  QObject *parent = 0, uint maximumTries = 3 );
+    PersistentAction( Herqq::Upnp::HClientAction *action,  QObject *parent = 0, uint maximumTries = PERSISTENT_ACTION_MAXIMUM_TRIES );
     QString errorString() const { return m_errorString; }
     void invoke(const Herqq::Upnp::HActionArguments &args);
+    /**
+     * Milliseconds since invoke() was called, all tries included.
+     */
+    qint64 elapsed() const { return m_elapsed.elapsed(); }
 
 signals:
     /**
@@ -71,17 +83,28 @@ signals:
 private slots:
     void invokeComplete(Herqq::Upnp::HClientAction*, const Herqq::Upnp::HClientActionOp &); // SLOT
     void timeout();
+    // begins a try, after the backoff if it is a retry
+    void invoke();
 
 private:
-    void invoke();
+    void tryDone(Herqq::Upnp::HClientAction*, const Herqq::Upnp::HClientActionOp &);
     uint m_maximumTries;
     uint m_tries;
     QString m_errorString;
     ulong m_delay;
     QTimer *m_timer;
+    QElapsedTimer m_elapsed;
+    // on the trace clock, see Tracer::now()
+    qint64 m_tryStarted;
+    // of the backoff before the pending retry, invalid if there is none
+    QElapsedTimer m_backoff;
+    qint64 m_backoffStarted;
 
     Herqq::Upnp::HClientAction *m_action;
     Herqq::Upnp::HActionArguments m_inputArgs;
+    // of the current try
+    Herqq::Upnp::HClientActionOp m_op;
+    Metrics *m_metrics;
 };
 
 #endif
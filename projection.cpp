@@ -0,0 +1,123 @@
+/********************************************************************
+ This file is part of the KDE project.
+
+Copyright (C) 2010 Nikhil Marathe <nsm.nikhil@gmail.com>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*********************************************************************/
+
+#include "projection.h"
+
+#include <sys/stat.h>
+
+#include "upnp-ms-types.h"
+
+struct ProjectedField {
+    // as in fields= and DIDL::Parser::setWantedProperties()
+    const char *name;
+    // as in the Filter
+    const char *filter;
+    Projection::Field field;
+    // as filled by ControlPointThread, 0 for Resource which has several
+    uint key;
+};
+
+static const ProjectedField projectedFields[] = {
+    { "date", "dc:date", Projection::Date, KIO::UPNP_DATE },
+    { "creator", "dc:creator", Projection::Creator, KIO::UPNP_CREATOR },
+    { "artist", "upnp:artist", Projection::Artist, KIO::UPNP_ARTIST },
+    { "album", "upnp:album", Projection::Album, KIO::UPNP_ALBUM },
+    { "genre", "upnp:genre", Projection::Genre, KIO::UPNP_GENRE },
+    { "albumArtURI", "upnp:albumArtURI", Projection::AlbumArtUri, KIO::UPNP_ALBUMART_URI },
+    { "channelName", "upnp:channelName", Projection::ChannelName, KIO::UPNP_CHANNEL_NAME },
+    { "channelNr", "upnp:channelNr", Projection::ChannelNumber, KIO::UPNP_CHANNEL_NUMBER },
+    { "originalTrackNumber", "upnp:originalTrackNumber", Projection::OriginalTrackNumber, KIO::UPNP_TRACK_NUMBER },
+    { "res", "res", Projection::Resource, 0 },
+    { "size", "res@size", Projection::ResourceSize, KIO::UDSEntry::UDS_SIZE },
+    { "duration", "res@duration", Projection::ResourceDuration, KIO::UPNP_DURATION },
+    { "bitrate", "res@bitrate", Projection::ResourceBitrate, KIO::UPNP_BITRATE },
+    { "resolution", "res@resolution", Projection::ResourceResolution, KIO::UPNP_IMAGE_RESOLUTION },
+    { "childCount", "@childCount", Projection::ChildCount, KIO::UPNP_ALBUM_CHILDCOUNT },
+    { "refID", "@refID", Projection::RefId, KIO::UPNP_REF_ID }
+};
+enum { ProjectedFieldCount = sizeof( projectedFields ) / sizeof( ProjectedField ) };
+
+namespace Projection
+{
+
+bool parse( const QString &names, Fields *fields, QString *unknown )
+{
+    Fields parsed;
+    foreach( const QString &name, names.split( QLatin1Char(','), QString::SkipEmptyParts ) ) {
+        const QString trimmed = name.trimmed();
+        int i = 0;
+        while( i < ProjectedFieldCount && trimmed != QLatin1String( projectedFields[i].name ) )
+            ++i;
+        if( i == ProjectedFieldCount ) {
+            if( unknown )
+                *unknown = trimmed;
+            return false;
+        }
+        parsed |= projectedFields[i].field;
+    }
+
+    // attributes of <res> come with the <res>
+    if( parsed & ( ResourceSize | ResourceDuration | ResourceBitrate | ResourceResolution ) )
+        parsed |= Resource;
+    *fields = parsed;
+    return true;
+}
+
+QString filter( Fields fields )
+{
+    if( ( fields & AllFields ) == AllFields )
+        return QLatin1String("*");
+
+    QStringList filter;
+    for( int i = 0; i < ProjectedFieldCount; ++i ) {
+        if( fields & projectedFields[i].field )
+            filter << QLatin1String( projectedFields[i].filter );
+    }
+    return filter.join( QLatin1String(",") );
+}
+
+QStringList properties( Fields fields )
+{
+    QStringList properties;
+    for( int i = 0; i < ProjectedFieldCount; ++i ) {
+        // attributes of the object element itself are always read
+        if( ( fields & projectedFields[i].field ) && projectedFields[i].filter[0] != '@' )
+            properties << QLatin1String( projectedFields[i].name );
+    }
+    return properties;
+}
+
+void apply( KIO::UDSEntry &entry, Fields fields )
+{
+    for( int i = 0; i < ProjectedFieldCount; ++i ) {
+        if( !( fields & projectedFields[i].field ) && projectedFields[i].key )
+            entry.remove( projectedFields[i].key );
+    }
+
+    if( !( fields & Resource ) ) {
+        entry.remove( KIO::UDSEntry::UDS_MIME_TYPE );
+        entry.remove( KIO::UDSEntry::UDS_TARGET_URL );
+        // whether it can be read is not known, it stays readable,
+        // as ControlPointThread::fillItem() leaves it
+        const long long access = entry.numberValue( KIO::UDSEntry::UDS_ACCESS );
+        entry.insert( KIO::UDSEntry::UDS_ACCESS, access | S_IRUSR | S_IRGRP | S_IROTH );
+    }
+}
+
+}
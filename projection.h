@@ -0,0 +1,99 @@
+/********************************************************************
+ This file is part of the KDE project.
+
+Copyright (C) 2010 Nikhil Marathe <nsm.nikhil@gmail.com>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*********************************************************************/
+
+#ifndef PROJECTION_H
+#define PROJECTION_H
+
+#include <QFlags>
+#include <QString>
+#include <QStringList>
+
+namespace KIO {
+    class UDSEntry;
+}
+
+/**
+ * The parts of a listing or stat entry a client can choose
+ * with fields=, see README. The name, file type, access,
+ * class, id and parent id of an object are always there,
+ * the server sends them whatever the Filter.
+ *
+ * Fields the client did not ask for are left out of the
+ * Browse or Search Filter, so the server neither looks
+ * them up nor sends them, and are not put in the entries.
+ */
+namespace Projection
+{
+    enum Field {
+        Date                = 1 << 0,
+        Creator             = 1 << 1,
+        Artist              = 1 << 2,
+        Album               = 1 << 3,
+        Genre               = 1 << 4,
+        AlbumArtUri         = 1 << 5,
+        ChannelName         = 1 << 6,
+        ChannelNumber       = 1 << 7,
+        OriginalTrackNumber = 1 << 8,
+        // UDS_MIME_TYPE and UDS_TARGET_URL, whether an item can be read
+        Resource            = 1 << 9,
+        // UDS_SIZE
+        ResourceSize        = 1 << 10,
+        ResourceDuration    = 1 << 11,
+        ResourceBitrate     = 1 << 12,
+        ResourceResolution  = 1 << 13,
+        ChildCount          = 1 << 14,
+        RefId               = 1 << 15,
+        AllFields           = ( 1 << 16 ) - 1
+    };
+    Q_DECLARE_FLAGS( Fields, Field )
+
+    /**
+     * Reads a comma separated list of field names, as
+     * in the DIDL-Lite without namespace ( "artist,album",
+     * "res,size" ). An empty list is names only.
+     * Asking for any <res> attribute implies Resource.
+     *
+     * Returns false, with the offending name in
+     * @c unknown, if a name is not a field.
+     */
+    bool parse( const QString &names, Fields *fields, QString *unknown );
+
+    /**
+     * The Filter argument of Browse and Search
+     * which has the server send @c fields.
+     */
+    QString filter( Fields fields );
+
+    /**
+     * Those of ControlPointThread::listingProperties()
+     * which @c fields needs, for DIDL::Parser::setWantedProperties().
+     */
+    QStringList properties( Fields fields );
+
+    /**
+     * Takes what @c fields leaves out from an entry filled
+     * with AllFields, as one from the ObjectCache, so that
+     * it is the entry @c fields would have filled.
+     */
+    void apply( KIO::UDSEntry &entry, Fields fields );
+}
+
+Q_DECLARE_OPERATORS_FOR_FLAGS( Projection::Fields )
+
+#endif
@@ -0,0 +1,37 @@
+/********************************************************************
+ This file is part of the KDE project.
+
+Copyright (C) 2010 Nikhil Marathe <nsm.nikhil@gmail.com>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*********************************************************************/
+
+#include "stringpool.h"
+
+QString StringPool::intern( const QString &value )
+{
+    if( value.isEmpty() )
+        return value;
+
+    QSet<QString>::const_iterator it = m_strings.constFind( value );
+    if( it != m_strings.constEnd() )
+        return *it;
+
+    // values that did repeat are pooled again as soon as
+    // they are seen, so starting over is cheap
+    if( m_strings.size() >= STRING_POOL_LIMIT )
+        m_strings.clear();
+    m_strings.insert( value );
+    return value;
+}
@@ -0,0 +1,54 @@
+/********************************************************************
+ This file is part of the KDE project.
+
+Copyright (C) 2010 Nikhil Marathe <nsm.nikhil@gmail.com>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*********************************************************************/
+
+#ifndef STRINGPOOL_H
+#define STRINGPOOL_H
+
+#include <QSet>
+#include <QString>
+
+// distinct values kept before the pool starts over,
+// enough for the classes, genres and artists of a library
+#define STRING_POOL_LIMIT 8192
+
+/**
+ * Hands out one shared copy of equal strings, so that the
+ * upnp:class, genre, artist or mime type repeated by every
+ * object of a listing is stored once, in the objects, the
+ * ObjectCache and the UDSEntries alike.
+ *
+ * Only meant for values which repeat, every distinct value
+ * costs a hash node.
+ */
+class StringPool
+{
+  public:
+    /**
+     * Returns the pooled copy of @c value,
+     * pooling @c value if there is none.
+     */
+    QString intern( const QString &value );
+
+    int size() const { return m_strings.size(); }
+
+  private:
+    QSet<QString> m_strings;
+};
+
+#endif
@@ -0,0 +1,467 @@
+#include "cdsstub.h"
+
+#include <cstdio>
+
+#include <QCoreApplication>
+#include <QMutexLocker>
+#include <QStringList>
+#include <QThread>
+
+#include <KAboutData>
+#include <KCmdLineArgs>
+#include <KComponentData>
+
+#include <HUpnpCore/HDeviceHost>
+#include <HUpnpCore/HDeviceHostConfiguration>
+#include <HUpnpCore/HDeviceInfo>
+#include <HUpnpCore/HServerDevice>
+#include <HUpnpCore/HServiceInfo>
+#include <HUpnpCore/HServiceId>
+
+#include "../persistentaction.h"
+
+using namespace Herqq::Upnp;
+
+#define DIDL_LITE_HEADER "<DIDL-Lite xmlns=\"urn:schemas-upnp-org:metadata-1-0/DIDL-Lite/\"" \
+                         " xmlns:dc=\"http://purl.org/dc/elements/1.1/\"" \
+                         " xmlns:upnp=\"urn:schemas-upnp-org:metadata-1-0/upnp/\">"
+#define DIDL_LITE_FOOTER "</DIDL-Lite>"
+
+// UPnP ContentDirectory error code
+#define NO_SUCH_OBJECT 701
+
+class Sleeper : public QThread
+{
+public:
+    static void msleep( ulong msecs ) { QThread::msleep( msecs ); }
+};
+
+static QString escape( const QString &text )
+{
+    QString escaped = text;
+    escaped.replace( QLatin1Char('&'), QLatin1String("&amp;") );
+    escaped.replace( QLatin1Char('<'), QLatin1String("&lt;") );
+    escaped.replace( QLatin1Char('>'), QLatin1String("&gt;") );
+    escaped.replace( QLatin1Char('"'), QLatin1String("&quot;") );
+    return escaped;
+}
+
+static quint64 power( uint base, uint exponent )
+{
+    quint64 result = 1;
+    while( exponent-- )
+        result *= base;
+    return result;
+}
+
+quint64 StubTree::totalItems() const
+{
+    return power( fanout, depth ) * items;
+}
+
+ContentDirectoryStub::ContentDirectoryStub( const StubTree &tree )
+    : HServerService()
+    , m_tree( tree )
+    , m_invocations( 0 )
+    , m_random( tree.seed )
+{
+}
+
+HServerService::HActionInvokes ContentDirectoryStub::createActionInvokes()
+{
+    HActionInvokes invokes;
+    invokes.insert( QLatin1String("GetSearchCapabilities"),
+                    HActionInvoke( this, &ContentDirectoryStub::getSearchCapabilities ) );
+    invokes.insert( QLatin1String("GetSortCapabilities"),
+                    HActionInvoke( this, &ContentDirectoryStub::getSortCapabilities ) );
+    invokes.insert( QLatin1String("GetSystemUpdateID"),
+                    HActionInvoke( this, &ContentDirectoryStub::getSystemUpdateId ) );
+    invokes.insert( QLatin1String("Browse"),
+                    HActionInvoke( this, &ContentDirectoryStub::browse ) );
+    invokes.insert( QLatin1String("Search"),
+                    HActionInvoke( this, &ContentDirectoryStub::search ) );
+    return invokes;
+}
+
+/////////////////////////
+////   ID arithmetic ////
+/////////////////////////
+
+bool ContentDirectoryStub::isValidId( const QString &id ) const
+{
+    QStringList parts = id.split( QLatin1Char(':') );
+    if( parts.size() > 2 )
+        return false;
+
+    QStringList path = parts[0].split( QLatin1Char('.') );
+    if( path[0] != QLatin1String("0") || (uint)path.size() - 1 > m_tree.depth )
+        return false;
+    for( int i = 1; i < path.size(); ++i ) {
+        bool ok;
+        uint index = path[i].toUInt( &ok );
+        if( !ok || index >= m_tree.fanout )
+            return false;
+    }
+
+    if( parts.size() == 2 ) {
+        bool ok;
+        uint index = parts[1].toUInt( &ok );
+        if( !ok || index >= m_tree.items || level( parts[0] ) != m_tree.depth )
+            return false;
+    }
+    return true;
+}
+
+bool ContentDirectoryStub::isContainer( const QString &id ) const
+{
+    return !id.contains( QLatin1Char(':') );
+}
+
+uint ContentDirectoryStub::level( const QString &id ) const
+{
+    return id.count( QLatin1Char('.') );
+}
+
+uint ContentDirectoryStub::childCount( const QString &id ) const
+{
+    if( !isContainer( id ) )
+        return 0;
+    return level( id ) < m_tree.depth ? m_tree.fanout : m_tree.items;
+}
+
+QString ContentDirectoryStub::childId( const QString &id, uint index ) const
+{
+    if( level( id ) < m_tree.depth )
+        return id + QLatin1Char('.') + QString::number( index );
+    return id + QLatin1Char(':') + QString::number( index );
+}
+
+QString ContentDirectoryStub::parentId( const QString &id ) const
+{
+    if( id == QLatin1String("0") )
+        return QLatin1String("-1");
+    if( !isContainer( id ) )
+        return id.section( QLatin1Char(':'), 0, 0 );
+    return id.section( QLatin1Char('.'), 0, -2 );
+}
+
+uint ContentDirectoryStub::indexInParent( const QString &id ) const
+{
+    if( !isContainer( id ) )
+        return id.section( QLatin1Char(':'), 1 ).toUInt();
+    return id.section( QLatin1Char('.'), -1 ).toUInt();
+}
+
+QString ContentDirectoryStub::objectXml( const QString &id ) const
+{
+    const uint index = indexInParent( id );
+    QString xml;
+    if( isContainer( id ) ) {
+        xml += QString( QLatin1String("<container id=\"%1\" parentID=\"%2\" restricted=\"1\" childCount=\"%3\">") )
+                   .arg( escape( id ), escape( parentId( id ) ) ).arg( childCount( id ) );
+        xml += QString( QLatin1String("<dc:title>%1</dc:title>") )
+                   .arg( id == QLatin1String("0") ? QLatin1String("root") : QString( QLatin1String("Folder %1") ).arg( index ) );
+        xml += QLatin1String("<upnp:class>object.container.storageFolder</upnp:class>");
+        xml += QLatin1String("</container>");
+        return xml;
+    }
+
+    // deterministic, but spread out, metadata so that
+    // interning and caching see realistic repetition
+    const uint artist = index % 50;
+    const uint album = index % 200;
+    const char *genres[] = { "Rock", "Pop", "Jazz", "R&B", "Classical", "Electronic", "Folk", "Metal" };
+
+    xml += QString( QLatin1String("<item id=\"%1\" parentID=\"%2\" restricted=\"1\">") )
+               .arg( escape( id ), escape( parentId( id ) ) );
+    xml += QString( QLatin1String("<dc:title>Track %1.mp3</dc:title>") ).arg( index, 5, 10, QLatin1Char('0') );
+    xml += QLatin1String("<upnp:class>object.item.audioItem.musicTrack</upnp:class>");
+    xml += QString( QLatin1String("<dc:creator>Artist %1</dc:creator>") ).arg( artist );
+    xml += QString( QLatin1String("<upnp:artist>Artist %1</upnp:artist>") ).arg( artist );
+    xml += QString( QLatin1String("<upnp:album>Album %1</upnp:album>") ).arg( album );
+    xml += QString( QLatin1String("<upnp:genre>%1</upnp:genre>") ).arg( escape( QLatin1String( genres[index % 8] ) ) );
+    xml += QString( QLatin1String("<dc:date>%1-05-17</dc:date>") ).arg( 1970 + index % 40 );
+    xml += QString( QLatin1String("<upnp:originalTrackNumber>%1</upnp:originalTrackNumber>") ).arg( index % 20 + 1 );
+    xml += QString( QLatin1String("<upnp:albumArtURI>http://127.0.0.1/art/%1.jpg</upnp:albumArtURI>") ).arg( album );
+    xml += QString( QLatin1String("<res protocolInfo=\"http-get:*:audio/mpeg:*\" size=\"%1\" duration=\"0:0%2:%3.000\" bitrate=\"16000\">"
+                                  "http://127.0.0.1/media/%4.mp3</res>") )
+               .arg( 3000000 + index * 17 ).arg( index % 10 ).arg( index % 60, 2, 10, QLatin1Char('0') ).arg( escape( id ) );
+    xml += QLatin1String("</item>");
+    return xml;
+}
+
+void ContentDirectoryStub::finish( HActionArguments *outArgs, const QString &didl, uint returned, uint total )
+{
+    outArgs->setValue( QLatin1String("Result"), didl );
+    outArgs->setValue( QLatin1String("NumberReturned"), returned );
+    outArgs->setValue( QLatin1String("TotalMatches"), total );
+    outArgs->setValue( QLatin1String("UpdateID"), 1 );
+}
+
+/////////////////////////
+////     Faults      ////
+/////////////////////////
+
+// a seeded LCG, so that runs with the same --seed
+// see the same faults, whatever the thread pool does
+uint ContentDirectoryStub::random( uint bound )
+{
+    m_random = m_random * 1103515245u + 12345u;
+    return ( m_random >> 16 ) % bound;
+}
+
+ContentDirectoryStub::Fault ContentDirectoryStub::nextFault()
+{
+    QMutexLocker lock( &m_mutex );
+    if( m_tree.throttle && m_lastAccepted.isValid() && m_lastAccepted.elapsed() < m_tree.throttle )
+        return Throttle;
+    m_lastAccepted.start();
+
+    const uint roll = random( 100 );
+    if( roll < m_tree.dropRate )
+        return Drop;
+    if( roll < m_tree.dropRate + m_tree.resetRate )
+        return Reset;
+    return NoFault;
+}
+
+void ContentDirectoryStub::logRequest( const char *action, const char *outcome, qint64 msecs )
+{
+    QMutexLocker lock( &m_mutex );
+    printf( "REQ %s %s %lld\n", action, outcome, msecs );
+    fflush( stdout );
+}
+
+/**
+ * Runs @c handler after applying the configured faults and delays.
+ *
+ * HUpnp gives an action no way to tear down the connection it was
+ * invoked on, so a reset is answered with a plain action failure,
+ * which the slave treats exactly the same way. A drop holds the
+ * reply until PersistentAction has timed out and moved on.
+ */
+qint32 ContentDirectoryStub::serve( const char *action, Handler handler,
+                                    const HActionArguments &inArgs, HActionArguments *outArgs )
+{
+    m_invocations.ref();
+    QElapsedTimer timer;
+    timer.start();
+
+    switch( nextFault() ) {
+    case Drop:
+        logRequest( action, "dropped", 0 );
+        Sleeper::msleep( PERSISTENT_ACTION_TIMEOUT + 1000 );
+        return UpnpActionFailed;
+    case Reset:
+        logRequest( action, "reset", timer.elapsed() );
+        return UpnpActionFailed;
+    case Throttle:
+        logRequest( action, "throttled", timer.elapsed() );
+        return UpnpActionFailed;
+    case NoFault:
+        break;
+    }
+
+    uint delay = m_tree.latency;
+    if( m_tree.jitter ) {
+        QMutexLocker lock( &m_mutex );
+        delay += random( m_tree.jitter + 1 );
+    }
+    if( delay )
+        Sleeper::msleep( delay );
+
+    const qint32 result = ( this->*handler )( inArgs, outArgs );
+    logRequest( action, result == UpnpSuccess ? "ok" : "error", timer.elapsed() );
+    return result;
+}
+
+/////////////////////////
+////     Actions     ////
+/////////////////////////
+
+qint32 ContentDirectoryStub::getSearchCapabilities( const HActionArguments &inArgs, HActionArguments *outArgs )
+{
+    Q_UNUSED( inArgs );
+    outArgs->setValue( QLatin1String("SearchCaps"),
+                       QLatin1String("dc:title,dc:creator,upnp:class,upnp:artist,upnp:album,upnp:genre") );
+    return UpnpSuccess;
+}
+
+qint32 ContentDirectoryStub::getSortCapabilities( const HActionArguments &inArgs, HActionArguments *outArgs )
+{
+    Q_UNUSED( inArgs );
+    outArgs->setValue( QLatin1String("SortCaps"), QLatin1String("dc:title,dc:date") );
+    return UpnpSuccess;
+}
+
+qint32 ContentDirectoryStub::getSystemUpdateId( const HActionArguments &inArgs, HActionArguments *outArgs )
+{
+    Q_UNUSED( inArgs );
+    outArgs->setValue( QLatin1String("Id"), 1 );
+    return UpnpSuccess;
+}
+
+qint32 ContentDirectoryStub::browse( const HActionArguments &inArgs, HActionArguments *outArgs )
+{
+    return serve( "Browse", &ContentDirectoryStub::doBrowse, inArgs, outArgs );
+}
+
+qint32 ContentDirectoryStub::search( const HActionArguments &inArgs, HActionArguments *outArgs )
+{
+    return serve( "Search", &ContentDirectoryStub::doSearch, inArgs, outArgs );
+}
+
+qint32 ContentDirectoryStub::doBrowse( const HActionArguments &inArgs, HActionArguments *outArgs )
+{
+    const QString id = inArgs.value( QLatin1String("ObjectID") ).toString();
+    if( !isValidId( id ) )
+        return NO_SUCH_OBJECT;
+
+    QString didl = QLatin1String(DIDL_LITE_HEADER);
+    if( inArgs.value( QLatin1String("BrowseFlag") ).toString() == QLatin1String("BrowseMetadata") ) {
+        didl += objectXml( id );
+        didl += QLatin1String(DIDL_LITE_FOOTER);
+        finish( outArgs, didl, 1, 1 );
+        return UpnpSuccess;
+    }
+
+    const uint total = childCount( id );
+    const uint start = inArgs.value( QLatin1String("StartingIndex") ).toUInt();
+    uint count = inArgs.value( QLatin1String("RequestedCount") ).toUInt();
+    if( count == 0 || ( m_tree.maxPage && count > m_tree.maxPage ) )
+        count = m_tree.maxPage ? m_tree.maxPage : total;
+
+    uint returned = 0;
+    for( uint i = start; i < total && returned < count; ++i, ++returned )
+        didl += objectXml( childId( id, i ) );
+    didl += QLatin1String(DIDL_LITE_FOOTER);
+
+    finish( outArgs, didl, returned, total );
+    return UpnpSuccess;
+}
+
+/**
+ * The criteria are not evaluated, every item below
+ * the container matches, which is what a
+ * 'upnp:class derivedfrom "object.item"' collection scan asks for.
+ */
+qint32 ContentDirectoryStub::doSearch( const HActionArguments &inArgs, HActionArguments *outArgs )
+{
+    const QString id = inArgs.value( QLatin1String("ContainerID") ).toString();
+    if( !isValidId( id ) || !isContainer( id ) )
+        return NO_SUCH_OBJECT;
+
+    const uint below = m_tree.depth - level( id );
+    const uint total = power( m_tree.fanout, below ) * m_tree.items;
+    const uint start = inArgs.value( QLatin1String("StartingIndex") ).toUInt();
+    uint count = inArgs.value( QLatin1String("RequestedCount") ).toUInt();
+    if( count == 0 || ( m_tree.maxPage && count > m_tree.maxPage ) )
+        count = m_tree.maxPage ? m_tree.maxPage : total;
+
+    QString didl = QLatin1String(DIDL_LITE_HEADER);
+    uint returned = 0;
+    for( uint i = start; i < total && returned < count; ++i, ++returned ) {
+        // the leaf container is the base-fanout representation
+        // of i / items, most significant digit first
+        uint leaf = i / m_tree.items;
+        QString container = id;
+        for( uint l = below; l > 0; --l ) {
+            const quint64 weight = power( m_tree.fanout, l - 1 );
+            container += QLatin1Char('.') + QString::number( leaf / weight );
+            leaf %= weight;
+        }
+        didl += objectXml( container + QLatin1Char(':') + QString::number( i % m_tree.items ) );
+    }
+    didl += QLatin1String(DIDL_LITE_FOOTER);
+
+    finish( outArgs, didl, returned, total );
+    return UpnpSuccess;
+}
+
+/////////////////////////
+////  Model creator  ////
+/////////////////////////
+
+StubModelCreator::StubModelCreator( const StubTree &tree )
+    : HDeviceModelCreator()
+    , m_tree( tree )
+{
+}
+
+StubModelCreator* StubModelCreator::newInstance() const
+{
+    return new StubModelCreator( m_tree );
+}
+
+HServerService* StubModelCreator::createService( const HServiceInfo &serviceInfo,
+                                                 const HDeviceInfo &parentDeviceInfo ) const
+{
+    Q_UNUSED( parentDeviceInfo );
+    if( serviceInfo.serviceId() == HServiceId( QLatin1String("urn:upnp-org:serviceId:ContentDirectory") ) )
+        return new ContentDirectoryStub( m_tree );
+    return 0;
+}
+
+int main (int argc, char *argv[])
+{
+  const QByteArray& ba=QByteArray("cdsstub");
+  const KLocalizedString name=ki18n("cdsstub");
+  KAboutData aboutData( ba, ba, name, ba, name);
+  KCmdLineArgs::init( argc, argv, &aboutData );
+
+  KCmdLineOptions options;
+  options.add("depth <levels>", ki18n("Levels of containers below the root"), "2");
+  options.add("fanout <containers>", ki18n("Child containers of every non-leaf container"), "10");
+  options.add("items <items>", ki18n("Items in every leaf container"), "100");
+  options.add("max-page <count>", ki18n("Cap on objects returned per Browse/Search, 0 for none"), "0");
+  options.add("latency <msecs>", ki18n("Delay added to every Browse/Search"), "0");
+  options.add("jitter <msecs>", ki18n("Random delay of up to this much on top of the latency"), "0");
+  options.add("drop-rate <percent>", ki18n("Browse/Search replies held back until the client times out"), "0");
+  options.add("reset-rate <percent>", ki18n("Browse/Search requests failed as if the connection was reset"), "0");
+  options.add("throttle <msecs>", ki18n("Refuse Browse/Search arriving sooner than this after the last one"), "0");
+  options.add("seed <number>", ki18n("Seed for the fault injection"), "1");
+  KCmdLineArgs::addCmdLineOptions(options);
+
+  QCoreApplication app( KCmdLineArgs::qtArgc(), KCmdLineArgs::qtArgv() );
+  KComponentData component( &aboutData );
+  KCmdLineArgs *args = KCmdLineArgs::parsedArgs();
+
+  StubTree tree;
+  tree.depth = args->getOption("depth").toUInt();
+  tree.fanout = qMax( 1u, args->getOption("fanout").toUInt() );
+  tree.items = args->getOption("items").toUInt();
+  tree.maxPage = args->getOption("max-page").toUInt();
+  tree.latency = args->getOption("latency").toUInt();
+  tree.jitter = args->getOption("jitter").toUInt();
+  tree.dropRate = qMin( 100u, args->getOption("drop-rate").toUInt() );
+  tree.resetRate = qMin( 100u - tree.dropRate, args->getOption("reset-rate").toUInt() );
+  tree.throttle = args->getOption("throttle").toUInt();
+  tree.seed = args->getOption("seed").toUInt();
+
+  if( tree.totalItems() > 1000000 ) {
+      fprintf( stderr, "cdsstub: at most 1000000 items are supported, asked for %llu\n", tree.totalItems() );
+      return 1;
+  }
+
+  HDeviceConfiguration deviceConfig;
+  deviceConfig.setPathToDeviceDescription( QLatin1String(CDSSTUB_DATA_DIR "/device.xml") );
+  deviceConfig.setCacheControlMaxAge( 1800 );
+
+  HDeviceHostConfiguration hostConfig;
+  hostConfig.add( deviceConfig );
+  hostConfig.setDeviceModelCreator( StubModelCreator( tree ) );
+
+  HDeviceHost host;
+  if( !host.init( hostConfig ) ) {
+      fprintf( stderr, "cdsstub: %s\n", qPrintable( host.errorDescription() ) );
+      return 1;
+  }
+
+  // the benchmark waits for this line
+  printf( "READY %s %llu\n",
+          qPrintable( host.rootDevices().first()->info().udn().toSimpleUuid() ),
+          tree.totalItems() );
+  fflush( stdout );
+
+  return app.exec();
+}
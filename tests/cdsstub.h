@@ -0,0 +1,118 @@
+#ifndef CDSSTUB_H
+#define CDSSTUB_H
+
+#include <QAtomicInt>
+#include <QElapsedTimer>
+#include <QMutex>
+
+#include <HUpnpCore/HUpnp>
+#include <HUpnpCore/HActionArguments>
+#include <HUpnpCore/HServerService>
+#include <HUpnpCore/HDeviceModelCreator>
+
+/**
+ * Shape of the synthetic ContentDirectory.
+ *
+ * Every container above @c depth has @c fanout child containers,
+ * every container at @c depth has @c items child items.
+ * A depth of 0 gives a flat root holding @c items items.
+ */
+struct StubTree {
+    uint depth;
+    uint fanout;
+    uint items;
+    // cap on NumberReturned, like minidlna and friends, 0 is unlimited
+    uint maxPage;
+    // added to every Browse/Search
+    uint latency;
+    // uniformly distributed delay on top of latency
+    uint jitter;
+
+    // Faults, applied to Browse/Search only.
+    // percentage of requests answered only after the client timed out
+    uint dropRate;
+    // percentage of requests failing like a reset connection
+    uint resetRate;
+    // requests arriving sooner than this many msecs after
+    // the last accepted one are refused, like MediaTomb does
+    uint throttle;
+    uint seed;
+
+    quint64 totalItems() const;
+};
+
+/**
+ * A ContentDirectory which generates its DIDL-Lite on the fly
+ * from object IDs, so even a million item library costs
+ * no memory on the server side.
+ *
+ * Container IDs are the dotted child indices from the root,
+ * '0.3.1', items append ':<index>' to their container, '0.3.1:17'.
+ */
+class ContentDirectoryStub : public Herqq::Upnp::HServerService
+{
+  Q_OBJECT
+  public:
+    ContentDirectoryStub( const StubTree &tree );
+
+    qint32 getSearchCapabilities( const Herqq::Upnp::HActionArguments &inArgs, Herqq::Upnp::HActionArguments *outArgs );
+    qint32 getSortCapabilities( const Herqq::Upnp::HActionArguments &inArgs, Herqq::Upnp::HActionArguments *outArgs );
+    qint32 getSystemUpdateId( const Herqq::Upnp::HActionArguments &inArgs, Herqq::Upnp::HActionArguments *outArgs );
+    qint32 browse( const Herqq::Upnp::HActionArguments &inArgs, Herqq::Upnp::HActionArguments *outArgs );
+    qint32 search( const Herqq::Upnp::HActionArguments &inArgs, Herqq::Upnp::HActionArguments *outArgs );
+
+  protected:
+    virtual HActionInvokes createActionInvokes();
+
+  private:
+    enum Fault {
+        NoFault,
+        Drop,
+        Reset,
+        Throttle
+    };
+    typedef qint32 (ContentDirectoryStub::*Handler)( const Herqq::Upnp::HActionArguments &, Herqq::Upnp::HActionArguments * );
+
+    qint32 serve( const char *action, Handler handler,
+                  const Herqq::Upnp::HActionArguments &inArgs, Herqq::Upnp::HActionArguments *outArgs );
+    qint32 doBrowse( const Herqq::Upnp::HActionArguments &inArgs, Herqq::Upnp::HActionArguments *outArgs );
+    qint32 doSearch( const Herqq::Upnp::HActionArguments &inArgs, Herqq::Upnp::HActionArguments *outArgs );
+    Fault nextFault();
+    uint random( uint bound );
+    void logRequest( const char *action, const char *outcome, qint64 msecs );
+
+    bool isValidId( const QString &id ) const;
+    bool isContainer( const QString &id ) const;
+    uint level( const QString &id ) const;
+    uint childCount( const QString &id ) const;
+    QString childId( const QString &id, uint index ) const;
+    QString parentId( const QString &id ) const;
+    uint indexInParent( const QString &id ) const;
+    QString objectXml( const QString &id ) const;
+    void finish( Herqq::Upnp::HActionArguments *outArgs, const QString &didl, uint returned, uint total );
+
+    StubTree m_tree;
+    QAtomicInt m_invocations;
+
+    // actions run on HUpnp's thread pool
+    QMutex m_mutex;
+    quint32 m_random;
+    QElapsedTimer m_lastAccepted;
+};
+
+class StubModelCreator : public Herqq::Upnp::HDeviceModelCreator
+{
+  public:
+    StubModelCreator( const StubTree &tree );
+
+    virtual Herqq::Upnp::HServerService* createService( const Herqq::Upnp::HServiceInfo &serviceInfo,
+                                                        const Herqq::Upnp::HDeviceInfo &parentDeviceInfo ) const;
+
+  protected:
+    virtual StubModelCreator* newInstance() const;
+
+  private:
+    StubTree m_tree;
+};
+
+#endif
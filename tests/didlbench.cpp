@@ -0,0 +1,233 @@
+#include "didlbench.h"
+
+#include <cstdio>
+#include <cstdlib>
+
+#include <QCoreApplication>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFile>
+
+#include <KAboutData>
+#include <KCmdLineArgs>
+#include <KComponentData>
+#include <kio/udsentry.h>
+
+#include "../controlpointthread.h"
+#include "../didlparser.h"
+#include "../didlobjects.h"
+#include "../listingparser.h"
+#include "../stringpool.h"
+
+// Count every heap allocation, QString data included,
+// which goes through qMalloc() rather than operator new.
+static quint64 s_allocations = 0;
+
+#ifdef __GLIBC__
+extern "C" {
+void *__libc_malloc( size_t size );
+void *__libc_calloc( size_t nmemb, size_t size );
+void *__libc_realloc( void *ptr, size_t size );
+
+void *malloc( size_t size )
+{
+    ++s_allocations;
+    return __libc_malloc( size );
+}
+
+void *calloc( size_t nmemb, size_t size )
+{
+    ++s_allocations;
+    return __libc_calloc( nmemb, size );
+}
+
+void *realloc( void *ptr, size_t size )
+{
+    ++s_allocations;
+    return __libc_realloc( ptr, size );
+}
+}
+#endif
+
+#define SCALED_OBJECTS 10000
+
+didlbench::didlbench( bool fill )
+    : QObject(0)
+    , m_fill( fill )
+    , m_objects( 0 )
+    , m_stopAfter( 0 )
+{
+}
+
+QStringList didlbench::listingProperties()
+{
+    return ControlPointThread::listingProperties();
+}
+
+void didlbench::item( DIDL::Item *item )
+{
+    if( m_fill ) {
+        KIO::UDSEntry entry;
+        ControlPointThread::fillItem( entry, item );
+    }
+    objectDone();
+}
+
+void didlbench::container( DIDL::Container *container )
+{
+    if( m_fill ) {
+        KIO::UDSEntry entry;
+        ControlPointThread::fillContainer( entry, container );
+    }
+    objectDone();
+}
+
+void didlbench::entry( const KIO::UDSEntry & )
+{
+    objectDone();
+}
+
+void didlbench::objectDone()
+{
+    m_objects++;
+    if( m_stopAfter && m_objects >= m_stopAfter )
+        static_cast<DIDL::Parser *>( sender() )->stop();
+}
+
+/**
+ * Repeats the objects in @c didl until there are
+ * at least @c objects of them, keeping the DIDL-Lite
+ * root element, to get a large page out of a recorded small one.
+ */
+static QByteArray scale( const QByteArray &didl, int objects )
+{
+    const int bodyStart = didl.indexOf( '>', didl.indexOf( "<DIDL-Lite" ) ) + 1;
+    const int bodyEnd = didl.lastIndexOf( "</DIDL-Lite>" );
+    const QByteArray body = didl.mid( bodyStart, bodyEnd - bodyStart );
+    const int perBody = body.count( "<item " ) + body.count( "<container " );
+    if( perBody == 0 )
+        return didl;
+
+    QByteArray scaled = didl.left( bodyStart );
+    for( int i = 0; i < objects; i += perBody )
+        scaled += body;
+    scaled += didl.mid( bodyEnd );
+    return scaled;
+}
+
+enum Mode {
+    // the whole document, from a QString like HUpnp hands it over
+    ParseAll,
+    // only what a listing uses
+    ParseListing,
+    // only what a listing uses, straight from the encoded reply
+    ParseListingUtf8,
+    // what a listing did, UDSEntries filled from the objects
+    Fill,
+    // what a listing does, UDSEntries straight from the document
+    Entries,
+    // titles and IDs until the middle object, like path resolution
+    Resolve
+};
+
+static void run( const QString &name, const QByteArray &didl, Mode mode, int minRuns, DIDL::Parser::Backend backend )
+{
+    const char *modeNames[] = { "all", "listing", "utf8", "fill", "entries", "resolve" };
+    const QString input = QString::fromUtf8( didl );
+
+    didlbench receiver( mode == Fill );
+    if( mode == Resolve )
+        receiver.setStopAfter( qMax( 1, ( didl.count( "<item " ) + didl.count( "<container " ) ) / 2 ) );
+    // lives as long as the device would, across pages
+    StringPool strings;
+    quint64 runs = 0;
+    quint64 objects = 0;
+    quint64 allocations = 0;
+    QElapsedTimer timer;
+    timer.start();
+    do {
+        receiver.resetObjects();
+        const quint64 allocationsBefore = s_allocations;
+
+        if( mode == Entries ) {
+            ListingParser parser;
+            parser.setBackend( backend );
+            parser.setStringPool( &strings );
+            QObject::connect( &parser, SIGNAL(entryParsed(const KIO::UDSEntry &)),
+                              &receiver, SLOT(entry(const KIO::UDSEntry &)) );
+            parser.parse( input );
+        }
+        else {
+            DIDL::Parser parser;
+            parser.setBackend( backend );
+            if( mode == Resolve )
+                parser.setWantedProperties( QStringList() );
+            else if( mode != ParseAll )
+                parser.setWantedProperties( didlbench::listingProperties() );
+            if( mode == Fill )
+                parser.setStringPool( &strings );
+            QObject::connect( &parser, SIGNAL(itemParsed(DIDL::Item *)),
+                              &receiver, SLOT(item(DIDL::Item *)) );
+            QObject::connect( &parser, SIGNAL(containerParsed(DIDL::Container *)),
+                              &receiver, SLOT(container(DIDL::Container *)) );
+            if( mode == ParseListingUtf8 )
+                parser.parse( didl );
+            else
+                parser.parse( input );
+        }
+
+        allocations += s_allocations - allocationsBefore;
+        objects += receiver.objects();
+        runs++;
+    } while( runs < (quint64)minRuns || timer.elapsed() < 1000 );
+    const double seconds = timer.nsecsElapsed() / 1e9;
+
+    printf( "%-32s %-7s %8d B %6llu obj  %9.2f MB/s  %11.0f obj/s  %7.1f allocs/obj\n",
+            qPrintable( name ),
+            modeNames[mode],
+            didl.size(),
+            objects / runs,
+            didl.size() * runs / seconds / ( 1024 * 1024 ),
+            objects / seconds,
+            objects ? double( allocations ) / objects : 0.0 );
+}
+
+int main (int argc, char *argv[])
+{
+  const QByteArray& ba=QByteArray("didlbench");
+  const KLocalizedString name=ki18n("didlbench");
+  KAboutData aboutData( ba, ba, name, ba, name);
+  KCmdLineArgs::init( argc, argv, &aboutData );
+
+  KCmdLineOptions options;
+  options.add("corpus <dir>", ki18n("Directory of recorded DIDL-Lite payloads"), DIDLBENCH_CORPUS_DIR);
+  options.add("runs <count>", ki18n("Minimum runs per payload"), "5");
+  options.add("scanner", ki18n("Read with the DIDL::Scanner instead of QXmlStreamReader"));
+  KCmdLineArgs::addCmdLineOptions(options);
+
+  QCoreApplication app( KCmdLineArgs::qtArgc(), KCmdLineArgs::qtArgv() );
+  KComponentData component( &aboutData );
+  KCmdLineArgs *args = KCmdLineArgs::parsedArgs();
+
+  QDir corpus( args->getOption("corpus") );
+  const int minRuns = qMax( 1, args->getOption("runs").toInt() );
+  const DIDL::Parser::Backend backend = args->isSet("scanner")
+      ? DIDL::Parser::ScannerBackend : DIDL::Parser::StreamReaderBackend;
+
+  foreach( const QString &fileName, corpus.entryList( QStringList() << QLatin1String("*.xml"), QDir::Files, QDir::Name ) ) {
+      QFile file( corpus.filePath( fileName ) );
+      if( !file.open( QIODevice::ReadOnly ) ) {
+          fprintf( stderr, "didlbench: cannot read %s\n", qPrintable( file.fileName() ) );
+          continue;
+      }
+      const QByteArray didl = file.readAll();
+      const QByteArray large = scale( didl, SCALED_OBJECTS );
+      const QString largeName = fileName + QLatin1String(" x10k");
+
+      for( int mode = ParseAll; mode <= Resolve; ++mode )
+          run( fileName, didl, Mode( mode ), minRuns, backend );
+      for( int mode = ParseAll; mode <= Resolve; ++mode )
+          run( largeName, large, Mode( mode ), minRuns, backend );
+  }
+  return 0;
+}
@@ -0,0 +1,43 @@
+#include <QObject>
+#include <QStringList>
+
+namespace KIO {
+    class UDSEntry;
+}
+
+namespace DIDL {
+    class Item;
+    class Container;
+}
+
+/**
+ * Receives the Parser's objects, optionally turning
+ * them into UDSEntries the way a listing did, or
+ * the ListingParser's entries.
+ */
+class didlbench : public QObject
+{
+  Q_OBJECT
+  public:
+    didlbench( bool fill );
+
+    // what the slave asks the Parser for when listing
+    static QStringList listingProperties();
+
+    quint64 objects() const { return m_objects; }
+    void resetObjects() { m_objects = 0; }
+    // stops the parser like path resolution does once it finds its title
+    void setStopAfter( quint64 objects ) { m_stopAfter = objects; }
+
+  public slots:
+    void item( DIDL::Item * );
+    void container( DIDL::Container * );
+    void entry( const KIO::UDSEntry & );
+
+  private:
+    void objectDone();
+
+    bool m_fill;
+    quint64 m_objects;
+    quint64 m_stopAfter;
+};
@@ -0,0 +1,281 @@
+#include "didlscannertest.h"
+
+#include <cstdio>
+
+#include <QCoreApplication>
+#include <QDir>
+#include <QFile>
+
+#include <KAboutData>
+#include <KCmdLineArgs>
+#include <KComponentData>
+#include <kio/udsentry.h>
+
+#include "../controlpointthread.h"
+#include "../didlparser.h"
+#include "../didlobjects.h"
+#include "../listingparser.h"
+
+static QString show( const QString &value )
+{
+    return value.isNull() ? QString::fromLatin1("<null>") : QLatin1Char('"') + value + QLatin1Char('"');
+}
+
+static void addObject( QStringList &lines, const QString &kind, const DIDL::Object *object )
+{
+    lines << kind + QLatin1Char(' ') + show( object->id() )
+        + QLatin1String(" parent=") + show( object->parentId() )
+        + QLatin1String(" restricted=") + QString::number( object->restricted() )
+        + QLatin1String(" title=") + show( object->title() )
+        + QLatin1String(" class=") + show( object->upnpClass() );
+    for( int i = 0; i < DIDL::PropertyCount; ++i )
+        lines << QLatin1String("  property ") + QString::number( i ) + QLatin1Char(' ')
+            + show( object->property( DIDL::Property( i ) ) );
+    const DIDL::ExtraData extra = object->data();
+    QStringList keys = extra.keys();
+    keys.sort();
+    foreach( const QString &key, keys )
+        lines << QLatin1String("  data ") + key + QLatin1Char(' ') + show( extra[key] );
+}
+
+void didlscannertest::item( DIDL::Item *item )
+{
+    addObject( m_lines, QLatin1String("item"), item );
+    m_lines << QLatin1String("  refID ") + show( item->refId() );
+    if( !item->hasResource() )
+        return;
+    const DIDL::Resource &res = item->resource();
+    for( int i = 0; i < DIDL::ResourcePropertyCount; ++i )
+        m_lines << QLatin1String("  res ") + QString::number( i ) + QLatin1Char(' ')
+            + show( res.value( DIDL::ResourceProperty( i ) ) );
+    const DIDL::ExtraData extra = res.extra();
+    QStringList keys = extra.keys();
+    keys.sort();
+    foreach( const QString &key, keys )
+        m_lines << QLatin1String("  res ") + key + QLatin1Char(' ') + show( extra[key] );
+}
+
+void didlscannertest::container( DIDL::Container *container )
+{
+    addObject( m_lines, QLatin1String("container"), container );
+}
+
+void didlscannertest::description( DIDL::Description *description )
+{
+    m_lines << QLatin1String("desc ") + show( description->id() )
+        + QLatin1String(" ns=") + description->nameSpace().toString()
+        + QLatin1Char(' ') + show( description->description() );
+}
+
+void didlscannertest::entry( const KIO::UDSEntry &entry )
+{
+    QList<uint> fields = entry.listFields();
+    qSort( fields );
+    m_lines << QLatin1String("entry");
+    foreach( uint field, fields ) {
+        m_lines << QLatin1String("  ") + QString::number( field ) + QLatin1Char(' ')
+            + ( entry.isNumber( field ) ? QString::number( entry.numberValue( field ) )
+                                        : show( entry.stringValue( field ) ) );
+    }
+}
+
+void didlscannertest::filledItem( DIDL::Item *item )
+{
+    KIO::UDSEntry entry;
+    ControlPointThread::fillItem( entry, item );
+    this->entry( entry );
+}
+
+void didlscannertest::filledContainer( DIDL::Container *container )
+{
+    KIO::UDSEntry entry;
+    ControlPointThread::fillContainer( entry, container );
+    this->entry( entry );
+}
+
+void didlscannertest::error( const QString &errorString )
+{
+    m_lines << QLatin1String("error ") + errorString;
+}
+
+void didlscannertest::done()
+{
+    m_lines << QLatin1String("done");
+}
+
+enum Input {
+    // DIDL::Parser, everything, from a QString
+    ObjectsFromString,
+    // DIDL::Parser, everything, from the encoded bytes
+    ObjectsFromBytes,
+    // ListingParser, from a QString
+    Entries,
+    // DIDL::Parser through fillItem() and fillContainer()
+    FilledEntries
+};
+
+static QStringList parse( const QByteArray &didl, Input input, DIDL::Parser::Backend backend, bool *scanned )
+{
+    didlscannertest receiver;
+    DIDL::Parser *parser;
+    if( input == Entries ) {
+        parser = new ListingParser;
+        QObject::connect( parser, SIGNAL(entryParsed(const KIO::UDSEntry &)),
+                          &receiver, SLOT(entry(const KIO::UDSEntry &)) );
+    }
+    else if( input == FilledEntries ) {
+        parser = new DIDL::Parser;
+        QObject::connect( parser, SIGNAL(itemParsed(DIDL::Item *)),
+                          &receiver, SLOT(filledItem(DIDL::Item *)) );
+        QObject::connect( parser, SIGNAL(containerParsed(DIDL::Container *)),
+                          &receiver, SLOT(filledContainer(DIDL::Container *)) );
+    }
+    else {
+        parser = new DIDL::Parser;
+        QObject::connect( parser, SIGNAL(itemParsed(DIDL::Item *)),
+                          &receiver, SLOT(item(DIDL::Item *)) );
+        QObject::connect( parser, SIGNAL(containerParsed(DIDL::Container *)),
+                          &receiver, SLOT(container(DIDL::Container *)) );
+        QObject::connect( parser, SIGNAL(descriptionParsed(DIDL::Description *)),
+                          &receiver, SLOT(description(DIDL::Description *)) );
+    }
+    QObject::connect( parser, SIGNAL(error(const QString &)),
+                      &receiver, SLOT(error(const QString &)) );
+    QObject::connect( parser, SIGNAL(done()),
+                      &receiver, SLOT(done()) );
+
+    parser->setBackend( backend );
+    if( input == ObjectsFromBytes )
+        parser->parse( didl );
+    else
+        parser->parse( QString::fromUtf8( didl ) );
+    if( scanned )
+        *scanned = parser->scanned();
+    delete parser;
+    return receiver.lines();
+}
+
+/**
+ * Parses @c didl with both backends, printing whether
+ * the Scanner took it and the first difference, if any.
+ * Returns false if they differ or if the Scanner did not
+ * take a document it should have.
+ */
+static bool compare( const QString &name, const QByteArray &didl, bool scannable )
+{
+    const char *inputNames[] = { "objects", "utf8", "entries" };
+    bool ok = true;
+    for( int input = ObjectsFromString; input <= Entries; ++input ) {
+        bool scanned;
+        const QStringList expected = parse( didl, Input( input ), DIDL::Parser::StreamReaderBackend, 0 );
+        const QStringList actual = parse( didl, Input( input ), DIDL::Parser::ScannerBackend, &scanned );
+
+        int line = 0;
+        while( line < expected.size() && line < actual.size() && expected[line] == actual[line] )
+            ++line;
+        const bool same = expected.size() == actual.size() && line == expected.size();
+
+        printf( "%-40s %-7s %-8s %s\n",
+                qPrintable( name ),
+                inputNames[input],
+                scanned ? "scanned" : "fallback",
+                same ? "same" : "DIFFERENT" );
+        if( !same ) {
+            printf( "  QXmlStreamReader: %s\n  Scanner:          %s\n",
+                    line < expected.size() ? qPrintable( expected[line] ) : "<end>",
+                    line < actual.size() ? qPrintable( actual[line] ) : "<end>" );
+        }
+        if( scanned != scannable )
+            printf( "  expected %s\n", scannable ? "the Scanner to read it" : "a fallback" );
+        ok = ok && same && scanned == scannable;
+    }
+    return ok;
+}
+
+/**
+ * Parses @c didl with ListingParser and with DIDL::Parser
+ * through fillItem() and fillContainer(), which a listing
+ * has to tell apart by nothing. Returns false if the
+ * entries differ.
+ */
+static bool compareEntries( const QString &name, const QByteArray &didl )
+{
+    const QStringList expected = parse( didl, FilledEntries, DIDL::Parser::StreamReaderBackend, 0 );
+    const QStringList actual = parse( didl, Entries, DIDL::Parser::StreamReaderBackend, 0 );
+
+    int line = 0;
+    while( line < expected.size() && line < actual.size() && expected[line] == actual[line] )
+        ++line;
+    const bool same = expected.size() == actual.size() && line == expected.size();
+
+    printf( "%-40s %-7s %-8s %s\n",
+            qPrintable( name ), "filled", "", same ? "same" : "DIFFERENT" );
+    if( !same ) {
+        printf( "  fillItem():     %s\n  ListingParser:  %s\n",
+                line < expected.size() ? qPrintable( expected[line] ) : "<end>",
+                line < actual.size() ? qPrintable( actual[line] ) : "<end>" );
+    }
+    return same;
+}
+
+static QByteArray insertAfter( const QByteArray &didl, const char *marker, const QByteArray &text )
+{
+    QByteArray mutated = didl;
+    const int at = mutated.indexOf( marker );
+    if( at == -1 )
+        return mutated;
+    return mutated.insert( at + qstrlen( marker ), text );
+}
+
+int main (int argc, char *argv[])
+{
+  const QByteArray& ba=QByteArray("didlscannertest");
+  const KLocalizedString name=ki18n("didlscannertest");
+  KAboutData aboutData( ba, ba, name, ba, name);
+  KCmdLineArgs::init( argc, argv, &aboutData );
+
+  KCmdLineOptions options;
+  options.add("corpus <dir>", ki18n("Directory of recorded DIDL-Lite payloads"), DIDLSCANNERTEST_CORPUS_DIR);
+  KCmdLineArgs::addCmdLineOptions(options);
+
+  QCoreApplication app( KCmdLineArgs::qtArgc(), KCmdLineArgs::qtArgv() );
+  KComponentData component( &aboutData );
+  KCmdLineArgs *args = KCmdLineArgs::parsedArgs();
+
+  QDir corpus( args->getOption("corpus") );
+  bool ok = true;
+  foreach( const QString &fileName, corpus.entryList( QStringList() << QLatin1String("*.xml"), QDir::Files, QDir::Name ) ) {
+      QFile file( corpus.filePath( fileName ) );
+      if( !file.open( QIODevice::ReadOnly ) ) {
+          fprintf( stderr, "didlscannertest: cannot read %s\n", qPrintable( file.fileName() ) );
+          ok = false;
+          continue;
+      }
+      const QByteArray didl = file.readAll();
+
+      ok = compare( fileName, didl, true ) && ok;
+      ok = compareEntries( fileName, didl ) && ok;
+
+      // within what the Scanner reads
+      QByteArray entities = didl;
+      entities.replace( "<dc:title>", "<dc:title>&lt;&amp;&#233;&#x1F3B5;&gt; " );
+      ok = compare( fileName + QLatin1String(" +entities"), entities, true ) && ok;
+      ok = compareEntries( fileName + QLatin1String(" +entities"), entities ) && ok;
+
+      // left to QXmlStreamReader
+      ok = compare( fileName + QLatin1String(" truncated"), didl.left( didl.size() / 2 ), false ) && ok;
+      ok = compare( fileName + QLatin1String(" +comment"),
+                    insertAfter( didl, "<dc:title>", "<!-- c -->" ), false ) && ok;
+      ok = compare( fileName + QLatin1String(" +CDATA"),
+                    insertAfter( didl, "<dc:title>", "<![CDATA[<x>]]>" ), false ) && ok;
+      QByteArray crlf = didl;
+      crlf.replace( "\n", "\r\n" );
+      ok = compare( fileName + QLatin1String(" CRLF"), crlf, crlf == didl ) && ok;
+      ok = compare( fileName + QLatin1String(" +entity"),
+                    insertAfter( didl, "<dc:title>", "&unknown;" ), false ) && ok;
+      QByteArray mismatched = didl;
+      mismatched.replace( "</dc:title>", "</dc:titel>" );
+      ok = compare( fileName + QLatin1String(" mismatched"), mismatched, mismatched == didl ) && ok;
+  }
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,39 @@
+#include <QObject>
+#include <QStringList>
+
+namespace KIO {
+    class UDSEntry;
+}
+
+namespace DIDL {
+    class Item;
+    class Container;
+    class Description;
+}
+
+/**
+ * Writes down everything a Parser or ListingParser
+ * emits, one line per signal, so that two parses
+ * of the same document can be compared.
+ */
+class didlscannertest : public QObject
+{
+  Q_OBJECT
+  public:
+    QStringList lines() const { return m_lines; }
+    void clear() { m_lines.clear(); }
+
+  public slots:
+    void item( DIDL::Item * );
+    void container( DIDL::Container * );
+    void description( DIDL::Description * );
+    void entry( const KIO::UDSEntry & );
+    // through ControlPointThread::fillItem() and fillContainer()
+    void filledItem( DIDL::Item * );
+    void filledContainer( DIDL::Container * );
+    void error( const QString & );
+    void done();
+
+  private:
+    QStringList m_lines;
+};
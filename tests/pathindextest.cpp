@@ -0,0 +1,176 @@
+#include <cstdio>
+#include <cstring>
+
+#include <QCoreApplication>
+#include <QFile>
+
+#include <KAboutData>
+#include <KCmdLineArgs>
+#include <KComponentData>
+#include <KTempDir>
+
+#include "../pathindex.h"
+
+// where PathIndex puts things, see the layout in pathindex.cpp
+static const int headerSize = 32;
+static const int stringsLengthOffset = 16;
+static const int recordSize = 7 * sizeof( quint32 );
+static const int recordIdOffset = 0;
+static const int recordIdLengthOffset = 4;
+static const int recordParentIdOffset = 8;
+static const int recordParentIdLengthOffset = 12;
+static const int recordTitleOffset = 16;
+
+static bool check( const char *what, bool ok )
+{
+    printf( "%-60s %s\n", what, ok ? "ok" : "FAILED" );
+    return ok;
+}
+
+static PathIndex::Object object( const char *id, const char *parentId, const QString &title, bool container )
+{
+    PathIndex::Object o;
+    o.id = QLatin1String( id );
+    o.parentId = QLatin1String( parentId );
+    o.title = title;
+    o.container = container;
+    return o;
+}
+
+static QByteArray readFile( const QString &fileName )
+{
+    QFile file( fileName );
+    if( !file.open( QIODevice::ReadOnly ) )
+        return QByteArray();
+    return file.readAll();
+}
+
+static bool writeFile( const QString &fileName, const QByteArray &data )
+{
+    QFile file( fileName );
+    return file.open( QIODevice::WriteOnly | QIODevice::Truncate )
+        && file.write( data ) == data.size();
+}
+
+static quint32 field( const QByteArray &data, int offset )
+{
+    quint32 value;
+    memcpy( &value, data.constData() + offset, sizeof( value ) );
+    return value;
+}
+
+static void setField( QByteArray *data, int offset, quint32 value )
+{
+    memcpy( data->data() + offset, &value, sizeof( value ) );
+}
+
+int main (int argc, char *argv[])
+{
+  const QByteArray& ba=QByteArray("pathindextest");
+  const KLocalizedString name=ki18n("pathindextest");
+  KAboutData aboutData( ba, ba, name, ba, name);
+  KCmdLineArgs::init( argc, argv, &aboutData );
+
+  QCoreApplication app( KCmdLineArgs::qtArgc(), KCmdLineArgs::qtArgv() );
+  KComponentData component( &aboutData );
+
+  KTempDir directory;
+  const QString fileName = directory.name() + QLatin1String("device.index");
+  const QString systemUpdateId = QLatin1String("7");
+
+  QList<PathIndex::Object> objects;
+  objects << object( "1", "0", QLatin1String("Music"), true )
+          << object( "2", "0", QLatin1String("Video"), true )
+          << object( "11", "1", QLatin1String("AC%2fDC"), true )
+          << object( "111", "11", QLatin1String("Back in Black.mp3"), false )
+          << object( "12", "1", QString::fromUtf8("Sigur Rós"), true )
+          << object( "21", "2", QLatin1String("Movie.mkv"), false );
+
+  bool ok = true;
+  ok = check( "write", PathIndex::write( fileName, systemUpdateId, objects ) ) && ok;
+
+  {
+      PathIndex index;
+      ok = check( "open", index.open( fileName, systemUpdateId ) ) && ok;
+      ok = check( "size", index.size() == objects.size() ) && ok;
+      ok = check( "objects", index.objects().size() == objects.size() ) && ok;
+
+      PathIndex::Object found;
+      ok = check( "findPath item",
+                  index.findPath( QLatin1String("/Music/AC%2fDC/Back in Black.mp3"), &found )
+                  && found.id == QLatin1String("111")
+                  && found.parentId == QLatin1String("11")
+                  && found.title == QLatin1String("Back in Black.mp3")
+                  && !found.container ) && ok;
+      ok = check( "findPath container",
+                  index.findPath( QLatin1String("/Music/"), &found )
+                  && found.id == QLatin1String("1")
+                  && found.container ) && ok;
+      ok = check( "findPath non-ASCII title",
+                  index.findPath( QString::fromUtf8("/Music/Sigur Rós"), &found )
+                  && found.id == QLatin1String("12") ) && ok;
+      ok = check( "findPath missing name",
+                  !index.findPath( QLatin1String("/Music/Nothing"), &found ) ) && ok;
+      ok = check( "findPath below an item",
+                  !index.findPath( QLatin1String("/Video/Movie.mkv/x"), &found ) ) && ok;
+      ok = check( "findPath root", !index.findPath( QLatin1String("/"), &found ) ) && ok;
+
+      ok = check( "pathForId item",
+                  index.pathForId( QLatin1String("111") ) == QLatin1String("/Music/AC%2fDC/Back in Black.mp3") ) && ok;
+      ok = check( "pathForId container",
+                  index.pathForId( QLatin1String("2") ) == QLatin1String("/Video") ) && ok;
+      ok = check( "pathForId missing ID", index.pathForId( QLatin1String("999") ).isNull() ) && ok;
+  }
+
+  {
+      PathIndex index;
+      ok = check( "SystemUpdateID mismatch",
+                  !index.open( fileName, QLatin1String("8") ) && !index.isOpen() ) && ok;
+      ok = check( "no SystemUpdateID", !index.open( fileName, QString() ) ) && ok;
+      ok = check( "missing file",
+                  !index.open( directory.name() + QLatin1String("missing.index"), systemUpdateId ) ) && ok;
+  }
+
+  const QByteArray data = readFile( fileName );
+  const QString damaged = directory.name() + QLatin1String("damaged.index");
+  const quint32 stringsLength = field( data, stringsLengthOffset );
+  {
+      PathIndex index;
+      ok = check( "truncated file",
+                  writeFile( damaged, data.left( data.size() - 2 ) )
+                  && !index.open( damaged, systemUpdateId ) ) && ok;
+      ok = check( "truncated header",
+                  writeFile( damaged, data.left( headerSize / 2 ) )
+                  && !index.open( damaged, systemUpdateId ) ) && ok;
+
+      QByteArray magic = data;
+      magic[0] = 'X';
+      ok = check( "bad magic",
+                  writeFile( damaged, magic ) && !index.open( damaged, systemUpdateId ) ) && ok;
+
+      QByteArray offset = data;
+      setField( &offset, headerSize + recordTitleOffset, stringsLength );
+      ok = check( "corrupted offset",
+                  writeFile( damaged, offset ) && !index.open( damaged, systemUpdateId ) ) && ok;
+
+      QByteArray byId = data;
+      setField( &byId, headerSize + objects.size() * recordSize, objects.size() );
+      ok = check( "corrupted ID order",
+                  writeFile( damaged, byId ) && !index.open( damaged, systemUpdateId ) ) && ok;
+  }
+
+  {
+      // within bounds, but the first record is made its own
+      // parent, the paths through it must not loop forever
+      QByteArray loop = data;
+      setField( &loop, headerSize + recordParentIdOffset, field( loop, headerSize + recordIdOffset ) );
+      setField( &loop, headerSize + recordParentIdLengthOffset, field( loop, headerSize + recordIdLengthOffset ) );
+      PathIndex index;
+      ok = check( "corrupted parent offset opens",
+                  writeFile( damaged, loop ) && index.open( damaged, systemUpdateId ) ) && ok;
+      ok = check( "corrupted parent offset pathForId",
+                  index.pathForId( QLatin1String("111") ).isNull() ) && ok;
+  }
+
+  return ok ? 0 : 1;
+}
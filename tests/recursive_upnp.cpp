@@ -11,16 +11,28 @@
 #include <kdebug.h>
 #include "../upnp-ms-types.h"
  
-recursivetest::recursivetest(const KUrl &url)
+recursivetest::recursivetest(const KUrl &url, bool native)
     : QObject(0)
     , m_url(url)
+    , m_native(native)
+    , m_entries(0)
 {
     QTimer::singleShot( 200, this, SLOT(check()) );
 }
 
 void recursivetest::check()
 {
-    KIO::ListJob *job = KIO::listRecursive(m_url);
+    KIO::ListJob *job;
+    m_timer.start();
+    if( m_native ) {
+        // one crawl in the slave, instead of a listDir per directory
+        KUrl url( m_url );
+        url.addQueryItem( QLatin1String("recursive"), QString() );
+        job = KIO::listDir(url);
+    }
+    else {
+        job = KIO::listRecursive(m_url);
+    }
     connect( job, SIGNAL(result(KJob *)), this, SLOT(done(KJob *)));
     connect( job, SIGNAL(entries(KIO::Job *, const KIO::UDSEntryList&)),
             this, SLOT(entries(KIO::Job *, const KIO::UDSEntryList&)), Qt::UniqueConnection);
@@ -41,11 +53,12 @@ void recursivetest::entries(KIO::Job *job, const KIO::UDSEntryList &list )
 //        }
     }
     kDebug() << "-------------------------------------------";
+    m_entries += list.size();
 }
 
 void recursivetest::done(KJob *job)
 {
-    kDebug() << "Done";
+    kDebug() << "Done," << m_entries << "entries in" << m_timer.elapsed() << "ms";
     if( job->error() ) {
         kDebug() << "ERROR!" << job->errorString();
     }
@@ -61,11 +74,12 @@ int main (int argc, char *argv[])
   KCmdLineArgs::init( argc, argv, &aboutData );
 
   KCmdLineOptions options;
+  options.add("native", ki18n("List with the slave's own recursive listing"));
   options.add("+[url]", ki18n("path"));
   KCmdLineArgs::addCmdLineOptions(options);
 
   KApplication khello;
  
-  new recursivetest( KCmdLineArgs::parsedArgs()->url(0).url() );
+  new recursivetest( KCmdLineArgs::parsedArgs()->url(0).url(), KCmdLineArgs::parsedArgs()->isSet("native") );
   khello.exec();
 }
@@ -1,5 +1,6 @@
 
 #include <QObject>
+#include <QElapsedTimer>
 #include <KUrl>
 #include <KIO/NetAccess>
 
@@ -8,7 +9,7 @@ class recursivetest : public QObject
 {
   Q_OBJECT
   public:
-    recursivetest(const KUrl &url);
+    recursivetest(const KUrl &url, bool native);
 
   public slots:
     void done(KJob *);
@@ -17,5 +18,8 @@ class recursivetest : public QObject
 
   private:
     KUrl m_url;
+    bool m_native;
+    uint m_entries;
+    QElapsedTimer m_timer;
 };
 
@@ -0,0 +1,447 @@
+#include "upnpmsbench.h"
+
+#include <cstdio>
+#include <sys/resource.h>
+
+#include <QCoreApplication>
+#include <QEventLoop>
+#include <QHash>
+#include <QProcess>
+#include <QStringList>
+
+#include <KAboutData>
+#include <KCmdLineArgs>
+#include <KComponentData>
+#include <kdebug.h>
+#include <kio/job.h>
+
+#include "../controlpointthread.h"
+#include "../metrics.h"
+#include "../persistentaction.h"
+
+upnpmsbench::upnpmsbench()
+    : QObject(0)
+    , m_cpthread( 0 )
+    , m_running( false )
+    , m_stub( 0 )
+    , m_metrics( 0 )
+    , m_timeouts( 0 )
+    , m_backoffMsecs( 0 )
+{
+    restart();
+}
+
+void upnpmsbench::restart()
+{
+    delete m_cpthread;
+    m_cpthread = new ControlPointThread;
+    bool ok = connect( m_cpthread, SIGNAL( error( int, const QString & ) ),
+                       this, SLOT( slotError( int, const QString & ) ) );
+    Q_ASSERT( ok );
+    Q_UNUSED( ok );
+}
+
+upnpmsbench::~upnpmsbench()
+{
+    delete m_cpthread;
+}
+
+void upnpmsbench::setStub( QProcess *stub )
+{
+    m_stub = stub;
+    connect( m_stub, SIGNAL( readyReadStandardOutput() ),
+             this, SLOT( slotStubOutput() ) );
+}
+
+void upnpmsbench::begin( const QString &operation, const KUrl &url )
+{
+    m_result.operation = operation;
+    m_result.path = url.path();
+    m_result.ok = true;
+    m_result.error = QString();
+    m_result.entries = 0;
+    m_result.deliveries = 0;
+    m_result.firstEntryNs = -1;
+    m_result.totalNs = 0;
+    m_result.requests = 0;
+    m_result.failures = 0;
+    m_result.serverMs = 0;
+    m_result.timeoutMs = 0;
+    m_result.backoffMs = 0;
+    m_result.concurrency = 0;
+    m_lastEntry.clear();
+
+    m_metrics = Metrics::forDevice( url.host() );
+    m_timeouts = m_metrics->timeouts;
+    m_backoffMsecs = m_metrics->backoffMsecs;
+    m_metrics->requestsInFlightPeak = 0;
+    m_running = true;
+    m_timer.start();
+}
+
+void upnpmsbench::waitLoop()
+{
+    // the ControlPointThread may have finished synchronously
+    if( !m_running )
+        return;
+    QEventLoop loop;
+    connect( this, SIGNAL( breakLoop() ),
+             &loop, SLOT( quit() ) );
+    loop.exec();
+}
+
+/**
+ * Takes the time PersistentAction spent on timeouts and
+ * retries from its own Metrics, which know which request
+ * each belongs to however many are in flight.
+ */
+void upnpmsbench::finish()
+{
+    m_result.timeoutMs = ( m_metrics->timeouts - m_timeouts ) * PERSISTENT_ACTION_TIMEOUT;
+    m_result.backoffMs = m_metrics->backoffMsecs - m_backoffMsecs;
+    m_result.concurrency = m_metrics->requestsInFlightPeak;
+}
+
+/**
+ * The log line of the last reply is written before the reply,
+ * but may not have been read yet.
+ */
+void upnpmsbench::drainStub()
+{
+    if( !m_stub )
+        return;
+    m_stub->waitForReadyRead( 50 );
+    slotStubOutput();
+}
+
+/**
+ * Sums up the logged requests. With pipelining, ranges and
+ * crawls several are in flight, so the log can not tell
+ * which retry follows which failure, see finish().
+ */
+void upnpmsbench::slotStubOutput()
+{
+    while( m_stub->canReadLine() ) {
+        const QList<QByteArray> fields = m_stub->readLine().trimmed().split( ' ' );
+        if( fields.size() != 4 || fields[0] != "REQ" )
+            continue;
+
+        m_result.requests++;
+        m_result.serverMs += fields[3].toLongLong();
+        if( fields[2] != "ok" )
+            m_result.failures++;
+    }
+}
+
+upnpmsbench::Result upnpmsbench::listDir( const KUrl &url )
+{
+    begin( QLatin1String("listDir"), url );
+    connect( this, SIGNAL( startListDir( const KUrl &) ),
+             m_cpthread, SLOT( listDir( const KUrl &) ) );
+    connect( m_cpthread, SIGNAL( listEntry( const KIO::UDSEntry &) ),
+             this, SLOT( slotListEntry( const KIO::UDSEntry & ) ) );
+    connect( m_cpthread, SIGNAL( listEntries( const KIO::UDSEntryList &) ),
+             this, SLOT( slotListEntries( const KIO::UDSEntryList & ) ) );
+    connect( m_cpthread, SIGNAL( listingDone() ),
+             this, SLOT( slotListingDone() ) );
+    emit startListDir( url );
+    disconnect( this, SIGNAL( startListDir( const KUrl &) ),
+                m_cpthread, SLOT( listDir( const KUrl &) ) );
+    waitLoop();
+    drainStub();
+    finish();
+    disconnect( m_cpthread, SIGNAL( listEntry( const KIO::UDSEntry &) ),
+                this, SLOT( slotListEntry( const KIO::UDSEntry & ) ) );
+    disconnect( m_cpthread, SIGNAL( listEntries( const KIO::UDSEntryList &) ),
+                this, SLOT( slotListEntries( const KIO::UDSEntryList & ) ) );
+    disconnect( m_cpthread, SIGNAL( listingDone() ),
+                this, SLOT( slotListingDone() ) );
+    return m_result;
+}
+
+upnpmsbench::Result upnpmsbench::stat( const KUrl &url )
+{
+    begin( QLatin1String("stat"), url );
+    connect( this, SIGNAL( startStat( const KUrl &) ),
+             m_cpthread, SLOT( stat( const KUrl &) ) );
+    connect( m_cpthread, SIGNAL( listEntry( const KIO::UDSEntry &) ),
+             this, SLOT( slotStatEntry( const KIO::UDSEntry & ) ) );
+    emit startStat( url );
+    disconnect( this, SIGNAL( startStat( const KUrl &) ),
+                m_cpthread, SLOT( stat( const KUrl &) ) );
+    waitLoop();
+    drainStub();
+    finish();
+    disconnect( m_cpthread, SIGNAL( listEntry( const KIO::UDSEntry &) ),
+                this, SLOT( slotStatEntry( const KIO::UDSEntry & ) ) );
+    return m_result;
+}
+
+/**
+ * UPnPMS::get() is a stat followed by a redirection
+ * to the resource, so that is what is measured.
+ */
+upnpmsbench::Result upnpmsbench::get( const KUrl &url )
+{
+    Result result = stat( url );
+    result.operation = QLatin1String("get");
+    if( result.ok && ( m_lastEntry.isDir() || m_lastEntry.stringValue( KIO::UDSEntry::UDS_TARGET_URL ).isEmpty() ) ) {
+        result.ok = false;
+        result.error = QLatin1String("no resource to redirect to");
+    }
+    return result;
+}
+
+upnpmsbench::Result upnpmsbench::kioListDir( const KUrl &url, int entryBatch )
+{
+    begin( QLatin1String("kio/") + QString::number( entryBatch ), url );
+    KIO::ListJob *job = KIO::listDir( url, KIO::HideProgressInfo );
+    job->addMetaData( QLatin1String("entry-batch"), QString::number( entryBatch ) );
+    connect( job, SIGNAL( entries( KIO::Job *, const KIO::UDSEntryList & ) ),
+             this, SLOT( slotKioEntries( KIO::Job *, const KIO::UDSEntryList & ) ) );
+    connect( job, SIGNAL( result( KJob * ) ),
+             this, SLOT( slotKioResult( KJob * ) ) );
+    waitLoop();
+    drainStub();
+    return m_result;
+}
+
+void upnpmsbench::slotListEntry( const KIO::UDSEntry &entry )
+{
+    if( m_result.firstEntryNs < 0 )
+        m_result.firstEntryNs = m_timer.nsecsElapsed();
+    m_result.entries++;
+    m_result.deliveries++;
+    Q_UNUSED( entry );
+}
+
+void upnpmsbench::slotListEntries( const KIO::UDSEntryList &entries )
+{
+    if( m_result.firstEntryNs < 0 )
+        m_result.firstEntryNs = m_timer.nsecsElapsed();
+    m_result.entries += entries.size();
+    m_result.deliveries++;
+}
+
+/**
+ * The application's side of the slave connection, where
+ * KIO hands over whatever arrived in one message.
+ */
+void upnpmsbench::slotKioEntries( KIO::Job *job, const KIO::UDSEntryList &entries )
+{
+    Q_UNUSED( job );
+    slotListEntries( entries );
+}
+
+void upnpmsbench::slotKioResult( KJob *job )
+{
+    m_result.totalNs = m_timer.nsecsElapsed();
+    if( job->error() ) {
+        m_result.ok = false;
+        m_result.error = job->errorString();
+    }
+    m_running = false;
+    emit breakLoop();
+}
+
+void upnpmsbench::slotStatEntry( const KIO::UDSEntry &entry )
+{
+    m_result.firstEntryNs = m_result.totalNs = m_timer.nsecsElapsed();
+    m_result.entries = 1;
+    m_lastEntry = entry;
+    m_running = false;
+    emit breakLoop();
+}
+
+void upnpmsbench::slotListingDone()
+{
+    m_result.totalNs = m_timer.nsecsElapsed();
+    m_running = false;
+    emit breakLoop();
+}
+
+void upnpmsbench::slotError( int type, const QString &message )
+{
+    Q_UNUSED( type );
+    m_result.totalNs = m_timer.nsecsElapsed();
+    m_result.ok = false;
+    m_result.error = message;
+    m_running = false;
+    emit breakLoop();
+}
+
+static long peakRssKb()
+{
+    struct rusage usage;
+    getrusage( RUSAGE_SELF, &usage );
+    return usage.ru_maxrss;
+}
+
+static void report( const upnpmsbench::Result &r )
+{
+    const double totalMs = r.totalNs / 1e6;
+    printf( "%-8s %-40s ", qPrintable( r.operation ), qPrintable( r.path ) );
+    if( !r.ok ) {
+        printf( "FAILED after %.1f ms: %s\n", totalMs, qPrintable( r.error ) );
+    }
+    else {
+        printf( "entries %7u  deliveries %6u  total %9.1f ms  first %9.1f ms  %10.1f entries/s  rss %ld kB\n",
+                r.entries,
+                r.deliveries,
+                totalMs,
+                r.firstEntryNs < 0 ? 0.0 : r.firstEntryNs / 1e6,
+                totalMs > 0 ? r.entries / ( totalMs / 1e3 ) : 0.0,
+                peakRssKb() );
+    }
+
+    if( r.requests == 0 )
+        return;
+    printf( "%-8s %-40s requests %6u  failed %4u  server %9lld ms",
+            "", "",
+            r.requests,
+            r.failures,
+            r.serverMs );
+    if( r.concurrency == 0 ) {
+        printf( "  not attributed, retries were made by the slave\n" );
+        return;
+    }
+    printf( "  timeouts %7lld ms  backoff %7lld ms", r.timeoutMs, r.backoffMs );
+    if( r.concurrency > 1 ) {
+        // server times and timeouts overlap, they
+        // do not add up to the total any more
+        printf( "  not attributed, %u requests in flight at once\n", r.concurrency );
+        return;
+    }
+    // whatever is left is the slave itself: resolution
+    // throttling, parsing and the HTTP round trips
+    const double otherMs = totalMs - r.serverMs - r.timeoutMs - r.backoffMs;
+    printf( "  other %9.1f ms\n", otherMs );
+}
+
+/**
+ * Starts cdsstub next to this binary and waits for it
+ * to announce its UDN.
+ */
+static QString startStub( QProcess *stub, const QStringList &arguments )
+{
+    stub->setReadChannel( QProcess::StandardOutput );
+    stub->setProcessChannelMode( QProcess::ForwardedErrorChannel );
+    stub->start( QCoreApplication::applicationDirPath() + QLatin1String("/cdsstub"), arguments );
+    if( !stub->waitForStarted() )
+        return QString();
+
+    while( stub->waitForReadyRead( 10000 ) ) {
+        while( stub->canReadLine() ) {
+            const QString line = QString::fromLatin1( stub->readLine() ).trimmed();
+            if( line.startsWith( QLatin1String("READY ") ) )
+                return line.section( QLatin1Char(' '), 1, 1 );
+        }
+    }
+    return QString();
+}
+
+int main (int argc, char *argv[])
+{
+  const QByteArray& ba=QByteArray("upnpmsbench");
+  const KLocalizedString name=ki18n("upnpmsbench");
+  KAboutData aboutData( ba, ba, name, ba, name);
+  KCmdLineArgs::init( argc, argv, &aboutData );
+
+  KCmdLineOptions options;
+  options.add("device <uuid>", ki18n("Benchmark an existing MediaServer instead of starting cdsstub"));
+  options.add("list <path>", ki18n("Directory to list, defaults to the deepest synthetic container"));
+  options.add("stat <path>", ki18n("Path to stat and get, defaults to an item in the listed directory"));
+  options.add("repeat <count>", ki18n("Times every operation is repeated"), "3");
+  options.add("depth <levels>", ki18n("cdsstub: levels of containers below the root"), "2");
+  options.add("fanout <containers>", ki18n("cdsstub: child containers of every non-leaf container"), "10");
+  options.add("items <items>", ki18n("cdsstub: items in every leaf container"), "100");
+  options.add("max-page <count>", ki18n("cdsstub: cap on objects returned per action"), "0");
+  options.add("latency <msecs>", ki18n("cdsstub: delay added to every Browse/Search"));
+  options.add("jitter <msecs>", ki18n("cdsstub: random delay on top of the latency"));
+  options.add("drop-rate <percent>", ki18n("cdsstub: replies held back until the client times out"));
+  options.add("reset-rate <percent>", ki18n("cdsstub: requests failed as if the connection was reset"));
+  options.add("throttle <msecs>", ki18n("cdsstub: refuse requests arriving sooner than this after the last one"));
+  options.add("seed <number>", ki18n("cdsstub: seed for the fault injection"), "1");
+  options.add("faults", ki18n("Preset of a slow, flaky, throttling server for options not given explicitly"));
+  options.add("kio", ki18n("Also list through an installed kio_upnp_ms, sending entries one by one and batched"));
+  options.add("restart", ki18n("Start every repetition without the ObjectCache of the last, as a new slave would"));
+  KCmdLineArgs::addCmdLineOptions(options);
+
+  QCoreApplication app( KCmdLineArgs::qtArgc(), KCmdLineArgs::qtArgv() );
+  KComponentData component( &aboutData );
+  KCmdLineArgs *args = KCmdLineArgs::parsedArgs();
+
+  QProcess stub;
+  QString uuid = args->getOption("device");
+  if( uuid.isEmpty() ) {
+      // roughly a MediaTomb on a busy NAS over wifi
+      QHash<QString, QString> faultPreset;
+      if( args->isSet("faults") ) {
+          faultPreset[QLatin1String("latency")] = QLatin1String("20");
+          faultPreset[QLatin1String("jitter")] = QLatin1String("30");
+          faultPreset[QLatin1String("drop-rate")] = QLatin1String("2");
+          faultPreset[QLatin1String("reset-rate")] = QLatin1String("5");
+          faultPreset[QLatin1String("throttle")] = QLatin1String("200");
+      }
+
+      QStringList stubArgs;
+      foreach( const char *option, QList<const char*>() << "depth" << "fanout" << "items" << "max-page" << "latency"
+                                                       << "jitter" << "drop-rate" << "reset-rate" << "throttle" << "seed" ) {
+          const QString name = QLatin1String(option);
+          QString value = args->getOption(option);
+          // the delay and fault options have no default, so that
+          // the preset can tell whether they were given
+          if( value.isEmpty() )
+              value = faultPreset.value( name, QLatin1String("0") );
+          stubArgs << QLatin1String("--") + name << value;
+      }
+      uuid = startStub( &stub, stubArgs );
+      if( uuid.isEmpty() ) {
+          fprintf( stderr, "upnpmsbench: could not start cdsstub\n" );
+          return 1;
+      }
+  }
+
+  QString listPath = args->getOption("list");
+  if( listPath.isEmpty() ) {
+      listPath = QLatin1String("/");
+      for( uint i = 0; i < args->getOption("depth").toUInt(); ++i )
+          listPath += QLatin1String("Folder 0/");
+  }
+  QString statPath = args->getOption("stat");
+  if( statPath.isEmpty() )
+      statPath = listPath + QLatin1String("Track 00000.mp3");
+
+  const KUrl base( QLatin1String("upnp-ms://") + uuid );
+  KUrl listUrl( base );
+  listUrl.setPath( listPath );
+  KUrl statUrl( base );
+  statUrl.setPath( statPath );
+
+  const int repeat = qMax( 1, args->getOption("repeat").toInt() );
+
+  upnpmsbench bench;
+  if( stub.state() != QProcess::NotRunning )
+      bench.setStub( &stub );
+  // the first run includes device discovery and a cold ObjectCache,
+  // later ones show the steady state, or with --restart the
+  // cold start of a slave which has an index to go by
+  for( int i = 0; i < repeat; ++i ) {
+      if( i > 0 && args->isSet("restart") )
+          bench.restart();
+      report( bench.listDir( listUrl ) );
+      report( bench.stat( statUrl ) );
+      report( bench.get( statUrl ) );
+      if( args->isSet("kio") ) {
+          report( bench.kioListDir( listUrl, 0 ) );
+          report( bench.kioListDir( listUrl, ENTRY_BATCH_SIZE ) );
+      }
+  }
+  printf( "peak RSS %ld kB\n", peakRssKb() );
+
+  if( stub.state() != QProcess::NotRunning ) {
+      stub.terminate();
+      stub.waitForFinished();
+  }
+  return 0;
+}
@@ -0,0 +1,106 @@
+#include <QObject>
+#include <QElapsedTimer>
+#include <KUrl>
+#include <kio/udsentry.h>
+
+class KJob;
+class QProcess;
+class ControlPointThread;
+class Metrics;
+
+namespace KIO {
+    class Job;
+}
+
+/**
+ * Drives the ControlPointThread exactly like UPnPMS does,
+ * but times what comes back instead of handing it to KIO.
+ */
+class upnpmsbench : public QObject
+{
+  Q_OBJECT
+  public:
+    struct Result {
+        QString operation;
+        QString path;
+        bool ok;
+        QString error;
+        uint entries;
+        // handed to the application, listEntries() batches or single entries
+        uint deliveries;
+        qint64 firstEntryNs;
+        qint64 totalNs;
+
+        // from the cdsstub request log, all in msecs
+        uint requests;
+        uint failures;
+        qint64 serverMs;
+        // from PersistentAction's Metrics, waited for dropped replies
+        qint64 timeoutMs;
+        // and slept before retrying
+        qint64 backoffMs;
+        // most requests in flight at once, 0 if they were made
+        // by another process and the figures above are not known
+        uint concurrency;
+    };
+
+    upnpmsbench();
+    ~upnpmsbench();
+
+    Result listDir( const KUrl &url );
+    Result stat( const KUrl &url );
+    Result get( const KUrl &url );
+
+    /**
+     * Lists @c url with a KIO::ListJob, that is through an
+     * installed kio_upnp_ms running as its own process, the
+     * slave sending @c entryBatch entries at a time ( or one
+     * by one with 0 ) across to the application.
+     */
+    Result kioListDir( const KUrl &url, int entryBatch );
+
+    /**
+     * Attributes time using the request log of a cdsstub
+     * started by the benchmark.
+     */
+    void setStub( QProcess *stub );
+
+    /**
+     * Starts over with a new ControlPointThread, as a new
+     * slave process would, knowing only what is on disk.
+     */
+    void restart();
+
+  signals:
+    void startListDir( const KUrl &url );
+    void startStat( const KUrl &url );
+    void breakLoop();
+
+  private slots:
+    void slotListEntry( const KIO::UDSEntry & );
+    void slotListEntries( const KIO::UDSEntryList & );
+    void slotKioEntries( KIO::Job *, const KIO::UDSEntryList & );
+    void slotKioResult( KJob * );
+    void slotStatEntry( const KIO::UDSEntry & );
+    void slotListingDone();
+    void slotError( int, const QString & );
+    void slotStubOutput();
+
+  private:
+    void begin( const QString &operation, const KUrl &url );
+    void finish();
+    void waitLoop();
+    void drainStub();
+
+    ControlPointThread *m_cpthread;
+    QElapsedTimer m_timer;
+    Result m_result;
+    bool m_running;
+    KIO::UDSEntry m_lastEntry;
+
+    QProcess *m_stub;
+    // of the device benchmarked, and its counters at begin()
+    Metrics *m_metrics;
+    quint64 m_timeouts;
+    quint64 m_backoffMsecs;
+};
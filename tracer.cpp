@@ -0,0 +1,116 @@
+/********************************************************************
+ This file is part of the KDE project.
+
+Copyright (C) 2010 Nikhil Marathe <nsm.nikhil@gmail.com>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*********************************************************************/
+
+#include "tracer.h"
+
+#include <QCoreApplication>
+#include <QDir>
+
+#include <kdebug.h>
+
+Tracer *Tracer::fromEnvironment()
+{
+    const QByteArray directory = qgetenv( TRACE_ENV );
+    if( directory.isEmpty() )
+        return 0;
+    return new Tracer( QFile::decodeName( directory ) );
+}
+
+Tracer *Tracer::instance()
+{
+    static Tracer *tracer = fromEnvironment();
+    return tracer;
+}
+
+static QByteArray jsonString( const QString &string )
+{
+    QByteArray json( "\"" );
+    foreach( const QChar &c, string ) {
+        switch( c.unicode() ) {
+        case '"': json += "\\\""; break;
+        case '\\': json += "\\\\"; break;
+        case '\n': json += "\\n"; break;
+        case '\r': json += "\\r"; break;
+        case '\t': json += "\\t"; break;
+        default:
+            // escaping all of non-ASCII keeps surrogate pairs intact
+            if( c.unicode() < 0x20 || c.unicode() > 0x7e )
+                json += "\\u" + QByteArray::number( c.unicode(), 16 ).rightJustified( 4, '0' );
+            else
+                json += c.toLatin1();
+        }
+    }
+    json += '"';
+    return json;
+}
+
+Tracer::Tracer( const QString &directory )
+    : m_pid( QCoreApplication::applicationPid() )
+{
+    QDir dir( directory );
+    dir.mkpath( QLatin1String(".") );
+    m_file.setFileName( dir.filePath( QString::number( m_pid ) + QLatin1String(".trace.json") ) );
+    if( !m_file.open( QIODevice::WriteOnly | QIODevice::Truncate ) ) {
+        kDebug() << "Cannot trace to" << m_file.fileName();
+        return;
+    }
+    m_clock.start();
+
+    // the JSON array format does not need the closing ']',
+    // which is just as well since slaves are killed
+    write( "[\n" );
+    write( "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":" + QByteArray::number( m_pid )
+           + ",\"args\":{\"name\":" + jsonString( QCoreApplication::applicationName() ) + "}},\n" );
+    kDebug() << "Tracing to" << m_file.fileName();
+}
+
+qint64 Tracer::now() const
+{
+    return m_clock.nsecsElapsed() / 1000;
+}
+
+void Tracer::complete( const char *name, qint64 start, const TraceArguments &arguments )
+{
+    if( !m_file.isOpen() )
+        return;
+
+    const qint64 end = now();
+    QByteArray event( "{\"name\":\"" );
+    event += name;
+    event += "\",\"ph\":\"X\",\"pid\":" + QByteArray::number( m_pid );
+    event += ",\"tid\":0,\"ts\":" + QByteArray::number( start );
+    event += ",\"dur\":" + QByteArray::number( end - start );
+    if( !arguments.isEmpty() ) {
+        event += ",\"args\":{";
+        for( int i = 0; i < arguments.size(); ++i ) {
+            if( i > 0 )
+                event += ',';
+            event += jsonString( QLatin1String( arguments[i].first ) ) + ':' + jsonString( arguments[i].second );
+        }
+        event += '}';
+    }
+    event += "},\n";
+    write( event );
+}
+
+void Tracer::write( const QByteArray &event )
+{
+    m_file.write( event );
+    m_file.flush();
+}
@@ -0,0 +1,113 @@
+/********************************************************************
+ This file is part of the KDE project.
+
+Copyright (C) 2010 Nikhil Marathe <nsm.nikhil@gmail.com>
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*********************************************************************/
+
+#ifndef TRACER_H
+#define TRACER_H
+
+#include <QElapsedTimer>
+#include <QFile>
+#include <QList>
+#include <QPair>
+#include <QString>
+
+#define TRACE_ENV "KIO_UPNP_MS_TRACE"
+
+typedef QPair<const char *, QString> TraceArgument;
+typedef QList<TraceArgument> TraceArguments;
+
+/**
+ * Records where the slave spends its time as
+ * Chrome trace events ( chrome://tracing, Perfetto ).
+ *
+ * Tracing is enabled by pointing the environment variable
+ * KIO_UPNP_MS_TRACE to a directory. Every slave process
+ * writes <directory>/<pid>.trace.json, one complete ("X")
+ * event per span, written as soon as the span ends so that
+ * killed slaves still leave a usable trace.
+ *
+ * When tracing is off instance() returns 0 and spans
+ * cost a single branch.
+ */
+class Tracer
+{
+  public:
+    static Tracer *instance();
+
+    /**
+     * Microseconds on the trace clock, for spans which
+     * begin and end in different functions.
+     */
+    qint64 now() const;
+
+    /**
+     * Records a span named @c name from @c start until now.
+     * @c name must be a string literal.
+     */
+    void complete( const char *name, qint64 start, const TraceArguments &arguments = TraceArguments() );
+
+  private:
+    static Tracer *fromEnvironment();
+    // lives as long as the process, every event is flushed anyway
+    Tracer( const QString &directory );
+    void write( const QByteArray &event );
+
+    QFile m_file;
+    QElapsedTimer m_clock;
+    qint64 m_pid;
+};
+
+/**
+ * Records the span from its construction to its destruction.
+ */
+class TraceSpan
+{
+  public:
+    explicit TraceSpan( const char *name )
+        : m_tracer( Tracer::instance() )
+        , m_name( name )
+        , m_start( m_tracer ? m_tracer->now() : 0 )
+    {
+    }
+
+    ~TraceSpan()
+    {
+        if( m_tracer )
+            m_tracer->complete( m_name, m_start, m_arguments );
+    }
+
+    bool enabled() const { return m_tracer != 0; }
+
+    /**
+     * Attaches @c value to the span. Check enabled() first
+     * when @c value is expensive to compute.
+     */
+    void setArgument( const char *key, const QString &value )
+    {
+        if( m_tracer )
+            m_arguments << qMakePair( key, value );
+    }
+
+  private:
+    Tracer *m_tracer;
+    const char *m_name;
+    qint64 m_start;
+    TraceArguments m_arguments;
+};
+
+#endif